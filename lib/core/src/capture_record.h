@@ -0,0 +1,71 @@
+// Capture store record layout and the rules shared with the host benchmark.
+// Records are fixed size and appended in time order to /captures.bin;
+// repeated values are ids into the line-based string table.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct CaptureRecord {
+    uint16_t bootId;         // increments per boot, orders records across reboots
+    uint16_t ssid;           // interned string ids
+    uint32_t payloadLength;  // bytes of remaining fields in /captures.dat
+    uint32_t capturedAtMs;   // millis() at capture time
+    uint32_t session;        // IPv4 address of the submitting station
+    uint32_t payloadOffset;
+    uint32_t bodyHash;       // FNV-1a of the raw body, for deduplication
+    uint8_t mac[6];          // submitting station, zero if it was not in the table
+    uint16_t portal;
+    uint16_t userAgent;
+    uint16_t platform;
+    uint16_t language;
+    uint16_t timezone;
+};
+static_assert(sizeof(CaptureRecord) == 40, "capture records are stored as raw bytes");
+
+// /captures.bin starts with this header. A store written with another
+// magic, version or record size is cleared at boot rather than misread;
+// stores from before the header are version 1.
+struct CaptureStoreHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t recordSize;
+};
+
+const uint32_t captureStoreMagic = 0x5043524b;   // "KRCP"
+const uint16_t captureStoreVersion = 2;
+
+inline CaptureStoreHeader currentCaptureStoreHeader() {
+    CaptureStoreHeader header = { captureStoreMagic, captureStoreVersion, sizeof(CaptureRecord) };
+    return header;
+}
+
+inline bool captureStoreHeaderValid(const CaptureStoreHeader& header) {
+    return header.magic == captureStoreMagic && header.version == captureStoreVersion &&
+           header.recordSize == sizeof(CaptureRecord);
+}
+
+const uint16_t noCaptureString = 0xffff;
+
+// Longest value the string table holds; longer values are not interned and
+// stay in the record's payload instead
+const size_t captureMaxStringLength = 255;
+
+inline uint32_t captureHash(const char* text, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Whether a stored record came from the same client in the current boot:
+// the station MAC when it is known, otherwise its IP. DHCP leases are
+// handed out again after a reboot, so an IP only identifies a client within
+// one boot.
+inline bool captureSameClient(const CaptureRecord& record, uint16_t bootId, uint32_t session, const uint8_t* mac) {
+    if (record.bootId != bootId) return false;
+    if (mac) return memcmp(record.mac, mac, sizeof(record.mac)) == 0;
+    return record.session == session;
+}
@@ -0,0 +1,80 @@
+// Channel hopping for Karma. Channels 1-13 are swept in order and each gets
+// a dwell between minHopDwell and maxHopDwell, scaled by that channel's
+// smoothed probe yield, so busy channels are heard for longer while quiet
+// ones are still revisited every sweep. The caller owns the radio: it asks
+// due() whether to move on and calls start() once the channel is set.
+#pragma once
+
+#include <stdint.h>
+
+const uint8_t hopChannelCount = 13;
+const uint32_t minHopDwell = 120;
+const uint32_t maxHopDwell = 600;
+
+struct ChannelStats {
+    uint32_t probes;         // probes heard on this channel
+    uint32_t visits;
+    uint32_t dwellMs;        // total time parked here
+    uint32_t yieldEwma;      // probes per second, x16, smoothed over visits
+};
+
+struct ChannelHopper {
+    ChannelStats stats[hopChannelCount];
+    uint8_t channel;         // 0 while not hopping
+    uint32_t dwell;
+    uint32_t probes;         // probes heard during the current dwell
+    uint32_t startMs;
+
+    // Dwell for the channel's share of the yield seen across all channels. A
+    // channel nobody has probed on yet still gets the minimum.
+    uint32_t dwellFor(uint8_t next) const {
+        uint32_t best = 0;
+        for (int i = 0; i < hopChannelCount; i++) {
+            if (stats[i].yieldEwma > best) best = stats[i].yieldEwma;
+        }
+        if (best == 0) return minHopDwell;
+        return minHopDwell + (maxHopDwell - minHopDwell) * stats[next - 1].yieldEwma / best;
+    }
+
+    void start(uint8_t next, uint32_t nowMs) {
+        channel = next;
+        dwell = dwellFor(next);
+        probes = 0;
+        startMs = nowMs;
+        stats[next - 1].visits++;
+    }
+
+    void noteProbe(uint8_t probeChannel) {
+        if (probeChannel < 1 || probeChannel > hopChannelCount) return;
+        stats[probeChannel - 1].probes++;
+        if (probeChannel == channel) probes++;
+    }
+
+    // Closes the current dwell: folds its probe rate into the channel's yield
+    void finishDwell(uint32_t nowMs) {
+        if (channel == 0) return;
+        ChannelStats& current = stats[channel - 1];
+        uint32_t elapsed = nowMs - startMs;
+        if (elapsed == 0) elapsed = 1;
+        uint32_t rate = probes * 16000 / elapsed;
+        current.dwellMs += elapsed;
+        current.yieldEwma = (current.yieldEwma * 3 + rate) / 4;
+    }
+
+    // Whether it's time to hop, and to which channel. Closes the dwell first
+    // unless it ran far over, which means an AP was up in between and its
+    // channel says nothing about yield.
+    bool due(uint32_t nowMs, uint8_t& next) {
+        if (channel != 0) {
+            uint32_t elapsed = nowMs - startMs;
+            if (elapsed <= maxHopDwell * 2) {
+                if (elapsed < dwell) return false;
+                finishDwell(nowMs);
+            }
+        }
+        next = channel % hopChannelCount + 1;
+        return true;
+    }
+
+    void stop() { channel = 0; }
+};
@@ -0,0 +1,129 @@
+// Streaming response bodies. ChunkedWriter collects output in a fixed buffer
+// and hands it to a sink a chunk at a time, so a body is never built in a
+// heap string; JsonWriter layers escaped JSON on top of it. The sink gets a
+// zero-length chunk when the body ends.
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <type_traits>
+
+class ChunkedWriter {
+public:
+    typedef void (*Sink)(void* context, const char* data, size_t length);
+
+    ChunkedWriter(Sink chunkSink, void* sinkContext) : sink(chunkSink), context(sinkContext) {}
+
+    // Unescaped output
+    void raw(char c) { put(c); }
+    void raw(const char* text) { write(text); }
+
+    // Flushes the buffer and terminates the body; returns body bytes
+    size_t end() {
+        flush();
+        sink(context, "", 0);
+        return total;
+    }
+
+protected:
+    void put(char c) {
+        if (used == sizeof(buffer)) flush();
+        buffer[used++] = c;
+    }
+
+    void write(const char* text) {
+        while (*text) put(*text++);
+    }
+
+private:
+    Sink sink;
+    void* context;
+    char buffer[256];
+    size_t used = 0;
+    size_t total = 0;
+
+    void flush() {
+        if (used == 0) return;
+        sink(context, buffer, used);
+        total += used;
+        used = 0;
+    }
+};
+
+class JsonWriter : public ChunkedWriter {
+public:
+    JsonWriter(Sink chunkSink, void* sinkContext) : ChunkedWriter(chunkSink, sinkContext) {}
+
+    void beginObject() { separate(); put('{'); needComma = false; }
+    void endObject() { put('}'); needComma = true; }
+    void beginArray() { separate(); put('['); needComma = false; }
+    void endArray() { put(']'); needComma = true; }
+
+    void key(const char* name) {
+        separate();
+        put('"');
+        writeEscaped(name);
+        put('"');
+        put(':');
+        needComma = false;
+    }
+
+    // Strings can be assembled from several parts between begin and end
+    void beginString() { separate(); put('"'); }
+    void appendString(const char* text) { writeEscaped(text); }
+    void endString() { put('"'); needComma = true; }
+
+    void value(const char* text) { beginString(); appendString(text); endString(); }
+    void value(bool flag) { separate(); write(flag ? "true" : "false"); needComma = true; }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type
+    value(T number) {
+        char digits[21];
+        if (std::is_signed<T>::value) {
+            snprintf(digits, sizeof(digits), "%lld", (long long)number);
+        } else {
+            snprintf(digits, sizeof(digits), "%llu", (unsigned long long)number);
+        }
+        separate();
+        write(digits);
+        needComma = true;
+    }
+
+    template <typename T>
+    void field(const char* name, T fieldValue) { key(name); value(fieldValue); }
+
+    // A pre-serialized member follows as raw output
+    void rawMember() { separate(); needComma = true; }
+    // Ends a record in newline-delimited output
+    void newline() { put('\n'); needComma = false; }
+
+private:
+    bool needComma = false;
+
+    void separate() {
+        if (needComma) put(',');
+    }
+
+    void writeEscaped(const char* text) {
+        for (; *text; text++) {
+            unsigned char c = *text;
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            } else if (c == '\n') {
+                write("\\n");
+            } else if (c == '\r') {
+                write("\\r");
+            } else if (c == '\t') {
+                write("\\t");
+            } else if (c < 0x20) {
+                char escape[7];
+                snprintf(escape, sizeof(escape), "\\u%04x", c);
+                write(escape);
+            } else {
+                put(c);
+            }
+        }
+    }
+};
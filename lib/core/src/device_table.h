@@ -0,0 +1,184 @@
+// Devices heard probing during a Karma run. Records are found by source MAC
+// through an open-addressed index and kept in LRU order, so a full table
+// evicts whoever has been quiet longest. Each device keeps a bitset over the
+// probed-SSID table, which lets every SSID carry a count of distinct devices
+// asking for it. Every operation is O(1) apart from the SSID table scan,
+// which is bounded by maxProbedSSIDs.
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include "capture_record.h"
+#include "probe_sniffer.h"
+
+const int maxProbedSSIDs = 64;            // one bit each in DeviceRecord::ssids
+
+struct DeviceRecord {
+    uint8_t mac[6];
+    int16_t rssiEwma;                     // dBm x16
+    int16_t prev;                         // LRU neighbours, -1 at the ends
+    int16_t next;
+    uint32_t macHash;
+    uint32_t firstSeen;
+    uint32_t lastSeen;
+    uint32_t probes;
+    uint32_t fingerprint;                 // hash of IE order, rates and HT/VHT caps
+    uint64_t ssids;
+};
+static_assert(sizeof(DeviceRecord) == 40, "field order keeps records free of padding");
+
+struct ProbedSSID {
+    char ssid[33];
+    uint32_t hash;
+    uint16_t devices;
+    uint32_t probes;
+};
+
+inline uint32_t macHash(const uint8_t* mac) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 6; i++) hash = (hash ^ mac[i]) * 16777619u;
+    return hash;
+}
+
+template<int MaxDevices>
+struct DeviceTable {
+    static const int indexSize = MaxDevices * 2;   // power of two, load at most one half
+    static_assert((indexSize & (indexSize - 1)) == 0, "MaxDevices must be a power of two");
+    static_assert(MaxDevices < 32767, "device ids are int16_t");
+
+    DeviceRecord devices[MaxDevices];
+    int16_t index[indexSize];             // device + 1, 0 when empty
+    int count = 0;
+    int16_t lruHead = -1;                 // most recently heard
+    int16_t lruTail = -1;
+    uint32_t evicted = 0;
+    ProbedSSID ssids[maxProbedSSIDs];
+    int ssidCount = 0;
+    uint32_t untrackedProbes = 0;         // probes for SSIDs past the table
+
+    void reset() {
+        memset(index, 0, sizeof(index));
+        count = 0;
+        lruHead = lruTail = -1;
+        ssidCount = 0;
+        untrackedProbes = 0;
+    }
+
+    // Records one probe and returns how many distinct devices have asked for
+    // its SSID (0 for wildcard probes or SSIDs past the table)
+    uint16_t noteProbe(const ProbeRecord& probe, uint32_t now) {
+        const uint32_t mask = indexSize - 1;
+        uint32_t hash = macHash(probe.mac);
+        uint32_t slot = hash & mask;
+        int16_t device = -1;
+        for (; index[slot]; slot = (slot + 1) & mask) {
+            int16_t candidate = index[slot] - 1;
+            if (devices[candidate].macHash == hash && memcmp(devices[candidate].mac, probe.mac, 6) == 0) {
+                device = candidate;
+                break;
+            }
+        }
+
+        if (device >= 0) {
+            lruUnlink(device);
+        } else {
+            if (count < MaxDevices) {
+                device = count++;
+            } else {
+                device = lruTail;
+                evict(device);
+                // Eviction may have shifted entries into our probe sequence
+                slot = hash & mask;
+                while (index[slot]) slot = (slot + 1) & mask;
+            }
+            DeviceRecord& record = devices[device];
+            memset(&record, 0, sizeof(record));
+            memcpy(record.mac, probe.mac, 6);
+            record.macHash = hash;
+            record.firstSeen = now;
+            record.rssiEwma = probe.rssi * 16;
+            index[slot] = device + 1;
+        }
+        lruPushFront(device);
+
+        DeviceRecord& record = devices[device];
+        record.lastSeen = now;
+        record.probes++;
+        record.fingerprint = probe.fingerprint;
+        record.rssiEwma += (probe.rssi * 16 - record.rssiEwma) / 4;
+
+        if (!probe.ssid[0]) return 0;
+        int ssid = findSSID(probe.ssid, true);
+        if (ssid < 0) {
+            untrackedProbes++;
+            return 0;
+        }
+        ProbedSSID& entry = ssids[ssid];
+        entry.probes++;
+        if (!(record.ssids & (1ULL << ssid))) {
+            record.ssids |= 1ULL << ssid;
+            entry.devices++;
+        }
+        return entry.devices;
+    }
+
+    int findSSID(const char* ssid, bool create) {
+        uint32_t hash = captureHash(ssid, strlen(ssid));
+        for (int i = 0; i < ssidCount; i++) {
+            if (ssids[i].hash == hash && strcmp(ssids[i].ssid, ssid) == 0) return i;
+        }
+        if (!create || ssidCount >= maxProbedSSIDs) return -1;
+        ProbedSSID& entry = ssids[ssidCount];
+        memset(&entry, 0, sizeof(entry));
+        memcpy(entry.ssid, ssid, strnlen(ssid, sizeof(entry.ssid) - 1));
+        entry.hash = hash;
+        return ssidCount++;
+    }
+
+private:
+    void lruUnlink(int16_t device) {
+        DeviceRecord& record = devices[device];
+        if (record.prev >= 0) devices[record.prev].next = record.next;
+        else lruHead = record.next;
+        if (record.next >= 0) devices[record.next].prev = record.prev;
+        else lruTail = record.prev;
+    }
+
+    void lruPushFront(int16_t device) {
+        DeviceRecord& record = devices[device];
+        record.prev = -1;
+        record.next = lruHead;
+        if (lruHead >= 0) devices[lruHead].prev = device;
+        lruHead = device;
+        if (lruTail < 0) lruTail = device;
+    }
+
+    // Linear-probing delete: shift later entries back into the hole so
+    // lookups never need tombstones
+    void indexRemove(int16_t device) {
+        const uint32_t mask = indexSize - 1;
+        uint32_t hole = devices[device].macHash & mask;
+        while (index[hole] != device + 1) hole = (hole + 1) & mask;
+        index[hole] = 0;
+
+        for (uint32_t slot = (hole + 1) & mask; index[slot]; slot = (slot + 1) & mask) {
+            uint32_t home = devices[index[slot] - 1].macHash & mask;
+            bool homeBetween = hole <= slot ? (home > hole && home <= slot) : (home > hole || home <= slot);
+            if (homeBetween) continue;
+            index[hole] = index[slot];
+            index[slot] = 0;
+            hole = slot;
+        }
+    }
+
+    void evict(int16_t device) {
+        DeviceRecord& record = devices[device];
+        for (int i = 0; i < ssidCount; i++) {
+            if (record.ssids & (1ULL << i)) ssids[i].devices--;
+        }
+        lruUnlink(device);
+        indexRemove(device);
+        evicted++;
+    }
+};
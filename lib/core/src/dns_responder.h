@@ -0,0 +1,147 @@
+// DNS answer builder for the captive portal, shared with the host tests.
+// Every query is answered with the AP address from a cached, pre-encoded
+// resource record; override names get an error rcode instead (e.g. NXDOMAIN
+// for telemetry hosts). Responses are built in place in the query buffer.
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+
+const int dnsMaxPacket = 512;
+const int dnsMaxName = 253;
+const int dnsMaxOverrides = 32;
+const uint32_t dnsAnswerTTL = 60;
+const uint8_t DNS_RCODE_FORMERR = 1;
+const uint8_t DNS_RCODE_NXDOMAIN = 3;
+const uint8_t DNS_RCODE_NOTIMP = 4;
+const uint8_t DNS_RCODE_REFUSED = 5;
+
+struct DnsOverride {
+    char name[dnsMaxName + 1];
+    uint8_t rcode;
+};
+
+struct DnsStats {
+    uint32_t queries;
+    uint32_t answered;
+    uint32_t overridden;
+    uint32_t malformed;
+};
+
+struct DnsResponder {
+    uint8_t wildcardAnswer[16];
+    DnsOverride overrides[dnsMaxOverrides];
+    int overrideCount;
+    DnsStats stats;
+
+    // Answer RR: name pointer to the question, type A, class IN, TTL, address
+    void setAddress(const uint8_t ip[4]) {
+        const uint8_t answer[16] = {
+            0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01,
+            (uint8_t)(dnsAnswerTTL >> 24), (uint8_t)(dnsAnswerTTL >> 16),
+            (uint8_t)(dnsAnswerTTL >> 8), (uint8_t)dnsAnswerTTL,
+            0x00, 0x04, ip[0], ip[1], ip[2], ip[3]
+        };
+        memcpy(wildcardAnswer, answer, sizeof(wildcardAnswer));
+    }
+
+    void clearOverrides() { overrideCount = 0; }
+
+    // name must already be lowercase; false when full or the name is too long
+    bool addOverride(const char* name, uint8_t rcode) {
+        size_t length = strlen(name);
+        if (overrideCount >= dnsMaxOverrides || length == 0 || length > (size_t)dnsMaxName) return false;
+        DnsOverride& entry = overrides[overrideCount++];
+        memcpy(entry.name, name, length + 1);
+        entry.rcode = rcode;
+        return true;
+    }
+
+    // Matches the name itself and any subdomain of an override entry
+    uint8_t overrideFor(const char* name, int nameLength) const {
+        for (int i = 0; i < overrideCount; i++) {
+            const DnsOverride& entry = overrides[i];
+            int entryLength = strlen(entry.name);
+            if (entryLength > nameLength) continue;
+            const char* tail = name + nameLength - entryLength;
+            if (memcmp(tail, entry.name, entryLength) != 0) continue;
+            if (tail == name || tail[-1] == '.') return entry.rcode;
+        }
+        return 0;
+    }
+
+    // Rewrites the query in packet (dnsMaxPacket bytes of room) into its
+    // response in place and returns the response length, or 0 if the packet
+    // should be dropped.
+    int buildResponse(uint8_t* packet, int length) {
+        stats.queries++;
+        int end = answer(packet, length);
+        if (end == 0) stats.malformed++;
+        return end;
+    }
+
+private:
+    int answer(uint8_t* packet, int length) {
+        if (length < 12) return 0;
+        if (packet[2] & 0x80) return 0; // Not a query
+
+        uint8_t opcode = (packet[2] >> 3) & 0x0F;
+        uint16_t questions = (packet[4] << 8) | packet[5];
+
+        // QR + AA, keep opcode and RD; no answers until we know the question
+        packet[2] = 0x84 | (packet[2] & 0x79);
+        packet[3] = 0;
+        memset(&packet[6], 0, 6);
+
+        if (opcode != 0) {
+            packet[3] = DNS_RCODE_NOTIMP;
+            memset(&packet[4], 0, 2);
+            return 12;
+        }
+        if (questions != 1) {
+            packet[3] = DNS_RCODE_FORMERR;
+            memset(&packet[4], 0, 2);
+            return 12;
+        }
+
+        // Walk the QNAME labels, lowercasing into a dotted name
+        char name[dnsMaxName + 1];
+        int nameLength = 0;
+        int pos = 12;
+        while (true) {
+            if (pos >= length) return 0;
+            uint8_t labelLength = packet[pos++];
+            if (labelLength == 0) break;
+            if (labelLength > 63 || pos + labelLength > length) return 0;
+            if (nameLength + labelLength + 1 > dnsMaxName) return 0;
+            if (nameLength > 0) name[nameLength++] = '.';
+            for (int i = 0; i < labelLength; i++) {
+                name[nameLength++] = tolower(packet[pos++]);
+            }
+        }
+        name[nameLength] = '\0';
+        if (pos + 4 > length) return 0;
+
+        uint16_t qtype = (packet[pos] << 8) | packet[pos + 1];
+        uint16_t qclass = (packet[pos + 2] << 8) | packet[pos + 3];
+        int end = pos + 4;
+
+        uint8_t rcode = overrideFor(name, nameLength);
+        if (rcode) {
+            packet[3] = rcode;
+            stats.overridden++;
+            return end;
+        }
+
+        // A (or ANY) in IN gets the portal address; anything else is NODATA so
+        // clients move on immediately instead of waiting for a timeout.
+        if ((qtype == 1 || qtype == 255) && qclass == 1 && end + (int)sizeof(wildcardAnswer) <= dnsMaxPacket) {
+            memcpy(&packet[end], wildcardAnswer, sizeof(wildcardAnswer));
+            packet[7] = 1;
+            end += sizeof(wildcardAnswer);
+            stats.answered++;
+        }
+        return end;
+    }
+};
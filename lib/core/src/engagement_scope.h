@@ -0,0 +1,69 @@
+// Engagement scope decisions shared by the firmware and the host benchmark.
+// A profile holds the compiled scope rules, the time windows and the AP
+// dwell cap; scopeVerdict() is the whole decision for one SSID and touches
+// nothing but its arguments.
+#pragma once
+
+#include <stdint.h>
+
+#include "ssid_matcher.h"
+
+const int maxEngagementWindows = 8;
+
+struct EngagementWindow {
+    uint16_t startMinute;    // minutes since midnight; end < start wraps
+    uint16_t endMinute;
+};
+
+struct EngagementProfile {
+    bool active;
+    SSIDMatcher scope;
+    EngagementWindow windows[maxEngagementWindows];
+    int windowCount;
+    uint32_t maxDwellMs;     // 0 = no cap
+};
+
+enum ScopeVerdict : uint8_t {
+    SCOPE_ALLOWED,
+    SCOPE_WHITELISTED,
+    SCOPE_OUT_OF_SCOPE,
+    SCOPE_OUTSIDE_WINDOW,
+    SCOPE_NO_CLOCK,
+    SCOPE_VERDICT_COUNT
+};
+const char* const scopeVerdictNames[SCOPE_VERDICT_COUNT] = {
+    "allowed", "whitelisted", "out_of_scope", "outside_window", "no_clock"
+};
+
+// One line of /scope_log.txt, queued by the net task for the storage service
+struct ScopeDecision {
+    uint32_t timeMs;
+    int16_t minuteOfDay;     // -1 without a clock
+    uint8_t verdict;
+    char ssid[33];
+};
+
+inline bool insideEngagementWindow(const EngagementProfile& profile, int minute) {
+    for (int i = 0; i < profile.windowCount; i++) {
+        const EngagementWindow& window = profile.windows[i];
+        bool inside = window.startMinute <= window.endMinute
+            ? minute >= window.startMinute && minute < window.endMinute
+            : minute >= window.startMinute || minute < window.endMinute;
+        if (inside) return true;
+    }
+    return false;
+}
+
+// The whitelist applies first, then the profile if one is loaded. minute is
+// the time of day, -1 when the clock was never set.
+inline ScopeVerdict scopeVerdict(const SSIDMatcher& whitelist, const EngagementProfile& profile,
+                                 const char* ssid, int minute) {
+    if (whitelist.matches(ssid)) return SCOPE_WHITELISTED;
+    if (!profile.active) return SCOPE_ALLOWED;
+    if (!profile.scope.matches(ssid)) return SCOPE_OUT_OF_SCOPE;
+    if (profile.windowCount > 0) {
+        if (minute < 0) return SCOPE_NO_CLOCK;
+        if (!insideEngagementWindow(profile, minute)) return SCOPE_OUTSIDE_WINDOW;
+    }
+    return SCOPE_ALLOWED;
+}
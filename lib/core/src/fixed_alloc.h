@@ -0,0 +1,108 @@
+// Fixed-footprint allocators for the firmware's churn-prone temporaries:
+// a bump arena for scratch that dies together, a ring of SSID slots and
+// append-only columns for per-record indexes. None touches the heap.
+#pragma once
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Bump allocator for temporaries that die together. Allocating is a pointer
+// bump and reset() releases everything at once, so per-frame and per-request
+// scratch never fragments the heap. Returns nullptr when full.
+template <size_t Size>
+struct BumpArena {
+    alignas(8) uint8_t buffer[Size];
+    size_t used = 0;
+    size_t highWater = 0;
+    uint32_t overflows = 0;
+
+    void* alloc(size_t bytes, size_t align = alignof(void*)) {
+        size_t start = (used + align - 1) & ~(align - 1);
+        if (start + bytes > Size) {
+            overflows++;
+            return nullptr;
+        }
+        used = start + bytes;
+        if (used > highWater) highWater = used;
+        return buffer + start;
+    }
+
+    template <typename T>
+    T* allocArray(size_t count) {
+        return static_cast<T*>(alloc(sizeof(T) * count, alignof(T)));
+    }
+
+    char* printf(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        int length = vsnprintf(nullptr, 0, format, args);
+        va_end(args);
+        char* text = length < 0 ? nullptr : allocArray<char>(length + 1);
+        if (!text) return nullptr;
+        va_start(args, format);
+        vsnprintf(text, length + 1, format, args);
+        va_end(args);
+        return text;
+    }
+
+    void reset() { used = 0; }
+};
+
+// Saved SSIDs, oldest first, in a fixed ring of slots. Names are copied in
+// place, so adding SSIDs during a long Karma session never touches the heap.
+template <int Capacity>
+struct SSIDPool {
+    char names[Capacity][33];
+    int first = 0;
+    int count = 0;
+
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    const char* operator[](int i) const { return names[(first + i) % Capacity]; }
+    void clear() { first = 0; count = 0; }
+
+    bool contains(const char* ssid) const {
+        for (int i = 0; i < count; i++) {
+            if (strcmp((*this)[i], ssid) == 0) return true;
+        }
+        return false;
+    }
+
+    // Returns true if the oldest entry had to be dropped to make room
+    bool push(const char* ssid) {
+        bool evicted = count == Capacity;
+        if (evicted) {
+            first = (first + 1) % Capacity;
+            count--;
+        }
+        char* slot = names[(first + count) % Capacity];
+        size_t length = strnlen(ssid, sizeof(names[0]) - 1);
+        memcpy(slot, ssid, length);
+        slot[length] = '\0';
+        count++;
+        return evicted;
+    }
+};
+
+// Append-only column of fixed capacity, for per-record indexes that would
+// otherwise grow a std::vector. The storage is part of the object, so filling
+// it never reallocates; push_back() returns false once it is full.
+template <typename T, int Capacity>
+struct FixedColumn {
+    T items[Capacity];
+    int count = 0;
+
+    size_t size() const { return count; }
+    bool full() const { return count == Capacity; }
+    const T& operator[](size_t i) const { return items[i]; }
+    void clear() { count = 0; }
+
+    bool push_back(const T& item) {
+        if (full()) return false;
+        items[count++] = item;
+        return true;
+    }
+};
@@ -0,0 +1,71 @@
+// Multi-producer log ring shared by the firmware and the host benchmark. A
+// slot's sequence is 2 * lap while free for that lap and 2 * lap + 1 once
+// written, so zero-initialised slots start free. Producers claim a position
+// with a CAS on enqueuePos and format straight into the slot; only the
+// consumer reads slots and advances dequeuePos. A full ring drops the message
+// instead of waiting.
+#pragma once
+
+#include <atomic>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+template<int SlotCount, size_t LineSize>
+struct LogRing {
+    static_assert(LineSize < 256, "slot length is a uint8_t");
+
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        uint32_t timeMs;
+        uint8_t level;
+        uint8_t length;
+        char text[LineSize];
+    };
+
+    Slot slots[SlotCount];
+    std::atomic<uint32_t> enqueuePos{0};
+    uint32_t dequeuePos = 0;
+
+    // False when the ring is full and the message was dropped
+    bool write(uint8_t level, uint32_t timeMs, const char* format, va_list args) {
+        uint32_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot;
+        uint32_t lap;
+        for (;;) {
+            slot = &slots[pos % SlotCount];
+            lap = pos / SlotCount;
+            int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - lap * 2);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                // Still holds last lap's message
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        int length = vsnprintf(slot->text, sizeof(slot->text), format, args);
+        slot->timeMs = timeMs;
+        slot->level = level;
+        slot->length = length < 0 ? 0 : length < (int)LineSize ? length : LineSize - 1;
+        slot->sequence.store(lap * 2 + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only: the oldest completed slot, or nullptr when there is none.
+    // release() frees it for producers.
+    const Slot* peek() const {
+        const Slot& slot = slots[dequeuePos % SlotCount];
+        uint32_t lap = dequeuePos / SlotCount;
+        return slot.sequence.load(std::memory_order_acquire) == lap * 2 + 1 ? &slot : nullptr;
+    }
+
+    void release() {
+        uint32_t lap = dequeuePos / SlotCount;
+        slots[dequeuePos % SlotCount].sequence.store(lap * 2 + 2, std::memory_order_release);
+        dequeuePos++;
+    }
+};
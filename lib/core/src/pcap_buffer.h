@@ -0,0 +1,144 @@
+// Double-buffered pcap record writer for probe requests heard while Karma
+// sniffs. The producer (the Wi-Fi RX callback) appends records to one of two
+// RAM buffers and never waits: when the filling buffer is full it swaps to the
+// other only if the consumer has already written it out, otherwise the frame
+// is counted as dropped. The consumer (a core 1 service) takes full buffers
+// with full(), writes them and hands them back with release().
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+const size_t pcapBufferSize = 4096;
+const size_t pcapSnapLength = 256;
+
+// Global file header: microsecond timestamps, LINKTYPE_IEEE802_11_RADIOTAP
+const uint32_t pcapFileHeader[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 127 };
+
+// Radiotap header carrying channel and antenna signal (present bits 3 and 5)
+struct __attribute__((packed)) PcapRadiotap {
+    uint8_t version;
+    uint8_t pad;
+    uint16_t length;
+    uint32_t present;
+    uint16_t frequency;
+    uint16_t channelFlags;
+    int8_t signal;
+};
+
+struct __attribute__((packed)) PcapRecordHeader {
+    uint32_t seconds;
+    uint32_t micros;
+    uint32_t capturedLength;
+    uint32_t originalLength;
+};
+
+enum PcapBufferState : uint8_t { PCAP_FREE, PCAP_FILLING, PCAP_FULL };
+
+struct PcapBuffer {
+    uint8_t data[pcapBufferSize];
+    size_t used;
+    std::atomic<uint8_t> state{PCAP_FREE};
+};
+
+struct PcapStats {
+    std::atomic<uint32_t> frames{0};        // records buffered
+    std::atomic<uint32_t> dropped{0};       // lost to a full double buffer
+    uint32_t bytesWritten;
+    uint32_t rotations;
+    uint32_t writeErrors;
+};
+
+struct PcapDoubleBuffer {
+    PcapBuffer buffers[2];
+    int active = 0;                          // buffer the producer fills
+    std::atomic<bool> flushRequested{false};
+    PcapStats stats;
+
+    // Consumer side, while the producer is stopped
+    void reset() {
+        for (PcapBuffer& buffer : buffers) {
+            buffer.used = 0;
+            buffer.state.store(PCAP_FREE, std::memory_order_relaxed);
+        }
+        active = 0;
+        buffers[0].state.store(PCAP_FILLING, std::memory_order_relaxed);
+        flushRequested.store(false, std::memory_order_relaxed);
+    }
+
+    // Producer side; must not block
+    bool append(const uint8_t* frame, size_t length, uint8_t channel, int8_t rssi, uint32_t nowMicros) {
+        size_t captured = length < pcapSnapLength ? length : pcapSnapLength;
+        size_t recordSize = sizeof(PcapRecordHeader) + sizeof(PcapRadiotap) + captured;
+
+        PcapBuffer* buffer = &buffers[active];
+        bool flush = flushRequested.load(std::memory_order_relaxed) && buffer->used > 0;
+        if (flush || buffer->used + recordSize > pcapBufferSize) {
+            PcapBuffer& next = buffers[active ^ 1];
+            if (next.state.load(std::memory_order_acquire) != PCAP_FREE) {
+                if (!flush) {
+                    stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            } else {
+                buffer->state.store(PCAP_FULL, std::memory_order_release);
+                flushRequested.store(false, std::memory_order_relaxed);
+                active ^= 1;
+                buffer = &next;
+                buffer->used = 0;
+                buffer->state.store(PCAP_FILLING, std::memory_order_relaxed);
+            }
+            if (buffer->used + recordSize > pcapBufferSize) {
+                stats.dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+
+        PcapRecordHeader record = { nowMicros / 1000000, nowMicros % 1000000,
+                                    (uint32_t)(sizeof(PcapRadiotap) + captured),
+                                    (uint32_t)(sizeof(PcapRadiotap) + length) };
+        PcapRadiotap radiotap = { 0, 0, sizeof(PcapRadiotap), (1u << 3) | (1u << 5),
+                                  (uint16_t)(channel == 14 ? 2484 : 2407 + 5 * channel), 0x0080, rssi };
+
+        uint8_t* out = buffer->data + buffer->used;
+        memcpy(out, &record, sizeof(record));
+        memcpy(out + sizeof(record), &radiotap, sizeof(radiotap));
+        memcpy(out + sizeof(record) + sizeof(radiotap), frame, captured);
+        buffer->used += recordSize;
+        stats.frames.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Consumer side. The producer only hands a buffer over once the other one
+    // is free, so at most one is full at a time and file order is kept.
+    PcapBuffer* full() {
+        for (PcapBuffer& buffer : buffers) {
+            if (buffer.state.load(std::memory_order_acquire) == PCAP_FULL) return &buffer;
+        }
+        return nullptr;
+    }
+
+    void release(PcapBuffer& buffer) {
+        buffer.used = 0;
+        buffer.state.store(PCAP_FREE, std::memory_order_release);
+    }
+
+    // Quiet air can leave a few frames sitting in the filling buffer; asks the
+    // producer to hand it over with the next frame
+    void requestFlush() {
+        flushRequested.store(true, std::memory_order_relaxed);
+    }
+
+    // Once the producer has stopped: visits the full buffer, then the
+    // filling one, and frees both
+    template<typename Write>
+    void drain(Write write) {
+        for (int i = 0; i < 2; i++) {
+            PcapBuffer& buffer = buffers[(active + 1 + i) % 2];
+            if (buffer.state.load(std::memory_order_acquire) != PCAP_FREE && buffer.used > 0) write(buffer);
+            release(buffer);
+        }
+    }
+};
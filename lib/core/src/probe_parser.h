@@ -0,0 +1,54 @@
+// Probe request parsing shared by the firmware and the host tests. Nothing
+// here touches Arduino or ESP-IDF, so test/ can exercise it natively.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+const size_t probeHeaderLength = 24;          // 802.11 management header
+const uint8_t probeRequestFrameControl = 0x40;
+
+// Finds the SSID element in a probe request body. Tagged parameters follow
+// the 24-byte management header; every length is checked against the frame
+// so a truncated or hostile frame can't walk past the buffer. Returns the
+// SSID length (0 for a wildcard probe) or -1 when the frame is malformed.
+static inline int parseProbeSSID(const uint8_t* frame, size_t length, char* ssid) {
+    if (length < probeHeaderLength) return -1;
+
+    size_t pos = probeHeaderLength;
+    while (pos + 2 <= length) {
+        uint8_t id = frame[pos];
+        uint8_t elementLength = frame[pos + 1];
+        if (pos + 2 + elementLength > length) return -1;
+        if (id == 0) {
+            if (elementLength > 32) return -1;
+            memcpy(ssid, &frame[pos + 2], elementLength);
+            ssid[elementLength] = '\0';
+            return elementLength;
+        }
+        pos += 2 + elementLength;
+    }
+    return -1;
+}
+
+// Hashes what a probe says about the client's radio rather than its address:
+// the order of tagged parameters plus the rates and HT/VHT/extended
+// capability contents. Stays stable when a client randomises its MAC.
+static inline uint32_t probeFingerprint(const uint8_t* frame, size_t length) {
+    uint32_t hash = 2166136261u;
+    size_t pos = probeHeaderLength;
+    while (pos + 2 <= length) {
+        uint8_t id = frame[pos];
+        uint8_t elementLength = frame[pos + 1];
+        if (pos + 2 + elementLength > length) break;
+        hash = (hash ^ id) * 16777619u;
+        if (id == 1 || id == 45 || id == 50 || id == 127 || id == 191) {
+            for (size_t i = 0; i < elementLength; i++) {
+                hash = (hash ^ frame[pos + 2 + i]) * 16777619u;
+            }
+        }
+        pos += 2 + elementLength;
+    }
+    return hash;
+}
@@ -0,0 +1,224 @@
+// Probe replay shared by the firmware and the host replay program (src/host).
+// A replay reads a pcap of 802.11 or radiotap frames and hands each one to
+// the sniffer at the recorded pace divided by speed (0 = as fast as the
+// caller pulls). It tracks what the report needs: unique SSIDs, when each
+// was first heard, forwarded to the UI and deployed, and the peak depth of
+// the probe queue.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "chunked_writer.h"
+#include "probe_sniffer.h"
+
+const int maxReplaySSIDs = 32;
+// SSIDs past maxReplaySSIDs are only counted, once each, through a set of
+// their hashes; past three quarters full the count stops and is flagged
+const int replayUntrackedSlots = 256;       // power of two
+const size_t maxReplayRecord = 512;
+
+struct ReplaySSID {
+    char ssid[33];
+    uint32_t firstSeenMs;    // all times since replay start
+    uint32_t forwardedMs;
+    uint32_t deployedMs;
+    bool forwarded;
+    bool deployed;
+};
+
+enum ReplayStep { REPLAY_FRAME, REPLAY_WAIT, REPLAY_END };
+
+struct ProbeReplay {
+    uint32_t speed;
+    uint32_t linkType;
+    uint32_t firstTimestampMs;
+    bool timed;                      // firstTimestampMs has been taken
+    bool haveRecord;                 // header read, frame waiting for its time
+    uint32_t recordTimestampMs;
+    uint32_t recordLength;
+    uint32_t frames;
+    uint32_t probes;                 // frames that were probe requests
+    uint32_t maxQueueDepth;
+    SnifferStatsSnapshot snifferBefore;
+    uint32_t queueDropsBefore;
+    ReplaySSID ssids[maxReplaySSIDs];
+    int ssidCount;
+    uint32_t untrackedSSIDs;         // unique SSIDs past maxReplaySSIDs
+    uint32_t untrackedHashes[replayUntrackedSlots];
+    bool untrackedOverflow;
+    uint8_t record[maxReplayRecord];
+
+    // Clears the previous run and checks the pcap global header. Source
+    // needs read(buffer, length), position() and seek(position).
+    template<typename Source>
+    bool begin(Source& file, uint32_t replaySpeed, const SnifferStatsSnapshot& sniffer, uint32_t queueDrops) {
+        memset(this, 0, sizeof(*this));
+        speed = replaySpeed;
+        snifferBefore = sniffer;
+        queueDropsBefore = queueDrops;
+        uint32_t header[6];
+        if (file.read((uint8_t*)header, sizeof(header)) != sizeof(header) ||
+            header[0] != 0xa1b2c3d4 || (header[5] != 105 && header[5] != 127)) {
+            return false;
+        }
+        linkType = header[5];
+        return true;
+    }
+
+    // Reads the next record into record[] once it is due, recordLength bytes
+    template<typename Source>
+    ReplayStep next(Source& file, uint32_t elapsedMs) {
+        for (;;) {
+            if (!haveRecord) {
+                uint32_t header[4];
+                if (file.read((uint8_t*)header, sizeof(header)) != sizeof(header)) return REPLAY_END;
+                recordTimestampMs = header[0] * 1000 + header[1] / 1000;
+                recordLength = header[2];
+                if (!timed) {
+                    firstTimestampMs = recordTimestampMs;
+                    timed = true;
+                }
+                haveRecord = true;
+            }
+
+            if (speed > 0 && elapsedMs < (recordTimestampMs - firstTimestampMs) / speed) return REPLAY_WAIT;
+
+            haveRecord = false;
+            if (recordLength > maxReplayRecord) {
+                file.seek(file.position() + recordLength);
+                continue;
+            }
+            if (file.read(record, recordLength) != recordLength) return REPLAY_END;
+            return REPLAY_FRAME;
+        }
+    }
+
+    // Strips a radiotap header from record[], picking up channel and signal
+    // when laid out as probes.pcap records them. False if the record is unusable.
+    bool decode(const uint8_t*& frame, size_t& length, uint8_t& channel, int8_t& rssi) const {
+        frame = record;
+        length = recordLength;
+        channel = 1;
+        rssi = 0;
+        if (linkType != 127) return true;
+
+        if (length < 8) return false;
+        uint16_t radiotapLength = frame[2] | (frame[3] << 8);
+        uint32_t present;
+        memcpy(&present, frame + 4, sizeof(present));
+        if (radiotapLength > length) return false;
+        if (present == ((1u << 3) | (1u << 5)) && radiotapLength >= 13) {
+            uint16_t frequency = frame[8] | (frame[9] << 8);
+            channel = frequency == 2484 ? 14 : (frequency - 2407) / 5;
+            rssi = (int8_t)frame[12];
+        }
+        frame += radiotapLength;
+        length -= radiotapLength;
+        return true;
+    }
+
+    // Called for every frame before the sniffer sees it
+    void noteFrame(const uint8_t* frame, size_t length, uint32_t elapsedMs) {
+        frames++;
+        if (length < 1 || frame[0] != probeRequestFrameControl) return;
+        probes++;
+        char ssid[33];
+        if (parseProbeSSID(frame, length, ssid) <= 0) return;
+        if (find(ssid)) return;
+        if (ssidCount >= maxReplaySSIDs) {
+            noteUntracked(ssid);
+            return;
+        }
+        ReplaySSID& entry = ssids[ssidCount++];
+        memcpy(entry.ssid, ssid, sizeof(entry.ssid));
+        entry.firstSeenMs = elapsedMs;
+    }
+
+    void noteQueueDepth(uint32_t depth) {
+        if (depth > maxQueueDepth) maxQueueDepth = depth;
+    }
+
+    // The net task passed the SSID to the UI
+    void noteForward(const char* ssid, uint32_t elapsedMs) {
+        ReplaySSID* entry = find(ssid);
+        if (!entry || entry->forwarded) return;
+        entry->forwarded = true;
+        entry->forwardedMs = elapsedMs;
+    }
+
+    // An AP went up for the SSID
+    void noteDeploy(const char* ssid, uint32_t elapsedMs) {
+        ReplaySSID* entry = find(ssid);
+        if (!entry || entry->deployed) return;
+        entry->deployed = true;
+        entry->deployedMs = elapsedMs;
+    }
+
+    uint32_t uniqueSSIDs() const { return ssidCount + untrackedSSIDs; }
+
+    void writeReport(JsonWriter& json, uint32_t durationMs, const SnifferStatsSnapshot& after,
+                     uint32_t queueDrops) const {
+        uint32_t malformed = after.malformed - snifferBefore.malformed;
+        // Probes the sniffer held back from the UI as repeats of the last SSID
+        uint32_t wellFormed = probes - malformed;
+        uint32_t dedupHits = after.repeats - snifferBefore.repeats;
+
+        json.beginObject();
+        json.field("durationMs", durationMs);
+        json.field("speed", speed);
+        json.field("frames", frames);
+        json.field("probes", probes);
+        json.field("malformed", malformed);
+        json.field("accepted", after.accepted - snifferBefore.accepted);
+        json.field("uniqueSSIDs", uniqueSSIDs());
+        if (untrackedOverflow) json.field("uniqueSSIDsCapped", true);
+        json.field("dedupHits", dedupHits);
+        char rate[32];
+        snprintf(rate, sizeof(rate), "\"dedupHitRate\":%.4f", wellFormed ? (double)dedupHits / wellFormed : 0.0);
+        json.rawMember();
+        json.raw(rate);
+        json.field("maxQueueDepth", maxQueueDepth);
+        json.field("queueDrops", queueDrops - queueDropsBefore);
+        json.key("ssids");
+        json.beginArray();
+        for (int i = 0; i < ssidCount; i++) {
+            const ReplaySSID& entry = ssids[i];
+            json.beginObject();
+            json.field("ssid", entry.ssid);
+            json.field("firstSeenMs", entry.firstSeenMs);
+            if (entry.forwarded) json.field("timeToForwardMs", entry.forwardedMs - entry.firstSeenMs);
+            if (entry.deployed) json.field("timeToDeployMs", entry.deployedMs - entry.firstSeenMs);
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+    }
+
+private:
+    void noteUntracked(const char* ssid) {
+        uint32_t hash = 2166136261u;
+        for (; *ssid; ssid++) hash = (hash ^ (uint8_t)*ssid) * 16777619u;
+        if (hash == 0) hash = 1;                 // zero marks a free slot
+        for (uint32_t slot = hash;; slot++) {
+            uint32_t& entry = untrackedHashes[slot & (replayUntrackedSlots - 1)];
+            if (entry == hash) return;
+            if (entry != 0) continue;
+            if (untrackedSSIDs >= replayUntrackedSlots * 3 / 4) {
+                untrackedOverflow = true;
+                return;
+            }
+            entry = hash;
+            untrackedSSIDs++;
+            return;
+        }
+    }
+
+    ReplaySSID* find(const char* ssid) {
+        for (int i = 0; i < ssidCount; i++) {
+            if (strcmp(ssids[i].ssid, ssid) == 0) return &ssids[i];
+        }
+        return nullptr;
+    }
+};
@@ -0,0 +1,90 @@
+// Probe intake shared by the Wi-Fi RX callback and the host replay: checks
+// and parses a frame, drops repeats of the previous probe's SSID from what
+// reaches the UI, and packs the result for the net task. Only the callback
+// (or a replay standing in for it) calls accept(); other tasks ask for a
+// dedup reset through requestReset().
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include "probe_parser.h"
+
+// Every well-formed probe is queued so the device table sees all of them;
+// only forwarded ones (a named SSID different from the previous probe) reach
+// the UI as NET_EVENT_PROBE.
+struct ProbeRecord {
+    char ssid[33];
+    uint8_t channel;
+    int8_t rssi;
+    bool forward;
+    uint8_t mac[6];
+    uint32_t fingerprint;
+};
+
+struct SnifferStats {
+    std::atomic<uint32_t> seen{0};        // frames handed to the callback
+    std::atomic<uint32_t> rejected{0};    // not a probe request, or AP deploying
+    std::atomic<uint32_t> malformed{0};   // truncated header or tagged parameters
+    std::atomic<uint32_t> accepted{0};    // probes queued for the net task
+    std::atomic<uint32_t> repeats{0};     // same SSID as the previous probe
+};
+
+struct SnifferStatsSnapshot {
+    uint32_t seen, rejected, malformed, accepted, repeats;
+};
+
+struct ProbeSniffer {
+    SnifferStats stats;
+    char lastSSID[33] = {};               // previous probe's SSID, for dedup
+    std::atomic<bool> resetPending{false};
+
+    void requestReset() { resetPending.store(true, std::memory_order_release); }
+
+    SnifferStatsSnapshot snapshot() const {
+        SnifferStatsSnapshot snapshot = { stats.seen.load(), stats.rejected.load(), stats.malformed.load(),
+                                          stats.accepted.load(), stats.repeats.load() };
+        return snapshot;
+    }
+
+    // usable is false for frames that aren't management frames or that
+    // arrive while the AP is deploying. Returns true when probe is filled.
+    bool accept(bool usable, const uint8_t* frame, size_t length, uint8_t channel, int8_t rssi,
+                ProbeRecord& probe) {
+        stats.seen.fetch_add(1, std::memory_order_relaxed);
+
+        if (resetPending.load(std::memory_order_relaxed) &&
+            resetPending.exchange(false, std::memory_order_acquire)) {
+            lastSSID[0] = '\0';
+        }
+
+        if (!usable || length < 1 || frame[0] != probeRequestFrameControl) {
+            stats.rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        int ssidLength = parseProbeSSID(frame, length, probe.ssid);
+        if (ssidLength < 0) {
+            stats.malformed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        probe.channel = channel;
+        probe.rssi = rssi;
+        memcpy(probe.mac, &frame[10], sizeof(probe.mac));
+        probe.fingerprint = probeFingerprint(frame, length);
+        probe.forward = false;
+        if (ssidLength > 0) {
+            if (strcmp(probe.ssid, lastSSID) == 0) {
+                stats.repeats.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                memcpy(lastSSID, probe.ssid, ssidLength + 1);
+                probe.forward = true;
+            }
+        }
+
+        stats.accepted.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+};
@@ -0,0 +1,78 @@
+// .565 images written by tools/bmp_to_rgb565.py: a 12-byte header, then
+// top-down pixels, raw or RLE-packed. Pixels are stored in the panel's byte
+// order (high byte first), so they go to the display without conversion.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct Rgb565Header {
+    char magic[4];
+    uint16_t width;
+    uint16_t height;
+    uint8_t flags;
+    uint8_t reserved[3];
+};
+const uint8_t rgb565FlagRLE = 0x01;
+
+inline bool rgb565HeaderValid(const Rgb565Header& header) {
+    return memcmp(header.magic, "R565", 4) == 0 && header.width != 0 && header.height != 0;
+}
+
+// Expands RLE pixel data from any source with read(uint8_t*, size_t)
+template <typename Source>
+struct Rgb565Decoder {
+    Source& file;
+    uint8_t input[512];
+    size_t inputLength = 0;
+    size_t inputPos = 0;
+    int literalLeft = 0;     // literal pixels still to copy
+    int repeatLeft = 0;      // copies of repeatPixel still to write
+    uint16_t repeatPixel = 0;
+
+    explicit Rgb565Decoder(Source& source) : file(source) {}
+
+    int nextByte() {
+        if (inputPos == inputLength) {
+            inputLength = file.read(input, sizeof(input));
+            inputPos = 0;
+            if (inputLength == 0) return -1;
+        }
+        return input[inputPos++];
+    }
+
+    // Keeps the bytes in file order, which is what the panel expects
+    bool nextPixel(uint16_t& pixel) {
+        int first = nextByte();
+        int second = nextByte();
+        if (second < 0) return false;
+        uint8_t bytes[2] = { (uint8_t)first, (uint8_t)second };
+        memcpy(&pixel, bytes, sizeof(pixel));
+        return true;
+    }
+
+    // Expands exactly count pixels; packets may span band boundaries
+    bool decodeRLE(uint16_t* out, size_t count) {
+        size_t written = 0;
+        while (written < count) {
+            if (repeatLeft > 0) {
+                out[written++] = repeatPixel;
+                repeatLeft--;
+            } else if (literalLeft > 0) {
+                if (!nextPixel(out[written++])) return false;
+                literalLeft--;
+            } else {
+                int control = nextByte();
+                if (control < 0) return false;
+                if (control < 128) {
+                    literalLeft = control + 1;
+                } else {
+                    if (!nextPixel(repeatPixel)) return false;
+                    repeatLeft = control - 126;
+                }
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,62 @@
+// Open-addressed hash index from method + path to a route table entry,
+// shared with the host tests. Slots hold entry + 1 so zero means empty; the
+// caller's table decides what an entry is and confirms each candidate.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+template <int Size>
+struct RouteIndex {
+    static_assert((Size & (Size - 1)) == 0, "route index size must be a power of two");
+    int16_t slots[Size];
+
+    static uint32_t hash(uint32_t method, const char* path, size_t length) {
+        uint32_t value = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+            value = (value ^ (uint8_t)path[i]) * 16777619u;
+        }
+        return (value ^ method) * 16777619u;
+    }
+
+    void clear() { memset(slots, 0, sizeof(slots)); }
+
+    void add(uint32_t method, const char* path, int entry) {
+        uint32_t slot = hash(method, path, strlen(path)) & (Size - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (Size - 1);
+        }
+        slots[slot] = entry + 1;
+    }
+
+    // Returns the first entry for which matches(entry) holds, or -1
+    template <typename Matches>
+    int find(uint32_t method, const char* path, Matches matches) const {
+        uint32_t slot = hash(method, path, strlen(path)) & (Size - 1);
+        while (slots[slot] != 0) {
+            int entry = slots[slot] - 1;
+            if (matches(entry)) return entry;
+            slot = (slot + 1) & (Size - 1);
+        }
+        return -1;
+    }
+};
+
+inline bool pathEndsWith(const char* path, const char* suffix) {
+    size_t pathLength = strlen(path);
+    size_t suffixLength = strlen(suffix);
+    return pathLength >= suffixLength && strcmp(path + pathLength - suffixLength, suffix) == 0;
+}
+
+inline const char* contentTypeFor(const char* path) {
+    if (pathEndsWith(path, ".html")) return "text/html";
+    if (pathEndsWith(path, ".css")) return "text/css";
+    if (pathEndsWith(path, ".js")) return "application/javascript";
+    if (pathEndsWith(path, ".png")) return "image/png";
+    if (pathEndsWith(path, ".jpg") || pathEndsWith(path, ".jpeg")) return "image/jpeg";
+    if (pathEndsWith(path, ".gif")) return "image/gif";
+    if (pathEndsWith(path, ".ico")) return "image/x-icon";
+    if (pathEndsWith(path, ".json")) return "application/json";
+    return "text/plain";
+}
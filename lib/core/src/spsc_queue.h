@@ -0,0 +1,37 @@
+// Single-producer/single-consumer ring. Only the producer writes tail and only
+// the consumer writes head, so both sides run lock-free on different cores.
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+template <typename T, uint32_t N>
+struct SpscQueue {
+    T items[N];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};     // written by the producer, read anywhere
+
+    bool push(const T& item) {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= N) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items[t % N] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h % N];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint32_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
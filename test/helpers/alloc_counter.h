@@ -0,0 +1,66 @@
+// Counts heap allocations in a test program so a suite can assert that a
+// hot path allocates nothing. On glibc malloc, calloc and realloc are
+// interposed, which also catches operator new; elsewhere, and under the
+// sanitizers that bring their own allocator, only operator new is counted.
+// Include from one file per suite.
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+static std::atomic<unsigned long> hostAllocations{0};
+
+inline unsigned long allocationCount() {
+    return hostAllocations.load(std::memory_order_relaxed);
+}
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer)
+#define HOST_SANITIZER_ALLOCATOR 1
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define HOST_SANITIZER_ALLOCATOR 1
+#endif
+
+#if defined(__GLIBC__) && !defined(HOST_SANITIZER_ALLOCATOR)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) {
+    hostAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    hostAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* pointer, size_t size) {
+    hostAllocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+}
+#else
+void* operator new(size_t size) {
+    hostAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* pointer = malloc(size ? size : 1);
+    if (!pointer) throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void* pointer) noexcept { free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+#endif
+
+// Allocations made while running op
+template <typename Op>
+unsigned long allocationsDuring(Op op) {
+    unsigned long before = allocationCount();
+    op();
+    return allocationCount() - before;
+}
@@ -0,0 +1,97 @@
+// Shared helpers for the native test suites: a deterministic RNG, a
+// monotonic clock for benchmarks, and builders for probe request frames and
+// DNS queries.
+#pragma once
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct XorShift {
+    uint32_t state;
+    explicit XorShift(uint32_t seed) : state(seed ? seed : 1) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    uint32_t below(uint32_t bound) { return next() % bound; }
+};
+
+inline uint64_t hostNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Benchmarks print their figures; pass -v to pio test to see them
+inline void benchReport(const char* name, const char* unit, double value) {
+    printf("bench %-40s %12.1f %s\n", name, value, unit);
+}
+
+// Probe request: management header, then SSID, rates and any extra elements
+struct ProbeFrameBuilder {
+    std::vector<uint8_t> bytes;
+
+    explicit ProbeFrameBuilder(const uint8_t* mac = nullptr) {
+        static const uint8_t defaultMac[6] = {0x02, 0x11, 0x22, 0x33, 0x44, 0x55};
+        const uint8_t header[24] = {
+            0x40, 0x00, 0x00, 0x00,
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+            0, 0, 0, 0, 0, 0,
+            0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+            0x10, 0x00,
+        };
+        bytes.assign(header, header + sizeof(header));
+        memcpy(&bytes[10], mac ? mac : defaultMac, 6);
+    }
+
+    ProbeFrameBuilder& element(uint8_t id, const void* data, size_t length) {
+        bytes.push_back(id);
+        bytes.push_back((uint8_t)length);
+        const uint8_t* p = (const uint8_t*)data;
+        bytes.insert(bytes.end(), p, p + length);
+        return *this;
+    }
+
+    ProbeFrameBuilder& ssid(const char* name) { return element(0, name, strlen(name)); }
+
+    ProbeFrameBuilder& rates() {
+        static const uint8_t supported[8] = {0x82, 0x84, 0x8b, 0x96, 0x0c, 0x12, 0x18, 0x24};
+        return element(1, supported, sizeof(supported));
+    }
+
+    ProbeFrameBuilder& htCapabilities(uint8_t variant = 0) {
+        uint8_t ht[26] = {0x2d, 0x01, 0x17, 0xff, 0xff};
+        ht[25] = variant;
+        return element(45, ht, sizeof(ht));
+    }
+};
+
+// Single-question DNS query with RD set; returns its length
+inline int buildDnsQuery(uint8_t* packet, uint16_t id, const char* name, uint16_t qtype, uint16_t qclass = 1) {
+    memset(packet, 0, 12);
+    packet[0] = id >> 8;
+    packet[1] = id & 0xff;
+    packet[2] = 0x01;                  // RD
+    packet[5] = 1;                     // one question
+    int pos = 12;
+    const char* label = name;
+    while (*label) {
+        const char* dot = strchr(label, '.');
+        int length = dot ? dot - label : strlen(label);
+        packet[pos++] = length;
+        memcpy(&packet[pos], label, length);
+        pos += length;
+        label += length + (dot ? 1 : 0);
+    }
+    packet[pos++] = 0;
+    packet[pos++] = qtype >> 8;
+    packet[pos++] = qtype & 0xff;
+    packet[pos++] = qclass >> 8;
+    packet[pos++] = qclass & 0xff;
+    return pos;
+}
@@ -0,0 +1,263 @@
+// Capture store: file header, dedup keying and the string table limit,
+// plus storage size and query cost at 10k submissions against the raw
+// /log.txt the store replaces. The store is modelled in memory with the
+// firmware's record layout and interning rules; query times exclude flash
+// I/O, so bytes read per query are reported alongside. The firmware caps
+// the store at 4096 records; 10k measures the format past that.
+#include <unity.h>
+
+#include "capture_record.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_dedup_is_per_boot_and_prefers_mac(void) {
+    const uint8_t macA[6] = {0x02, 1, 2, 3, 4, 5};
+    const uint8_t macB[6] = {0x02, 9, 9, 9, 9, 9};
+    CaptureRecord record = {};
+    record.bootId = 7;
+    record.session = 0x0204a8c0;
+    memcpy(record.mac, macA, 6);
+
+    TEST_ASSERT_TRUE(captureSameClient(record, 7, 0x0204a8c0, macA));
+    TEST_ASSERT_TRUE(captureSameClient(record, 7, 0x0304a8c0, macA));    // same station, new lease
+    TEST_ASSERT_FALSE(captureSameClient(record, 7, 0x0204a8c0, macB));   // lease reused by another station
+    TEST_ASSERT_FALSE(captureSameClient(record, 8, 0x0204a8c0, macA));   // earlier boot
+    TEST_ASSERT_TRUE(captureSameClient(record, 7, 0x0204a8c0, nullptr)); // station unknown: IP
+    TEST_ASSERT_FALSE(captureSameClient(record, 8, 0x0204a8c0, nullptr));
+}
+
+void test_store_header_rejects_other_layouts(void) {
+    CaptureStoreHeader header = currentCaptureStoreHeader();
+    TEST_ASSERT_TRUE(captureStoreHeaderValid(header));
+
+    CaptureStoreHeader older = header;
+    older.version = 1;
+    TEST_ASSERT_FALSE(captureStoreHeaderValid(older));
+    CaptureStoreHeader resized = header;
+    resized.recordSize = 36;
+    TEST_ASSERT_FALSE(captureStoreHeaderValid(resized));
+
+    // A store from before the header starts with a record: bootId, then the
+    // 16-bit payload length and the capture time
+    const uint8_t legacy[8] = {0x03, 0x00, 0xd2, 0x00, 0x10, 0x27, 0x00, 0x00};
+    memcpy(&header, legacy, sizeof(header));
+    TEST_ASSERT_FALSE(captureStoreHeaderValid(header));
+}
+
+// In-memory stand-in for the three store files and the RAM index columns
+struct ModelStore {
+    std::vector<CaptureRecord> records;
+    std::string strings;
+    std::string payload;
+    std::vector<uint32_t> stringHashes;
+    std::vector<uint32_t> stringOffsets;
+    std::vector<uint32_t> sessions;
+    std::vector<uint16_t> ssids;
+
+    std::string stringAt(uint16_t id) const {
+        size_t start = stringOffsets[id];
+        return strings.substr(start, strings.find('\n', start) - start);
+    }
+
+    uint16_t intern(const std::string& value) {
+        if (value.empty() || value.size() > captureMaxStringLength) return noCaptureString;
+        uint32_t hash = captureHash(value.data(), value.size());
+        for (size_t id = 0; id < stringHashes.size(); id++) {
+            if (stringHashes[id] == hash && stringAt(id) == value) return id;
+        }
+        stringHashes.push_back(hash);
+        stringOffsets.push_back(strings.size());
+        strings += value;
+        strings += '\n';
+        return stringHashes.size() - 1;
+    }
+};
+
+static const char* const userAgents[] = {
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:129.0) Gecko/20100101 Firefox/129.0",
+    "Mozilla/5.0 (iPhone; CPU iPhone OS 17_5 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.5 Mobile/15E148 Safari/604.1",
+    "Mozilla/5.0 (Linux; Android 14; Pixel 8) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Mobile Safari/537.36",
+    "Mozilla/5.0 (Macintosh; Intel Mac OS X 14_5) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.5 Safari/605.1.15",
+    "Mozilla/5.0 (Linux; Android 13; SM-S911B) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/125.0.0.0 Mobile Safari/537.36",
+    "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0.0.0 Safari/537.36 Edg/126.0.0.0",
+};
+static const char* const platforms[] = { "Win32", "iPhone", "Linux armv81", "MacIntel" };
+static const char* const languages[] = { "en-US", "en-GB", "de-DE", "fr-FR", "es-ES" };
+static const char* const timezones[] = { "America/New_York", "Europe/London", "Europe/Berlin", "America/Chicago", "Asia/Tokyo" };
+static const char* const answers[] = { "Never", "No", "Yes" };
+
+const int benchmarkRecords = 10000;
+const int benchmarkSSIDs = 40;
+
+// 10k submissions shaped like data/log.txt, from 250 stations across 40 SSIDs
+static void buildBenchmarkData(ModelStore& store, std::string& log) {
+    XorShift rng(2024);
+    char ssid[33];
+    char body[768];
+    char fields[512];
+    for (int i = 0; i < benchmarkRecords; i++) {
+        int station = rng.below(250);
+        snprintf(ssid, sizeof(ssid), "Network-%d", (int)rng.below(benchmarkSSIDs));
+        const char* userAgent = userAgents[station % 6];
+        const char* platform = platforms[station % 4];
+        const char* language = languages[station % 5];
+        const char* timezone = timezones[station % 5];
+
+        int length = snprintf(fields, sizeof(fields),
+                              "\"id\":\"%d\",\"firstname\":\"First%u\",\"lastname\":\"Last%u\",\"email\":\"user%u@example.com\","
+                              "\"phone\":\"(555) %03u-%04u\",\"answers\":[\"%s\",\"%s\",\"%s\",\"%s\",\"%s\"]",
+                              i, rng.below(500), rng.below(800), rng.below(100000), rng.below(1000), rng.below(10000),
+                              answers[rng.below(3)], answers[rng.below(3)], answers[rng.below(3)],
+                              answers[rng.below(3)], answers[rng.below(3)]);
+        snprintf(body, sizeof(body), "{%s,\"userAgent\":\"%s\",\"platform\":\"%s\",\"language\":\"%s\",\"timezone\":\"%s\"}",
+                 fields, userAgent, platform, language, timezone);
+
+        // logData() appends the body with println
+        log += body;
+        log += "\r\n";
+
+        CaptureRecord record = {};
+        record.bootId = 1 + i / 2500;
+        record.capturedAtMs = i * 1000;
+        record.session = 0x0004a8c0 | (uint32_t)(2 + station) << 24;
+        record.bodyHash = captureHash(body, strlen(body));
+        record.mac[0] = 0x02;
+        record.mac[5] = station;
+        record.ssid = store.intern(ssid);
+        record.portal = store.intern("/index.html");
+        record.userAgent = store.intern(userAgent);
+        record.platform = store.intern(platform);
+        record.language = store.intern(language);
+        record.timezone = store.intern(timezone);
+        record.payloadOffset = store.payload.size();
+        record.payloadLength = length + 2;
+        store.payload += '{';
+        store.payload.append(fields, length);
+        store.payload += '}';
+        store.records.push_back(record);
+        store.sessions.push_back(record.session);
+        store.ssids.push_back(record.ssid);
+    }
+}
+
+// Copies a record and its payload out, as writeCaptureRecord reads them
+static size_t readRecord(const ModelStore& store, size_t index, char* buffer) {
+    CaptureRecord record;
+    memcpy(&record, &store.records[index], sizeof(record));
+    memcpy(buffer, store.payload.data() + record.payloadOffset, record.payloadLength);
+    return sizeof(record) + record.payloadLength;
+}
+
+void test_benchmark_10k_records(void) {
+    static ModelStore store;
+    static std::string log;
+    buildBenchmarkData(store, log);
+    static char buffer[1024];
+
+    size_t storeBytes = sizeof(CaptureStoreHeader) + store.records.size() * sizeof(CaptureRecord) +
+                        store.strings.size() + store.payload.size();
+    size_t indexBytes = store.records.size() * (sizeof(uint32_t) + sizeof(uint16_t)) +
+                        store.stringHashes.size() * 2 * sizeof(uint32_t);
+    benchReport("raw log.txt", "bytes", (double)log.size());
+    benchReport("capture store on flash", "bytes", (double)storeBytes);
+    benchReport("capture store RAM index", "bytes", (double)indexBytes);
+    benchReport("capture store per record", "bytes", (double)storeBytes / benchmarkRecords);
+    TEST_ASSERT_TRUE(storeBytes < log.size());
+
+    const int rounds = 50;
+    const char* needle = "\"platform\":\"iPhone\"";
+    const uint32_t session = store.sessions[1234];
+    const uint16_t iphone = store.intern("iPhone");
+    const uint16_t network = store.intern("Network-7");
+    volatile size_t sink = 0;
+
+    // One station's submissions via the RAM session column; the log has no
+    // IP, so it can't answer this
+    size_t bytesRead = 0;
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        bytesRead = 0;
+        for (size_t i = 0; i < store.sessions.size(); i++) {
+            if (store.sessions[i] == session) bytesRead += readRecord(store, i, buffer);
+        }
+    }
+    benchReport("query by session, store", "us", (hostNowNs() - start) / 1e3 / rounds);
+    benchReport("query by session, store bytes read", "bytes", (double)bytesRead);
+
+    // SSID at capture time: only the store has it
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        bytesRead = 0;
+        for (size_t i = 0; i < store.ssids.size(); i++) {
+            if (store.ssids[i] == network) bytesRead += readRecord(store, i, buffer);
+        }
+    }
+    benchReport("query by SSID, store", "us", (hostNowNs() - start) / 1e3 / rounds);
+    benchReport("query by SSID, store bytes read", "bytes", (double)bytesRead);
+
+    // An interned field: a pass over the fixed records vs. a text scan
+    size_t storeMatches = 0;
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        storeMatches = 0;
+        bytesRead = 0;
+        for (size_t i = 0; i < store.records.size(); i++) {
+            bytesRead += sizeof(CaptureRecord);
+            if (store.records[i].platform != iphone) continue;
+            bytesRead += readRecord(store, i, buffer);
+            storeMatches++;
+        }
+    }
+    benchReport("query by platform, store", "us", (hostNowNs() - start) / 1e3 / rounds);
+    benchReport("query by platform, store bytes read", "bytes", (double)bytesRead);
+
+    size_t logMatches = 0;
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        logMatches = 0;
+        const char* line = log.c_str();
+        while (*line) {
+            const char* end = strchr(line, '\n');
+            std::string text(line, end - line);
+            if (strstr(text.c_str(), needle)) logMatches++;
+            sink = sink + text.size();
+            line = end + 1;
+        }
+    }
+    benchReport("query by platform, log", "us", (hostNowNs() - start) / 1e3 / rounds);
+    benchReport("query by platform, log bytes read", "bytes", (double)log.size());
+    TEST_ASSERT_EQUAL(logMatches, storeMatches);
+
+    // The last 100 submissions: a seek vs. counting lines from the start
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        bytesRead = 0;
+        for (size_t i = store.records.size() - 100; i < store.records.size(); i++) {
+            bytesRead += readRecord(store, i, buffer);
+        }
+    }
+    benchReport("last 100 records, store", "us", (hostNowNs() - start) / 1e3 / rounds);
+    benchReport("last 100 records, store bytes read", "bytes", (double)bytesRead);
+
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        size_t lines = 0;
+        const char* line = log.c_str();
+        while (lines < (size_t)benchmarkRecords - 100) {
+            line = strchr(line, '\n') + 1;
+            lines++;
+        }
+        sink = sink + strlen(line);
+    }
+    benchReport("last 100 records, log", "us", (hostNowNs() - start) / 1e3 / rounds);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_dedup_is_per_boot_and_prefers_mac);
+    RUN_TEST(test_store_header_rejects_other_layouts);
+    RUN_TEST(test_benchmark_10k_records);
+    return UNITY_END();
+}
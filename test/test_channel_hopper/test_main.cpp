@@ -0,0 +1,205 @@
+// Channel hopper: dwell weighting and AP gaps, plus a site-survey
+// simulation reporting unique SSIDs discovered per minute for fixed-dwell
+// hopping against the yield-weighted hopper. The survey is generated:
+// phones come and go, mostly probe for their saved networks on the channel
+// they were last on and sometimes sweep all 13 channels.
+#include <unity.h>
+
+#include <algorithm>
+#include <set>
+
+#include "channel_hopper.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_dwell_follows_yield(void) {
+    ChannelHopper hopper = {};
+    TEST_ASSERT_EQUAL(minHopDwell, hopper.dwellFor(6));
+    hopper.stats[5].yieldEwma = 160;
+    hopper.stats[0].yieldEwma = 40;
+    TEST_ASSERT_EQUAL(maxHopDwell, hopper.dwellFor(6));
+    TEST_ASSERT_EQUAL(minHopDwell + (maxHopDwell - minHopDwell) / 4, hopper.dwellFor(1));
+    TEST_ASSERT_EQUAL(minHopDwell, hopper.dwellFor(13));
+}
+
+void test_sweep_and_yield(void) {
+    ChannelHopper hopper = {};
+    uint8_t next = 0;
+    TEST_ASSERT_TRUE(hopper.due(0, next));
+    TEST_ASSERT_EQUAL(1, next);
+    hopper.start(next, 0);
+    TEST_ASSERT_FALSE(hopper.due(minHopDwell - 1, next));
+
+    for (int i = 0; i < 12; i++) hopper.noteProbe(1);
+    hopper.noteProbe(2);                                 // heard off-channel: counted, not yield
+    TEST_ASSERT_TRUE(hopper.due(minHopDwell, next));
+    TEST_ASSERT_EQUAL(2, next);
+    TEST_ASSERT_EQUAL(12 * 16000 / minHopDwell / 4, hopper.stats[0].yieldEwma);
+    TEST_ASSERT_EQUAL(1, hopper.stats[1].probes);
+
+    hopper.start(13, 1000);
+    TEST_ASSERT_TRUE(hopper.due(1000 + minHopDwell, next));
+    TEST_ASSERT_EQUAL(1, next);
+}
+
+void test_ap_gap_does_not_count_as_dwell(void) {
+    ChannelHopper hopper = {};
+    hopper.start(6, 0);
+    hopper.noteProbe(6);
+    uint8_t next;
+    TEST_ASSERT_TRUE(hopper.due(maxHopDwell * 2 + 1, next));
+    TEST_ASSERT_EQUAL(7, next);
+    TEST_ASSERT_EQUAL(0, hopper.stats[5].dwellMs);
+    TEST_ASSERT_EQUAL(0, hopper.stats[5].yieldEwma);
+}
+
+struct SurveyProbe {
+    uint32_t timeMs;
+    uint8_t channel;
+    uint16_t ssid;
+};
+
+const uint32_t surveyMinutes = 10;
+const uint32_t surveyMs = surveyMinutes * 60000;
+
+// Home channels lean on 1, 6 and 11 the way deployed APs do
+static uint8_t pickHomeChannel(XorShift& rng) {
+    static const uint8_t weights[hopChannelCount] = { 20, 3, 3, 4, 3, 25, 3, 3, 3, 4, 20, 5, 4 };
+    uint32_t pick = rng.below(100);
+    for (int i = 0; i < hopChannelCount; i++) {
+        if (pick < weights[i]) return i + 1;
+        pick -= weights[i];
+    }
+    return 6;
+}
+
+static std::vector<SurveyProbe> buildSurvey(uint32_t seed) {
+    XorShift rng(seed);
+    std::vector<SurveyProbe> probes;
+    for (int device = 0; device < 150; device++) {
+        uint8_t home = pickHomeChannel(rng);
+        // Saved networks: a few shared names and some of the device's own
+        uint16_t saved[6];
+        int savedCount = 1 + rng.below(6);
+        for (int i = 0; i < savedCount; i++) {
+            saved[i] = rng.below(3) == 0 ? rng.below(20) : 20 + rng.below(600);
+        }
+
+        uint32_t arrive = rng.below(surveyMs);
+        uint32_t leave = std::min(surveyMs, arrive + 120000 + rng.below(180000));
+        for (uint32_t t = arrive + rng.below(30000); t < leave; t += 15000 + rng.below(60000)) {
+            if (rng.below(4) != 0) {
+                // Directed probes on the home channel
+                for (int i = 0; i < savedCount; i++) probes.push_back({ t + i * 2, home, saved[i] });
+            } else {
+                // Full active scan, ~30 ms per channel
+                for (int channel = 1; channel <= hopChannelCount; channel++) {
+                    uint32_t at = t + (channel - 1) * 30;
+                    for (int i = 0; i < savedCount; i++) probes.push_back({ at + i * 2, (uint8_t)channel, saved[i] });
+                }
+            }
+        }
+    }
+    std::sort(probes.begin(), probes.end(),
+              [](const SurveyProbe& a, const SurveyProbe& b) { return a.timeMs < b.timeMs; });
+    return probes;
+}
+
+struct SurveyResult {
+    std::vector<int> newPerMinute;
+    int probesHeard;
+};
+
+// Replays the survey against a radio that only hears its current channel.
+// The hop service runs every 10 ms, as on the net task. fixedDwell 0 uses
+// the yield-weighted hopper.
+static SurveyResult runSurvey(const std::vector<SurveyProbe>& probes, uint32_t fixedDwell) {
+    ChannelHopper hopper = {};
+    uint8_t fixedChannel = 1;
+    uint32_t fixedStart = 0;
+    std::set<uint16_t> heard;
+    SurveyResult result = { std::vector<int>(surveyMinutes, 0), 0 };
+    size_t nextProbe = 0;
+
+    for (uint32_t now = 0; now < surveyMs; now += 10) {
+        uint8_t channel;
+        if (fixedDwell) {
+            if (now - fixedStart >= fixedDwell) {
+                fixedChannel = fixedChannel % hopChannelCount + 1;
+                fixedStart = now;
+            }
+            channel = fixedChannel;
+        } else {
+            uint8_t next;
+            if (hopper.due(now, next)) hopper.start(next, now);
+            channel = hopper.channel;
+        }
+        for (; nextProbe < probes.size() && probes[nextProbe].timeMs < now + 10; nextProbe++) {
+            const SurveyProbe& probe = probes[nextProbe];
+            if (probe.channel != channel) continue;
+            if (!fixedDwell) hopper.noteProbe(probe.channel);
+            result.probesHeard++;
+            if (heard.insert(probe.ssid).second) result.newPerMinute[probe.timeMs / 60000]++;
+        }
+    }
+    return result;
+}
+
+// Averages over several generated surveys; per-minute figures are new
+// SSIDs first heard in that minute
+void test_survey_fixed_vs_adaptive(void) {
+    const int surveys = 10;
+    const char* const names[] = { "fixed 120 ms", "fixed 360 ms", "adaptive" };
+    const uint32_t dwells[] = { minHopDwell, (minHopDwell + maxHopDwell) / 2, 0 };
+    const int strategies = sizeof(dwells) / sizeof(dwells[0]);
+    std::vector<double> perMinute[strategies];
+    double found[strategies] = {};
+    double heard[strategies] = {};
+    double probed = 0;
+
+    for (int s = 0; s < strategies; s++) perMinute[s].assign(surveyMinutes, 0);
+    for (int seed = 1; seed <= surveys; seed++) {
+        std::vector<SurveyProbe> probes = buildSurvey(seed);
+        std::set<uint16_t> all;
+        for (const SurveyProbe& probe : probes) all.insert(probe.ssid);
+        probed += (double)all.size() / surveys;
+
+        for (int s = 0; s < strategies; s++) {
+            SurveyResult result = runSurvey(probes, dwells[s]);
+            for (uint32_t minute = 0; minute < surveyMinutes; minute++) {
+                perMinute[s][minute] += (double)result.newPerMinute[minute] / surveys;
+                found[s] += (double)result.newPerMinute[minute] / surveys;
+            }
+            heard[s] += (double)result.probesHeard / surveys;
+        }
+    }
+
+    char label[64];
+    for (int s = 0; s < strategies; s++) {
+        for (uint32_t minute = 0; minute < surveyMinutes; minute++) {
+            snprintf(label, sizeof(label), "%s, minute %u", names[s], (unsigned)minute + 1);
+            benchReport(label, "new SSIDs", perMinute[s][minute]);
+        }
+    }
+    benchReport("SSIDs probed for, per survey", "SSIDs", probed);
+    for (int s = 0; s < strategies; s++) {
+        snprintf(label, sizeof(label), "found, %s", names[s]);
+        benchReport(label, "SSIDs", found[s]);
+        snprintf(label, sizeof(label), "probes heard, %s", names[s]);
+        benchReport(label, "probes", heard[s]);
+    }
+    TEST_ASSERT_TRUE(found[2] > found[0]);
+    TEST_ASSERT_TRUE(heard[2] > heard[0]);
+    TEST_ASSERT_TRUE(heard[2] > heard[1]);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_dwell_follows_yield);
+    RUN_TEST(test_sweep_and_yield);
+    RUN_TEST(test_ap_gap_does_not_count_as_dwell);
+    RUN_TEST(test_survey_fixed_vs_adaptive);
+    return UNITY_END();
+}
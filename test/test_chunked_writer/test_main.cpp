@@ -0,0 +1,190 @@
+// Chunked response writer: JSON structure and escaping, chunking at the
+// buffer size, raw Prometheus/CSV output, and a heap-allocation count per
+// response to show the steady-state handlers allocate nothing.
+#include <unity.h>
+
+#include "chunked_writer.h"
+#include "../helpers/alloc_counter.h"
+#include "../helpers/host_support.h"
+
+// Collects chunks into a fixed buffer so the sink itself never allocates
+struct CaptureSink {
+    char body[8192];
+    size_t length;
+    int chunks;
+    size_t largestChunk;
+    bool ended;
+};
+static CaptureSink sink;
+
+static void captureChunk(void* context, const char* data, size_t length) {
+    CaptureSink* target = (CaptureSink*)context;
+    if (length == 0) {
+        target->ended = true;
+        return;
+    }
+    TEST_ASSERT_FALSE(target->ended);
+    TEST_ASSERT_TRUE(target->length + length < sizeof(target->body));
+    memcpy(target->body + target->length, data, length);
+    target->length += length;
+    target->body[target->length] = 0;
+    target->chunks++;
+    if (length > target->largestChunk) target->largestChunk = length;
+}
+
+static void discardChunk(void*, const char*, size_t) {}
+
+void setUp(void) { memset(&sink, 0, sizeof(sink)); }
+void tearDown(void) {}
+
+void test_nested_structure(void) {
+    JsonWriter json(captureChunk, &sink);
+    json.beginObject();
+    json.field("name", "a");
+    json.key("list");
+    json.beginArray();
+    json.value(1);
+    json.value(false);
+    json.beginObject();
+    json.endObject();
+    json.endArray();
+    json.field("min", (int64_t)INT64_MIN);
+    json.field("max", (uint64_t)UINT64_MAX);
+    json.endObject();
+    size_t written = json.end();
+    TEST_ASSERT_EQUAL(sink.length, written);
+    TEST_ASSERT_TRUE(sink.ended);
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"name\":\"a\",\"list\":[1,false,{}],\"min\":-9223372036854775808,\"max\":18446744073709551615}",
+        sink.body);
+}
+
+void test_escaping(void) {
+    JsonWriter json(captureChunk, &sink);
+    json.beginObject();
+    json.field("q\"k", "say \"hi\"\\ \n\r\t\x01\x1f ok");
+    json.key("message");
+    json.beginString();
+    json.appendString("Command executed: ");
+    json.appendString("</script>\"");
+    json.endString();
+    json.endObject();
+    json.end();
+    TEST_ASSERT_EQUAL_STRING(
+        "{\"q\\\"k\":\"say \\\"hi\\\"\\\\ \\n\\r\\t\\u0001\\u001f ok\","
+        "\"message\":\"Command executed: </script>\\\"\"}",
+        sink.body);
+}
+
+void test_ndjson_records(void) {
+    JsonWriter json(captureChunk, &sink);
+    for (int i = 0; i < 2; i++) {
+        json.beginObject();
+        json.field("record", i);
+        json.rawMember();
+        json.raw("\"fields\":{}");
+        json.endObject();
+        json.newline();
+    }
+    json.end();
+    TEST_ASSERT_EQUAL_STRING("{\"record\":0,\"fields\":{}}\n{\"record\":1,\"fields\":{}}\n", sink.body);
+}
+
+void test_chunks_split_at_buffer_size(void) {
+    ChunkedWriter out(captureChunk, &sink);
+    std::string expected;
+    for (int i = 0; i < 100; i++) {
+        char line[64];
+        snprintf(line, sizeof(line), "service_runs_total{service=\"s%d\"} %d\n", i, i * 7);
+        out.raw(line);
+        expected += line;
+    }
+    size_t written = out.end();
+    TEST_ASSERT_EQUAL(expected.size(), written);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), sink.body);
+    TEST_ASSERT_EQUAL(256, sink.largestChunk);
+    TEST_ASSERT_EQUAL((expected.size() + 255) / 256, (size_t)sink.chunks);
+}
+
+void test_empty_body_still_ends(void) {
+    ChunkedWriter out(captureChunk, &sink);
+    TEST_ASSERT_EQUAL(0, out.end());
+    TEST_ASSERT_TRUE(sink.ended);
+    TEST_ASSERT_EQUAL(0, sink.chunks);
+}
+
+// Same shape as handleFileList: an array of name/size objects
+static size_t writeFileList(JsonWriter& json, int files) {
+    json.beginArray();
+    for (int i = 0; i < files; i++) {
+        char name[24];
+        snprintf(name, sizeof(name), "capture-%d.txt", i);
+        json.beginObject();
+        json.field("name", name);
+        json.field("size", (size_t)(1000 + i * 37));
+        json.endObject();
+    }
+    json.endArray();
+    return json.end();
+}
+
+void test_steady_state_allocates_nothing(void) {
+    {
+        // Warm up stdio so its one-time setup isn't counted
+        JsonWriter json(captureChunk, &sink);
+        writeFileList(json, 1);
+    }
+    setUp();
+    unsigned long before = allocationCount();
+    { std::string counted(64, 'x'); }
+    TEST_ASSERT_EQUAL_MESSAGE(1, allocationCount() - before, "allocation counter not hooked");
+    before = allocationCount();
+    {
+        JsonWriter json(captureChunk, &sink);
+        writeFileList(json, 60);
+    }
+    {
+        JsonWriter json(discardChunk, nullptr);
+        json.beginObject();
+        json.field("success", true);
+        json.key("message");
+        json.beginString();
+        json.appendString("Command executed: ");
+        json.appendString("karma\n\"on\"");
+        json.endString();
+        json.endObject();
+        json.end();
+    }
+    {
+        ChunkedWriter out(discardChunk, nullptr);
+        for (int i = 0; i < 40; i++) out.raw("# TYPE heap_free_bytes gauge\nheap_free_bytes 123456\n");
+        out.end();
+    }
+    TEST_ASSERT_EQUAL(0, allocationCount() - before);
+    TEST_ASSERT_TRUE(sink.length > 2000);
+}
+
+void test_benchmark_file_list(void) {
+    const int responses = 20000;
+    size_t bytes = 0;
+    uint64_t start = hostNowNs();
+    for (int i = 0; i < responses; i++) {
+        JsonWriter json(discardChunk, nullptr);
+        bytes += writeFileList(json, 20);
+    }
+    uint64_t elapsed = hostNowNs() - start;
+    benchReport("file list response, 20 files", "ns", (double)elapsed / responses);
+    benchReport("json writer throughput", "MB/s", bytes * 1e3 / (elapsed ? elapsed : 1));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_nested_structure);
+    RUN_TEST(test_escaping);
+    RUN_TEST(test_ndjson_records);
+    RUN_TEST(test_chunks_split_at_buffer_size);
+    RUN_TEST(test_empty_body_still_ends);
+    RUN_TEST(test_steady_state_allocates_nothing);
+    RUN_TEST(test_benchmark_file_list);
+    return UNITY_END();
+}
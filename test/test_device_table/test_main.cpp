@@ -0,0 +1,170 @@
+// Device table: distinct-device counts per SSID, LRU eviction, index and
+// count consistency under churn, and update cost per probe and memory per
+// device at 1k devices.
+#include <unity.h>
+
+#include "device_table.h"
+#include "../helpers/host_support.h"
+
+static DeviceTable<128> table;
+
+void setUp(void) {
+    table.reset();
+}
+void tearDown(void) {}
+
+static ProbeRecord probeFrom(uint32_t device, const char* ssid, int8_t rssi = -60) {
+    ProbeRecord probe = {};
+    snprintf(probe.ssid, sizeof(probe.ssid), "%s", ssid);
+    probe.mac[0] = 0x02;
+    memcpy(&probe.mac[2], &device, sizeof(device));
+    probe.rssi = rssi;
+    probe.fingerprint = device * 2654435761u;
+    return probe;
+}
+
+// Walks the LRU list and checks it, the MAC index and the per-SSID device
+// counts all agree
+template<int MaxDevices>
+static void checkConsistent(DeviceTable<MaxDevices>& devices) {
+    int listed = 0;
+    int16_t previous = -1;
+    uint16_t ssidDevices[maxProbedSSIDs] = {0};
+    for (int16_t device = devices.lruHead; device >= 0; device = devices.devices[device].next) {
+        const DeviceRecord& record = devices.devices[device];
+        TEST_ASSERT_EQUAL(previous, record.prev);
+        previous = device;
+        listed++;
+        TEST_ASSERT_TRUE(listed <= devices.count);
+
+        int found = 0;
+        for (int slot = 0; slot < devices.indexSize; slot++) {
+            if (devices.index[slot] == device + 1) found++;
+        }
+        TEST_ASSERT_EQUAL(1, found);
+        for (int i = 0; i < devices.ssidCount; i++) {
+            if (record.ssids & (1ULL << i)) ssidDevices[i]++;
+        }
+    }
+    TEST_ASSERT_EQUAL(devices.count, listed);
+    TEST_ASSERT_EQUAL(previous, devices.lruTail);
+    for (int i = 0; i < devices.ssidCount; i++) TEST_ASSERT_EQUAL(ssidDevices[i], devices.ssids[i].devices);
+}
+
+void test_counts_distinct_devices_per_ssid(void) {
+    TEST_ASSERT_EQUAL(1, table.noteProbe(probeFrom(1, "Home"), 0));
+    TEST_ASSERT_EQUAL(1, table.noteProbe(probeFrom(1, "Home"), 10));    // same device again
+    TEST_ASSERT_EQUAL(2, table.noteProbe(probeFrom(2, "Home"), 20));
+    TEST_ASSERT_EQUAL(1, table.noteProbe(probeFrom(2, "Work"), 30));
+    TEST_ASSERT_EQUAL(0, table.noteProbe(probeFrom(3, ""), 40));        // wildcard
+
+    TEST_ASSERT_EQUAL(3, table.count);
+    int home = table.findSSID("Home", false);
+    TEST_ASSERT_EQUAL(3, table.ssids[home].probes);
+    TEST_ASSERT_EQUAL(2, table.ssids[home].devices);
+
+    const DeviceRecord& first = table.devices[0];
+    TEST_ASSERT_EQUAL(0, first.firstSeen);
+    TEST_ASSERT_EQUAL(10, first.lastSeen);
+    TEST_ASSERT_EQUAL(2, first.probes);
+    checkConsistent(table);
+}
+
+void test_rssi_is_smoothed(void) {
+    table.noteProbe(probeFrom(1, "Home", -80), 0);
+    TEST_ASSERT_EQUAL(-80 * 16, table.devices[0].rssiEwma);
+    table.noteProbe(probeFrom(1, "Home", -40), 1);
+    TEST_ASSERT_EQUAL(-70 * 16, table.devices[0].rssiEwma);
+}
+
+void test_full_table_evicts_least_recently_heard(void) {
+    for (uint32_t device = 0; device < 128; device++) table.noteProbe(probeFrom(device, "Home"), device);
+    table.noteProbe(probeFrom(0, "Home"), 200);         // device 0 is recent again
+    uint32_t evictedBefore = table.evicted;
+
+    TEST_ASSERT_EQUAL(128, table.noteProbe(probeFrom(1000, "Home"), 300));
+    TEST_ASSERT_EQUAL(evictedBefore + 1, table.evicted);
+    TEST_ASSERT_EQUAL(128, table.count);
+
+    // Device 1 was the quietest and is gone; device 0 is still known
+    uint32_t newcomer = 1001;
+    table.noteProbe(probeFrom(newcomer, "Work"), 400);   // evicts device 2, a Home prober
+    TEST_ASSERT_EQUAL(127, table.noteProbe(probeFrom(0, "Home"), 500));
+    TEST_ASSERT_EQUAL(evictedBefore + 2, table.evicted);
+    TEST_ASSERT_EQUAL(2, table.noteProbe(probeFrom(1, "Work"), 600));  // back as a new device
+    checkConsistent(table);
+}
+
+void test_untracked_ssids_past_the_table(void) {
+    char name[33];
+    for (int i = 0; i < maxProbedSSIDs + 5; i++) {
+        snprintf(name, sizeof(name), "Network-%d", i);
+        table.noteProbe(probeFrom(i % 10, name), i);
+    }
+    TEST_ASSERT_EQUAL(maxProbedSSIDs, table.ssidCount);
+    TEST_ASSERT_EQUAL(5, table.untrackedProbes);
+}
+
+// 1000 randomized MACs churning through the firmware's 128-entry table
+void test_consistency_under_churn(void) {
+    XorShift rng(99);
+    char name[33];
+    for (int i = 0; i < 200000; i++) {
+        snprintf(name, sizeof(name), "Network-%u", rng.below(80));
+        table.noteProbe(probeFrom(rng.below(1000), rng.below(8) ? name : ""), i);
+        if (i % 20000 == 0) checkConsistent(table);
+    }
+    checkConsistent(table);
+    TEST_ASSERT_EQUAL(128, table.count);
+}
+
+struct ProbeMix {
+    std::vector<ProbeRecord> probes;
+    ProbeMix(uint32_t deviceCount, uint32_t seed) {
+        XorShift rng(seed);
+        char name[33];
+        for (int i = 0; i < 65536; i++) {
+            snprintf(name, sizeof(name), "Network-%u", rng.below(60));
+            probes.push_back(probeFrom(rng.below(deviceCount), rng.below(5) ? name : ""));
+        }
+    }
+};
+
+template<int MaxDevices>
+static double nsPerProbe(DeviceTable<MaxDevices>& devices, const ProbeMix& mix, int rounds) {
+    devices.reset();
+    volatile uint32_t sink = 0;
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < mix.probes.size(); i++) sink = sink + devices.noteProbe(mix.probes[i], i);
+    }
+    return (double)(hostNowNs() - start) / (rounds * mix.probes.size());
+}
+
+void test_benchmark_update_cost_and_memory(void) {
+    static DeviceTable<1024> large;
+    ProbeMix resident(1000, 5), churn(4000, 6);
+
+    benchReport("1k-device table, 1000 devices", "ns/probe", nsPerProbe(large, resident, 30));
+    benchReport("1k-device table, 4000 devices (evicting)", "ns/probe", nsPerProbe(large, churn, 30));
+    benchReport("128-device table, 1000 devices (evicting)", "ns/probe", nsPerProbe(table, resident, 30));
+    checkConsistent(large);
+
+    // Record plus its two index slots, and the whole table with the shared
+    // SSID list spread over its devices
+    benchReport("device record + index", "bytes/device", sizeof(DeviceRecord) + 2 * sizeof(int16_t));
+    benchReport("1k-device table total", "bytes/device", (double)sizeof(DeviceTable<1024>) / 1024);
+    benchReport("128-device table total", "bytes/device", (double)sizeof(DeviceTable<128>) / 128);
+    TEST_ASSERT_EQUAL(44, sizeof(DeviceRecord) + 2 * sizeof(int16_t));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_counts_distinct_devices_per_ssid);
+    RUN_TEST(test_rssi_is_smoothed);
+    RUN_TEST(test_full_table_evicts_least_recently_heard);
+    RUN_TEST(test_untracked_ssids_past_the_table);
+    RUN_TEST(test_consistency_under_churn);
+    RUN_TEST(test_benchmark_update_cost_and_memory);
+    return UNITY_END();
+}
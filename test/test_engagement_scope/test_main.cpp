@@ -0,0 +1,164 @@
+// Engagement scope: verdict order, time windows including ones that wrap
+// midnight, the missing-clock case, and the cost of one decision with a
+// 1k-rule whitelist and a 200-rule scope next to parsing the probe it is for.
+#include <unity.h>
+
+#include "engagement_scope.h"
+#include "probe_parser.h"
+#include "spsc_queue.h"
+#include "../helpers/host_support.h"
+
+static SSIDMatcher whitelist;
+static EngagementProfile profile;
+
+void setUp(void) {
+    whitelist.clear();
+    whitelist.build();
+    profile.active = false;
+    profile.scope.clear();
+    profile.windowCount = 0;
+    profile.maxDwellMs = 0;
+}
+void tearDown(void) {}
+
+static void activate(const char* const* rules, int count) {
+    for (int i = 0; i < count; i++) profile.scope.addRule(rules[i]);
+    profile.scope.build();
+    profile.active = true;
+}
+
+void test_without_a_profile_only_the_whitelist_applies(void) {
+    whitelist.addRule("Home");
+    whitelist.build();
+    TEST_ASSERT_EQUAL(SCOPE_WHITELISTED, scopeVerdict(whitelist, profile, "Home", -1));
+    TEST_ASSERT_EQUAL(SCOPE_ALLOWED, scopeVerdict(whitelist, profile, "Cafe", -1));
+}
+
+void test_whitelist_wins_over_scope(void) {
+    static const char* const rules[] = { "Corp-*" };
+    whitelist.addRule("Corp-Exec");
+    whitelist.build();
+    activate(rules, 1);
+
+    TEST_ASSERT_EQUAL(SCOPE_WHITELISTED, scopeVerdict(whitelist, profile, "Corp-Exec", 600));
+    TEST_ASSERT_EQUAL(SCOPE_ALLOWED, scopeVerdict(whitelist, profile, "Corp-Lab", 600));
+    TEST_ASSERT_EQUAL(SCOPE_OUT_OF_SCOPE, scopeVerdict(whitelist, profile, "Cafe", 600));
+}
+
+void test_windows_and_clock(void) {
+    static const char* const rules[] = { "*" };
+    activate(rules, 1);
+    profile.windows[0] = { 9 * 60, 17 * 60 };         // 09:00-17:00
+    profile.windows[1] = { 22 * 60, 2 * 60 };         // 22:00-02:00, wraps
+    profile.windowCount = 2;
+
+    TEST_ASSERT_EQUAL(SCOPE_ALLOWED, scopeVerdict(whitelist, profile, "Lab", 9 * 60));
+    TEST_ASSERT_EQUAL(SCOPE_OUTSIDE_WINDOW, scopeVerdict(whitelist, profile, "Lab", 17 * 60));
+    TEST_ASSERT_EQUAL(SCOPE_ALLOWED, scopeVerdict(whitelist, profile, "Lab", 23 * 60));
+    TEST_ASSERT_EQUAL(SCOPE_ALLOWED, scopeVerdict(whitelist, profile, "Lab", 60));
+    TEST_ASSERT_EQUAL(SCOPE_OUTSIDE_WINDOW, scopeVerdict(whitelist, profile, "Lab", 3 * 60));
+    TEST_ASSERT_EQUAL(SCOPE_NO_CLOCK, scopeVerdict(whitelist, profile, "Lab", -1));
+
+    // Without windows the clock doesn't matter
+    profile.windowCount = 0;
+    TEST_ASSERT_EQUAL(SCOPE_ALLOWED, scopeVerdict(whitelist, profile, "Lab", -1));
+}
+
+// The net task's decideScope(): verdict, counter and the queued log line
+static uint32_t verdictCounts[SCOPE_VERDICT_COUNT];
+static SpscQueue<ScopeDecision, 32> logQueue;
+
+static ScopeVerdict decide(const char* ssid, uint32_t nowMs, int minute) {
+    ScopeVerdict verdict = scopeVerdict(whitelist, profile, ssid, minute);
+    verdictCounts[verdict]++;
+    if (profile.active) {
+        ScopeDecision decision = {};
+        decision.timeMs = nowMs;
+        decision.minuteOfDay = minute;
+        decision.verdict = verdict;
+        strncpy(decision.ssid, ssid, sizeof(decision.ssid) - 1);
+        logQueue.push(decision);
+    }
+    return verdict;
+}
+
+void test_benchmark_decision_cost(void) {
+    char rule[40];
+    XorShift rng(31);
+    for (int i = 0; i < 1000; i++) {
+        if (i % 10 < 8) snprintf(rule, sizeof(rule), "Neighbour-%u", i);
+        else snprintf(rule, sizeof(rule), "Shop%u-*", i);
+        whitelist.addRule(rule);
+    }
+    whitelist.build();
+    for (int i = 0; i < 200; i++) {
+        if (i % 4 < 3) snprintf(rule, sizeof(rule), "Client-AP-%u", i);
+        else snprintf(rule, sizeof(rule), "*-Site%u", i);
+        profile.scope.addRule(rule);
+    }
+    profile.scope.build();
+    profile.windows[0] = { 8 * 60, 18 * 60 };
+    profile.windows[1] = { 21 * 60, 23 * 60 };
+    profile.windowCount = 2;
+
+    // Probes for in-scope, whitelisted and unrelated networks
+    std::vector<std::vector<uint8_t> > frames;
+    char ssid[33];
+    for (int i = 0; i < 4096; i++) {
+        uint32_t kind = rng.below(4);
+        if (kind == 0) snprintf(ssid, sizeof(ssid), "Client-AP-%u", rng.below(200));
+        else if (kind == 1) snprintf(ssid, sizeof(ssid), "Neighbour-%u", rng.below(1000));
+        else snprintf(ssid, sizeof(ssid), "HomeNet-%08x", rng.next());
+        frames.push_back(ProbeFrameBuilder().ssid(ssid).bytes);
+    }
+    std::vector<std::string> ssids;
+    for (size_t i = 0; i < frames.size(); i++) {
+        TEST_ASSERT_TRUE(parseProbeSSID(frames[i].data(), frames[i].size(), ssid) > 0);
+        ssids.push_back(ssid);
+    }
+
+    const int rounds = 200;
+    const double perRound = rounds * (double)frames.size();
+    volatile uint32_t sink = 0;
+    ScopeDecision drained;
+
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < frames.size(); i++) sink = sink + parseProbeSSID(frames[i].data(), frames[i].size(), ssid);
+    }
+    double parse = (hostNowNs() - start) / perRound;
+
+    profile.active = false;
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < ssids.size(); i++) sink = sink + decide(ssids[i].c_str(), i, 600);
+    }
+    double whitelistOnly = (hostNowNs() - start) / perRound;
+
+    profile.active = true;
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < ssids.size(); i++) {
+            sink = sink + decide(ssids[i].c_str(), i, 600);
+            logQueue.pop(drained);    // the storage service keeps up
+        }
+    }
+    double withProfile = (hostNowNs() - start) / perRound;
+
+    benchReport("probe parse (reference)", "ns/probe", parse);
+    benchReport("decision, 1k-rule whitelist only", "ns/decision", whitelistOnly);
+    benchReport("decision, + 200-rule scope, windows, log", "ns/decision", withProfile);
+    TEST_ASSERT_EQUAL(0, logQueue.dropped.load());
+    TEST_ASSERT_TRUE(verdictCounts[SCOPE_ALLOWED] > 0);
+    TEST_ASSERT_TRUE(verdictCounts[SCOPE_WHITELISTED] > 0);
+    TEST_ASSERT_TRUE(verdictCounts[SCOPE_OUT_OF_SCOPE] > 0);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_without_a_profile_only_the_whitelist_applies);
+    RUN_TEST(test_whitelist_wins_over_scope);
+    RUN_TEST(test_windows_and_clock);
+    RUN_TEST(test_benchmark_decision_cost);
+    return UNITY_END();
+}
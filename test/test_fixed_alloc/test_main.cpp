@@ -0,0 +1,200 @@
+// Bump arena, SSID pool and fixed column behaviour, and heap allocations
+// over a replayed one-hour session: the arena/pool code paths against models
+// of the new[]/String code they replaced. std::string stands in for Arduino
+// String (both keep short values inline). Fragmentation depends on the
+// ESP-IDF heap and is not measured here; the heap_largest_free_block_bytes
+// gauge in /metrics tracks it on the device.
+#include <unity.h>
+
+#include "fixed_alloc.h"
+#include "../helpers/alloc_counter.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_arena_alignment_and_overflow(void) {
+    BumpArena<64> arena;
+    char* text = arena.printf("%s-%d", "abc", 7);
+    TEST_ASSERT_EQUAL_STRING("abc-7", text);
+    uint64_t* wide = arena.allocArray<uint64_t>(2);
+    TEST_ASSERT_NOT_NULL(wide);
+    TEST_ASSERT_EQUAL(0, (uintptr_t)wide % alignof(uint64_t));
+    TEST_ASSERT_EQUAL(24, arena.used);
+
+    TEST_ASSERT_NULL(arena.alloc(41));
+    TEST_ASSERT_EQUAL(1, arena.overflows);
+    TEST_ASSERT_NOT_NULL(arena.alloc(40));
+    TEST_ASSERT_EQUAL(64, arena.highWater);
+
+    arena.reset();
+    TEST_ASSERT_EQUAL(0, arena.used);
+    TEST_ASSERT_EQUAL(64, arena.highWater);
+    TEST_ASSERT_NULL(arena.printf("%065d", 1));
+}
+
+void test_pool_evicts_oldest(void) {
+    SSIDPool<3> pool;
+    TEST_ASSERT_FALSE(pool.push("a"));
+    TEST_ASSERT_FALSE(pool.push("b"));
+    TEST_ASSERT_FALSE(pool.push("c"));
+    TEST_ASSERT_TRUE(pool.push("d"));
+    TEST_ASSERT_EQUAL(3, pool.size());
+    TEST_ASSERT_EQUAL_STRING("b", pool[0]);
+    TEST_ASSERT_EQUAL_STRING("d", pool[2]);
+    TEST_ASSERT_FALSE(pool.contains("a"));
+    TEST_ASSERT_TRUE(pool.contains("c"));
+
+    pool.push("0123456789abcdef0123456789abcdef-too-long");
+    TEST_ASSERT_EQUAL(32, strlen(pool[2]));
+}
+
+void test_column_stops_at_capacity(void) {
+    FixedColumn<uint16_t, 4> column;
+    for (uint16_t i = 0; i < 4; i++) TEST_ASSERT_TRUE(column.push_back(i * 10));
+    TEST_ASSERT_TRUE(column.full());
+    TEST_ASSERT_FALSE(column.push_back(99));
+    TEST_ASSERT_EQUAL(4, column.size());
+    TEST_ASSERT_EQUAL(30, column[3]);
+    column.clear();
+    TEST_ASSERT_EQUAL(0, column.size());
+    TEST_ASSERT_TRUE(column.push_back(7));
+}
+
+// One hour of use: the operator turns the encoder through the SSID and
+// script menus, Karma saves a new SSID every ~10 s, and phones on the
+// portal fetch pages and captive probes
+enum SessionEventType { MENU_STEP, SSID_SAVED, HTTP_REQUEST };
+struct SessionEvent { SessionEventType type; int value; };
+
+static std::vector<SessionEvent> buildSessionTrace() {
+    std::vector<SessionEvent> trace;
+    XorShift rng(3600);
+    for (int second = 0; second < 3600; second++) {
+        if (rng.below(2) == 0) trace.push_back({ MENU_STEP, (int)rng.below(120) });
+        if (rng.below(10) == 0) trace.push_back({ SSID_SAVED, second });
+        for (int n = rng.below(3); n > 0; n--) trace.push_back({ HTTP_REQUEST, (int)rng.below(4) });
+    }
+    return trace;
+}
+
+static const char* const requestPaths[] = { "/", "/style.css", "/generate_204", "/deleteFile" };
+const int visibleItems = 4;
+const int ssidCapacity = 100;
+
+// What the firmware did before: a vector of Strings for saved SSIDs, a new[]
+// array per menu redraw, a String per visible item and Strings for paths
+struct LegacySession {
+    std::vector<std::string> ssids;
+    volatile size_t sink = 0;
+
+    void menuStep(int index) {
+        int count = (int)ssids.size() + 1;
+        const char** items = new const char*[count];
+        for (size_t i = 0; i < ssids.size(); i++) items[i] = ssids[i].c_str();
+        items[count - 1] = "Back";
+        for (int i = 0; i < visibleItems; i++) {
+            std::string displayText = std::string(items[(index + i) % count]);
+            if (displayText.size() > 16) displayText = displayText.substr(0, 13) + "...";
+            sink = sink + displayText.size();
+        }
+        delete[] items;
+    }
+
+    void ssidSaved(int second) {
+        char name[33];
+        snprintf(name, sizeof(name), "Probed-Network-%05d", second);
+        for (const auto& s : ssids) {
+            if (s == name) return;
+        }
+        ssids.push_back(name);
+        if ((int)ssids.size() > ssidCapacity) ssids.erase(ssids.begin());
+    }
+
+    void request(int kind) {
+        std::string path = requestPaths[kind];
+        if (path[path.size() - 1] == '/') path += "index.html";
+        if (kind == 3) path = "/" + std::string("capture-0001.txt");
+        sink = sink + path.size();
+    }
+};
+
+// The current code paths
+struct ArenaSession {
+    SSIDPool<ssidCapacity> ssids;
+    BumpArena<1024> frameArena;
+    BumpArena<512> requestArena;
+    volatile size_t sink = 0;
+
+    void menuStep(int index) {
+        int count = ssids.size() + 1;
+        const char** items = frameArena.allocArray<const char*>(count);
+        TEST_ASSERT_NOT_NULL(items);
+        for (int i = 0; i < ssids.size(); i++) items[i] = ssids[i];
+        items[count - 1] = "Back";
+        for (int i = 0; i < visibleItems; i++) {
+            const char* displayText = items[(index + i) % count];
+            if (strlen(displayText) > 16) {
+                const char* truncated = frameArena.printf("%.*s...", 13, displayText);
+                if (truncated) displayText = truncated;
+            }
+            sink = sink + strlen(displayText);
+        }
+        frameArena.reset();
+    }
+
+    void ssidSaved(int second) {
+        char name[33];
+        snprintf(name, sizeof(name), "Probed-Network-%05d", second);
+        if (!ssids.contains(name)) ssids.push(name);
+    }
+
+    void request(int kind) {
+        const char* path = requestPaths[kind];
+        if (path[strlen(path) - 1] == '/') path = requestArena.printf("%sindex.html", path);
+        if (kind == 3) path = requestArena.printf("/%s", "capture-0001.txt");
+        TEST_ASSERT_NOT_NULL(path);
+        sink = sink + strlen(path);
+        requestArena.reset();
+    }
+};
+
+template <typename Session>
+static unsigned long replaySession(const std::vector<SessionEvent>& trace, Session& session) {
+    return allocationsDuring([&]() {
+        for (const SessionEvent& event : trace) {
+            switch (event.type) {
+                case MENU_STEP: session.menuStep(event.value); break;
+                case SSID_SAVED: session.ssidSaved(event.value); break;
+                case HTTP_REQUEST: session.request(event.value); break;
+            }
+        }
+    });
+}
+
+void test_replay_one_hour_session(void) {
+    std::vector<SessionEvent> trace = buildSessionTrace();
+    static LegacySession legacy;
+    static ArenaSession arenas;
+
+    unsigned long legacyAllocations = replaySession(trace, legacy);
+    unsigned long arenaAllocations = replaySession(trace, arenas);
+
+    benchReport("session events", "events", (double)trace.size());
+    benchReport("heap allocations, new[]/String", "allocs", (double)legacyAllocations);
+    benchReport("heap allocations, arenas + pool", "allocs", (double)arenaAllocations);
+    benchReport("frame arena high water", "bytes", (double)arenas.frameArena.highWater);
+    benchReport("request arena high water", "bytes", (double)arenas.requestArena.highWater);
+    TEST_ASSERT_EQUAL(0, arenaAllocations);
+    TEST_ASSERT_EQUAL(0, arenas.frameArena.overflows + arenas.requestArena.overflows);
+    TEST_ASSERT_TRUE(legacyAllocations > 0);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_arena_alignment_and_overflow);
+    RUN_TEST(test_pool_evicts_oldest);
+    RUN_TEST(test_column_stops_at_capacity);
+    RUN_TEST(test_replay_one_hour_session);
+    return UNITY_END();
+}
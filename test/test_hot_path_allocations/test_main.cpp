@@ -0,0 +1,113 @@
+// Heap allocations per operation on the hot paths shared with the firmware.
+// Each must allocate nothing once warmed up; a regression fails here
+// instead of showing up as fragmentation after a long Karma session.
+#include <unity.h>
+
+#include "capture_record.h"
+#include "chunked_writer.h"
+#include "dns_responder.h"
+#include "probe_parser.h"
+#include "route_index.h"
+#include "../helpers/alloc_counter.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void discardChunk(void*, const char*, size_t) {}
+
+// Runs op a number of times, reports allocations per call and returns the
+// total
+template <typename Op>
+static unsigned long allocationsPerCall(const char* name, Op op) {
+    op();   // first call may set up stdio and the like
+    const int calls = 1000;
+    unsigned long total = allocationsDuring([&]() {
+        for (int i = 0; i < calls; i++) op();
+    });
+    benchReport(name, "allocs/op", (double)total / calls);
+    return total;
+}
+
+void test_counter_is_hooked(void) {
+    TEST_ASSERT_EQUAL(1, allocationsDuring([]() { std::string counted(64, 'x'); }));
+}
+
+void test_probe_parse(void) {
+    ProbeFrameBuilder frame;
+    frame.ssid("CoffeeShop").rates().htCapabilities();
+    char ssid[33];
+    volatile uint32_t sink = 0;
+    TEST_ASSERT_EQUAL(0, allocationsPerCall("probe parse + fingerprint", [&]() {
+        if (parseProbeSSID(frame.bytes.data(), frame.bytes.size(), ssid) >= 0) {
+            sink = sink + probeFingerprint(frame.bytes.data(), frame.bytes.size());
+        }
+    }));
+}
+
+void test_dns_answer(void) {
+    static DnsResponder responder;
+    const uint8_t portal[4] = {192, 168, 4, 1};
+    responder.setAddress(portal);
+    responder.addOverride("telemetry.example.com", DNS_RCODE_NXDOMAIN);
+    uint8_t query[dnsMaxPacket];
+    uint8_t packet[dnsMaxPacket];
+    int length = buildDnsQuery(query, 1, "captive.apple.com", 1);
+    TEST_ASSERT_EQUAL(0, allocationsPerCall("dns answer", [&]() {
+        memcpy(packet, query, length);
+        responder.buildResponse(packet, length);
+    }));
+}
+
+void test_route_lookup(void) {
+    static const char* const paths[] = { "/generate_204", "/submit", "/metrics", "/hotspot-detect.html" };
+    RouteIndex<64> index;
+    index.clear();
+    for (int i = 0; i < 4; i++) index.add(1, paths[i], i);
+    int next = 0;
+    volatile int sink = 0;
+    TEST_ASSERT_EQUAL(0, allocationsPerCall("route lookup", [&]() {
+        const char* path = paths[next++ & 3];
+        sink = sink + index.find(1, path, [&](int entry) { return strcmp(paths[entry], path) == 0; });
+    }));
+}
+
+void test_json_response(void) {
+    TEST_ASSERT_EQUAL(0, allocationsPerCall("json response, 20 objects", []() {
+        JsonWriter json(discardChunk, nullptr);
+        json.beginArray();
+        for (int i = 0; i < 20; i++) {
+            json.beginObject();
+            json.field("name", "capture.txt");
+            json.field("size", i * 1000);
+            json.endObject();
+        }
+        json.endArray();
+        json.end();
+    }));
+}
+
+void test_capture_dedup_check(void) {
+    const uint8_t mac[6] = {0x02, 1, 2, 3, 4, 5};
+    CaptureRecord records[32] = {};
+    for (int i = 0; i < 32; i++) records[i].bootId = 3;
+    const char body[] = "{\"email\":\"sample@example.com\"}";
+    volatile int sink = 0;
+    TEST_ASSERT_EQUAL(0, allocationsPerCall("capture dedup check, 32 records", [&]() {
+        uint32_t hash = captureHash(body, sizeof(body) - 1);
+        for (int i = 0; i < 32; i++) {
+            if (records[i].bodyHash == hash && captureSameClient(records[i], 3, 0, mac)) sink = sink + 1;
+        }
+    }));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_counter_is_hooked);
+    RUN_TEST(test_probe_parse);
+    RUN_TEST(test_dns_answer);
+    RUN_TEST(test_route_lookup);
+    RUN_TEST(test_json_response);
+    RUN_TEST(test_capture_dedup_check);
+    return UNITY_END();
+}
@@ -0,0 +1,183 @@
+// Log ring: slot reuse across laps, truncation, drops on a full ring,
+// ordering and loss accounting with several producer threads, and the cost
+// of one log call with the level enabled, enabled on a full ring, and
+// filtered out at runtime.
+#include <unity.h>
+
+#include <thread>
+
+#include "log_ring.h"
+#include "../helpers/host_support.h"
+
+const int slotCount = 32;                  // logSlotCount and logLineSize in main.cpp
+const size_t lineSize = 96;
+typedef LogRing<slotCount, lineSize> Ring;
+
+static Ring ring;
+static uint32_t droppedCalls;
+
+// The firmware's logWrite() and LOG_I(), against this ring
+static void logWrite(uint8_t level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void logWrite(uint8_t level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    bool queued = ring.write(level, 0, format, args);
+    va_end(args);
+    if (!queued) droppedCalls++;
+}
+static volatile bool debugMode = true;
+#define LOG_I(...) do { if (debugMode) logWrite(3, __VA_ARGS__); } while (0)
+
+static int drainAll() {
+    int drained = 0;
+    while (ring.peek()) {
+        ring.release();
+        drained++;
+    }
+    return drained;
+}
+
+void setUp(void) {
+    drainAll();
+    droppedCalls = 0;
+    debugMode = true;
+}
+void tearDown(void) {}
+
+void test_messages_come_out_in_order_across_laps(void) {
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < 20; i++) LOG_I("round %d line %d", round, i);
+        for (int i = 0; i < 20; i++) {
+            const Ring::Slot* slot = ring.peek();
+            TEST_ASSERT_NOT_NULL(slot);
+            char expected[32];
+            snprintf(expected, sizeof(expected), "round %d line %d", round, i);
+            TEST_ASSERT_EQUAL(strlen(expected), slot->length);
+            TEST_ASSERT_EQUAL(0, memcmp(expected, slot->text, slot->length));
+            TEST_ASSERT_EQUAL(3, slot->level);
+            ring.release();
+        }
+        TEST_ASSERT_NULL(ring.peek());
+    }
+}
+
+void test_long_lines_are_truncated(void) {
+    std::string text(200, 'x');
+    LOG_I("%s", text.c_str());
+    const Ring::Slot* slot = ring.peek();
+    TEST_ASSERT_NOT_NULL(slot);
+    TEST_ASSERT_EQUAL(lineSize - 1, slot->length);
+    TEST_ASSERT_EQUAL('\0', slot->text[lineSize - 1]);
+    ring.release();
+}
+
+void test_full_ring_drops_until_drained(void) {
+    for (int i = 0; i < slotCount + 10; i++) LOG_I("line %d", i);
+    TEST_ASSERT_EQUAL(10, droppedCalls);
+    TEST_ASSERT_EQUAL(slotCount, drainAll());
+    LOG_I("after");
+    TEST_ASSERT_EQUAL(1, drainAll());
+}
+
+void test_filtered_calls_never_reach_the_ring(void) {
+    debugMode = false;
+    LOG_I("hidden %d", 1);
+    TEST_ASSERT_NULL(ring.peek());
+}
+
+// logWrite() without the shared drop counter, for producer threads
+static bool ringWrite(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    bool queued = ring.write(3, 0, format, args);
+    va_end(args);
+    return queued;
+}
+
+// Three cores' worth of producers against one consumer: every message either
+// arrives, in order for its producer, or is counted as dropped
+void test_concurrent_producers(void) {
+    const int producers = 3;
+    const int perProducer = 50000;
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<int> running{producers};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.push_back(std::thread([&, p]() {
+            for (int i = 0; i < perProducer; i++) {
+                if (ringWrite("%d %d", p, i)) continue;
+                dropped.fetch_add(1);
+                std::this_thread::yield();       // give the consumer a turn, as a blocked task would
+            }
+            running.fetch_sub(1);
+        }));
+    }
+
+    int last[producers] = { -1, -1, -1 };
+    uint32_t received = 0;
+    for (;;) {
+        bool done = running.load() == 0;
+        if (!ring.peek()) std::this_thread::yield();
+        while (const Ring::Slot* slot = ring.peek()) {
+            int producer = -1, index = -1;
+            TEST_ASSERT_EQUAL(2, sscanf(slot->text, "%d %d", &producer, &index));
+            TEST_ASSERT_TRUE(producer >= 0 && producer < producers);
+            TEST_ASSERT_TRUE(index > last[producer]);
+            last[producer] = index;
+            ring.release();
+            received++;
+        }
+        if (done) break;
+    }
+    for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+
+    TEST_ASSERT_EQUAL((uint32_t)producers * perProducer, received + dropped.load());
+    TEST_ASSERT_TRUE(received > 0);
+}
+
+void test_benchmark_call_cost(void) {
+    const int calls = 2000000;
+
+    // Enabled, with the ring drained between batches as the log task does;
+    // only the calls are timed
+    uint64_t elapsed = 0;
+    for (int i = 0; i < calls; i += slotCount) {
+        uint64_t start = hostNowNs();
+        for (int j = 0; j < slotCount; j++) LOG_I("Probe %s on channel %d, rssi %d", "Corp-Guest", j % 13 + 1, -60);
+        elapsed += hostNowNs() - start;
+        TEST_ASSERT_EQUAL(slotCount, drainAll());
+    }
+    double enabled = (double)elapsed / calls;
+
+    // Enabled against a full ring: the drop path
+    for (int i = 0; i < slotCount; i++) LOG_I("fill %d", i);
+    droppedCalls = 0;
+    uint64_t start = hostNowNs();
+    for (int i = 0; i < calls; i++) LOG_I("Probe %s on channel %d, rssi %d", "Corp-Guest", i % 13 + 1, -60);
+    double full = (double)(hostNowNs() - start) / calls;
+    TEST_ASSERT_EQUAL((uint32_t)calls, droppedCalls);
+    drainAll();
+
+    // Filtered out at runtime: one flag test, no formatting
+    debugMode = false;
+    start = hostNowNs();
+    for (int i = 0; i < calls; i++) LOG_I("Probe %s on channel %d, rssi %d", "Corp-Guest", i % 13 + 1, -60);
+    double disabled = (double)(hostNowNs() - start) / calls;
+    TEST_ASSERT_NULL(ring.peek());
+
+    benchReport("log call, enabled", "ns/call", enabled);
+    benchReport("log call, enabled, ring full", "ns/call", full);
+    benchReport("log call, filtered out", "ns/call", disabled);
+    TEST_ASSERT_TRUE(disabled < enabled);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_messages_come_out_in_order_across_laps);
+    RUN_TEST(test_long_lines_are_truncated);
+    RUN_TEST(test_full_ring_drops_until_drained);
+    RUN_TEST(test_filtered_calls_never_reach_the_ring);
+    RUN_TEST(test_concurrent_producers);
+    RUN_TEST(test_benchmark_call_cost);
+    return UNITY_END();
+}
@@ -0,0 +1,208 @@
+// Probe request parser: malformed-frame corpus, differential fuzzing against
+// a straightforward reference walker, and a frames/s benchmark.
+#include <unity.h>
+
+#include "probe_parser.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Reference: the same rules written as plainly as possible, used as the
+// oracle for fuzzing
+static int referenceParseSSID(const std::vector<uint8_t>& frame, std::string& ssid) {
+    if (frame.size() < 24) return -1;
+    size_t pos = 24;
+    while (frame.size() - pos >= 2) {
+        size_t id = frame[pos];
+        size_t length = frame[pos + 1];
+        if (frame.size() - pos - 2 < length) return -1;
+        if (id == 0) {
+            if (length > 32) return -1;
+            ssid.assign((const char*)&frame[pos + 2], length);
+            return (int)length;
+        }
+        pos += 2 + length;
+    }
+    return -1;
+}
+
+static int parse(const std::vector<uint8_t>& frame, char* ssid) {
+    // Copy into an exactly sized allocation so a sanitizer build catches
+    // any read past the end
+    std::vector<uint8_t> exact(frame);
+    return parseProbeSSID(exact.empty() ? nullptr : exact.data(), exact.size(), ssid);
+}
+
+void test_named_ssid(void) {
+    char ssid[33];
+    ProbeFrameBuilder frame;
+    frame.ssid("CoffeeShop").rates();
+    TEST_ASSERT_EQUAL(10, parse(frame.bytes, ssid));
+    TEST_ASSERT_EQUAL_STRING("CoffeeShop", ssid);
+}
+
+void test_wildcard_ssid(void) {
+    char ssid[33];
+    ProbeFrameBuilder frame;
+    frame.ssid("").rates();
+    TEST_ASSERT_EQUAL(0, parse(frame.bytes, ssid));
+    TEST_ASSERT_EQUAL_STRING("", ssid);
+}
+
+void test_ssid_after_other_elements(void) {
+    char ssid[33];
+    ProbeFrameBuilder frame;
+    frame.rates().htCapabilities().ssid("Later");
+    TEST_ASSERT_EQUAL(5, parse(frame.bytes, ssid));
+    TEST_ASSERT_EQUAL_STRING("Later", ssid);
+}
+
+void test_longest_ssid(void) {
+    char ssid[33];
+    const char* name = "0123456789abcdef0123456789abcdef";
+    ProbeFrameBuilder frame;
+    frame.ssid(name);
+    TEST_ASSERT_EQUAL(32, parse(frame.bytes, ssid));
+    TEST_ASSERT_EQUAL_STRING(name, ssid);
+}
+
+void test_malformed_corpus(void) {
+    char ssid[33];
+    std::vector<std::vector<uint8_t>> corpus;
+
+    corpus.push_back({});                                          // empty
+    corpus.push_back(std::vector<uint8_t>(23, 0x40));              // short header
+    corpus.push_back(ProbeFrameBuilder().bytes);                   // no elements
+
+    ProbeFrameBuilder oneByte;
+    oneByte.bytes.push_back(0);                                    // element id only
+    corpus.push_back(oneByte.bytes);
+
+    ProbeFrameBuilder overlong;
+    overlong.ssid("Truncated");
+    overlong.bytes.resize(overlong.bytes.size() - 3);              // length runs past the end
+    corpus.push_back(overlong.bytes);
+
+    ProbeFrameBuilder tooBig;
+    std::string name(33, 'x');
+    tooBig.element(0, name.data(), name.size());                   // SSID over 32 bytes
+    corpus.push_back(tooBig.bytes);
+
+    ProbeFrameBuilder maxLength;
+    maxLength.bytes.push_back(0);
+    maxLength.bytes.push_back(255);                                // 255 claimed, 4 present
+    maxLength.bytes.insert(maxLength.bytes.end(), 4, 'a');
+    corpus.push_back(maxLength.bytes);
+
+    ProbeFrameBuilder brokenBefore;
+    brokenBefore.rates();
+    brokenBefore.bytes.push_back(45);
+    brokenBefore.bytes.push_back(200);                             // HT element past the end
+    corpus.push_back(brokenBefore.bytes);
+
+    ProbeFrameBuilder noSSID;
+    noSSID.rates().htCapabilities();
+    corpus.push_back(noSSID.bytes);
+
+    for (size_t i = 0; i < corpus.size(); i++) {
+        TEST_ASSERT_EQUAL_MESSAGE(-1, parse(corpus[i], ssid), "malformed frame accepted");
+    }
+}
+
+void test_fingerprint_ignores_mac(void) {
+    const uint8_t macA[6] = {0x02, 1, 2, 3, 4, 5};
+    const uint8_t macB[6] = {0x06, 9, 8, 7, 6, 5};
+    ProbeFrameBuilder a(macA), b(macB), c(macA);
+    a.ssid("Home").rates().htCapabilities(1);
+    b.ssid("Work").rates().htCapabilities(1);
+    c.ssid("Home").rates().htCapabilities(2);
+    TEST_ASSERT_EQUAL_HEX32(probeFingerprint(a.bytes.data(), a.bytes.size()),
+                            probeFingerprint(b.bytes.data(), b.bytes.size()));
+    TEST_ASSERT_NOT_EQUAL(probeFingerprint(a.bytes.data(), a.bytes.size()),
+                          probeFingerprint(c.bytes.data(), c.bytes.size()));
+}
+
+// Mutates valid frames (byte flips, length rewrites, truncation, extension)
+// and checks the parser agrees with the reference on every one
+void test_fuzz_against_reference(void) {
+    XorShift rng(0x5eed);
+    const char* names[] = {"", "a", "CoffeeShop", "0123456789abcdef0123456789abcdef"};
+    char ssid[33];
+    std::string expected;
+
+    for (int iteration = 0; iteration < 200000; iteration++) {
+        ProbeFrameBuilder frame;
+        if (rng.below(2)) frame.rates();
+        frame.ssid(names[rng.below(4)]);
+        if (rng.below(2)) frame.htCapabilities((uint8_t)rng.next());
+        std::vector<uint8_t>& bytes = frame.bytes;
+
+        int mutations = 1 + rng.below(4);
+        for (int m = 0; m < mutations; m++) {
+            switch (rng.below(4)) {
+                case 0: bytes[rng.below(bytes.size())] = (uint8_t)rng.next(); break;
+                case 1: if (bytes.size() > 25) bytes[24 + rng.below(bytes.size() - 24)] = (uint8_t)rng.below(64); break;
+                case 2: bytes.resize(rng.below(bytes.size() + 1)); break;
+                case 3: for (int n = rng.below(8); n > 0; n--) bytes.push_back((uint8_t)rng.next()); break;
+            }
+            if (bytes.empty()) break;
+        }
+
+        int result = parse(bytes, ssid);
+        int reference = referenceParseSSID(bytes, expected);
+        TEST_ASSERT_EQUAL(reference, result);
+        if (result >= 0) {
+            TEST_ASSERT_EQUAL(expected.size(), (size_t)result);
+            TEST_ASSERT_EQUAL_MEMORY(expected.data(), ssid, (size_t)result);
+            TEST_ASSERT_EQUAL(0, ssid[result]);
+        }
+        probeFingerprint(bytes.empty() ? nullptr : bytes.data(), bytes.size());
+    }
+}
+
+// Realistic mix: mostly named probes with rates and HT, some wildcard
+// probes and a few malformed frames
+void test_benchmark_throughput(void) {
+    std::vector<std::vector<uint8_t>> frames;
+    XorShift rng(42);
+    for (int i = 0; i < 256; i++) {
+        ProbeFrameBuilder frame;
+        char name[33];
+        snprintf(name, sizeof(name), "Network-%u", rng.below(1000));
+        int kind = rng.below(10);
+        if (kind < 7) frame.ssid(name).rates().htCapabilities((uint8_t)i);
+        else if (kind < 9) frame.ssid("").rates();
+        else { frame.ssid(name); frame.bytes.resize(frame.bytes.size() - 2); }
+        frames.push_back(frame.bytes);
+    }
+
+    const int rounds = 4000;
+    char ssid[33];
+    volatile uint32_t sink = 0;
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < frames.size(); i++) {
+            const std::vector<uint8_t>& frame = frames[i];
+            int length = parseProbeSSID(frame.data(), frame.size(), ssid);
+            if (length >= 0) sink = sink + probeFingerprint(frame.data(), frame.size());
+        }
+    }
+    uint64_t elapsed = hostNowNs() - start;
+    double framesPerSecond = (double)rounds * frames.size() * 1e9 / (elapsed ? elapsed : 1);
+    benchReport("probe parse + fingerprint", "frames/s", framesPerSecond);
+    TEST_ASSERT_GREATER_THAN(0, framesPerSecond);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_named_ssid);
+    RUN_TEST(test_wildcard_ssid);
+    RUN_TEST(test_ssid_after_other_elements);
+    RUN_TEST(test_longest_ssid);
+    RUN_TEST(test_malformed_corpus);
+    RUN_TEST(test_fingerprint_ignores_mac);
+    RUN_TEST(test_fuzz_against_reference);
+    RUN_TEST(test_benchmark_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,276 @@
+// Probe intake and replay: sniffer counters and dedup, traces recorded by the
+// pcap writer replayed with their channel and RSSI, pacing by speed, the
+// report's unique SSID count past the tracked table, and replay throughput.
+#include <unity.h>
+
+#include "pcap_buffer.h"
+#include "probe_replay.h"
+#include "spsc_queue.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// In-memory pcap with the read/position/seek calls ProbeReplay needs
+struct MemoryFile {
+    std::vector<uint8_t> bytes;
+    size_t pos = 0;
+    size_t read(uint8_t* buffer, size_t length) {
+        size_t available = pos < bytes.size() ? bytes.size() - pos : 0;
+        if (length > available) length = available;
+        memcpy(buffer, bytes.data() + pos, length);
+        pos += length;
+        return length;
+    }
+    size_t position() { return pos; }
+    bool seek(size_t position) { pos = position; return true; }
+};
+
+// Records frames through the firmware's pcap writer, draining as it goes
+struct TraceBuilder {
+    PcapDoubleBuffer* pcap = new PcapDoubleBuffer();
+    MemoryFile file;
+
+    TraceBuilder() {
+        pcap->reset();
+        const uint8_t* header = (const uint8_t*)pcapFileHeader;
+        file.bytes.assign(header, header + sizeof(pcapFileHeader));
+    }
+    ~TraceBuilder() { delete pcap; }
+
+    void add(const std::vector<uint8_t>& frame, uint32_t atMs, uint8_t channel = 6, int8_t rssi = -60) {
+        TEST_ASSERT_TRUE(pcap->append(frame.data(), frame.size(), channel, rssi, atMs * 1000));
+        if (PcapBuffer* full = pcap->full()) {
+            file.bytes.insert(file.bytes.end(), full->data, full->data + full->used);
+            pcap->release(*full);
+        }
+    }
+
+    MemoryFile& finish() {
+        pcap->drain([this](PcapBuffer& buffer) {
+            file.bytes.insert(file.bytes.end(), buffer.data, buffer.data + buffer.used);
+        });
+        return file;
+    }
+};
+
+static std::vector<uint8_t> probeFor(const char* ssid, uint8_t macTail = 0x55) {
+    const uint8_t mac[6] = {0x02, 0x11, 0x22, 0x33, 0x44, macTail};
+    ProbeFrameBuilder frame(mac);
+    frame.ssid(ssid).rates();
+    return frame.bytes;
+}
+
+static void appendChunk(void* context, const char* data, size_t length) {
+    ((std::string*)context)->append(data, length);
+}
+
+void test_sniffer_counters_and_dedup(void) {
+    static ProbeSniffer sniffer;
+    ProbeRecord probe;
+    std::vector<uint8_t> home = probeFor("Home"), work = probeFor("Work"), wildcard = probeFor("");
+    std::vector<uint8_t> beacon = home;
+    beacon[0] = 0x80;
+    std::vector<uint8_t> truncated(home.begin(), home.begin() + 28);    // inside the SSID element
+
+    TEST_ASSERT_FALSE(sniffer.accept(false, home.data(), home.size(), 1, -50, probe));
+    TEST_ASSERT_FALSE(sniffer.accept(true, beacon.data(), beacon.size(), 1, -50, probe));
+    TEST_ASSERT_FALSE(sniffer.accept(true, truncated.data(), truncated.size(), 1, -50, probe));
+
+    TEST_ASSERT_TRUE(sniffer.accept(true, home.data(), home.size(), 3, -41, probe));
+    TEST_ASSERT_TRUE(probe.forward);
+    TEST_ASSERT_EQUAL_STRING("Home", probe.ssid);
+    TEST_ASSERT_EQUAL(3, probe.channel);
+    TEST_ASSERT_EQUAL(-41, probe.rssi);
+    TEST_ASSERT_EQUAL(0x55, probe.mac[5]);
+
+    TEST_ASSERT_TRUE(sniffer.accept(true, home.data(), home.size(), 3, -41, probe));
+    TEST_ASSERT_FALSE(probe.forward);
+    TEST_ASSERT_TRUE(sniffer.accept(true, wildcard.data(), wildcard.size(), 3, -41, probe));
+    TEST_ASSERT_FALSE(probe.forward);
+    TEST_ASSERT_TRUE(sniffer.accept(true, work.data(), work.size(), 3, -41, probe));
+    TEST_ASSERT_TRUE(probe.forward);
+
+    // A reset forgets the previous SSID, so the next probe goes to the UI
+    sniffer.requestReset();
+    TEST_ASSERT_TRUE(sniffer.accept(true, work.data(), work.size(), 3, -41, probe));
+    TEST_ASSERT_TRUE(probe.forward);
+
+    SnifferStatsSnapshot stats = sniffer.snapshot();
+    TEST_ASSERT_EQUAL(8, stats.seen);
+    TEST_ASSERT_EQUAL(2, stats.rejected);
+    TEST_ASSERT_EQUAL(1, stats.malformed);
+    TEST_ASSERT_EQUAL(5, stats.accepted);
+    TEST_ASSERT_EQUAL(1, stats.repeats);
+}
+
+void test_recorded_trace_replays_channel_and_rssi(void) {
+    TraceBuilder trace;
+    std::vector<uint8_t> home = probeFor("Home");
+    trace.add(home, 0, 11, -70);
+    trace.add(probeFor("Work"), 5, 14, -33);
+    MemoryFile& file = trace.finish();
+
+    static ProbeReplay replay;
+    SnifferStatsSnapshot before = {};
+    TEST_ASSERT_TRUE(replay.begin(file, 0, before, 0));
+    TEST_ASSERT_EQUAL(127, replay.linkType);
+
+    const uint8_t* frame;
+    size_t length;
+    uint8_t channel;
+    int8_t rssi;
+    TEST_ASSERT_EQUAL(REPLAY_FRAME, replay.next(file, 0));
+    TEST_ASSERT_TRUE(replay.decode(frame, length, channel, rssi));
+    TEST_ASSERT_EQUAL(home.size(), length);
+    TEST_ASSERT_EQUAL_MEMORY(home.data(), frame, length);
+    TEST_ASSERT_EQUAL(11, channel);
+    TEST_ASSERT_EQUAL(-70, rssi);
+
+    TEST_ASSERT_EQUAL(REPLAY_FRAME, replay.next(file, 0));
+    TEST_ASSERT_TRUE(replay.decode(frame, length, channel, rssi));
+    TEST_ASSERT_EQUAL(14, channel);
+    TEST_ASSERT_EQUAL(-33, rssi);
+    TEST_ASSERT_EQUAL(REPLAY_END, replay.next(file, 0));
+
+    // Not a pcap at all
+    MemoryFile text;
+    text.bytes.assign(24, 'x');
+    TEST_ASSERT_FALSE(replay.begin(text, 1, before, 0));
+}
+
+void test_pacing_and_oversized_records(void) {
+    TraceBuilder trace;
+    trace.add(probeFor("A"), 1000);
+    trace.add(probeFor("B"), 2000);
+    trace.add(probeFor("C"), 3000);
+    MemoryFile& file = trace.finish();
+
+    // Make the second record longer than a replay can hold; it is skipped
+    size_t second = sizeof(pcapFileHeader) + sizeof(PcapRecordHeader) + sizeof(PcapRadiotap) + probeFor("A").size();
+    uint32_t captured;
+    memcpy(&captured, &file.bytes[second + 8], sizeof(captured));
+    std::vector<uint8_t> padding(maxReplayRecord, 0);
+    file.bytes.insert(file.bytes.begin() + second + sizeof(PcapRecordHeader) + captured, padding.begin(), padding.end());
+    captured += padding.size();
+    memcpy(&file.bytes[second + 8], &captured, sizeof(captured));
+
+    static ProbeReplay replay;
+    SnifferStatsSnapshot before = {};
+    TEST_ASSERT_TRUE(replay.begin(file, 2, before, 0));
+    TEST_ASSERT_EQUAL(REPLAY_FRAME, replay.next(file, 0));      // first record sets the origin
+    TEST_ASSERT_EQUAL(REPLAY_WAIT, replay.next(file, 0));       // B is due 1000 / 2 ms in
+    TEST_ASSERT_EQUAL(REPLAY_WAIT, replay.next(file, 499));
+    TEST_ASSERT_EQUAL(REPLAY_WAIT, replay.next(file, 999));     // B skipped, C due at 1000
+    TEST_ASSERT_EQUAL(REPLAY_FRAME, replay.next(file, 1000));
+    char ssid[33];
+    TEST_ASSERT_EQUAL(1, parseProbeSSID(replay.record + sizeof(PcapRadiotap),
+                                        replay.recordLength - sizeof(PcapRadiotap), ssid));
+    TEST_ASSERT_EQUAL_STRING("C", ssid);
+    TEST_ASSERT_EQUAL(REPLAY_END, replay.next(file, 1000));
+}
+
+// Replays a trace the way src/host/replay.cpp does and returns the report
+static std::string replayReport(MemoryFile& file, ProbeReplay& replay) {
+    static ProbeSniffer sniffer;
+    static SpscQueue<ProbeRecord, 64> queue;
+    sniffer.requestReset();
+    TEST_ASSERT_TRUE(replay.begin(file, 1, sniffer.snapshot(), queue.dropped.load()));
+
+    uint32_t nowMs = 0;
+    ReplayStep step;
+    do {
+        while ((step = replay.next(file, nowMs)) == REPLAY_FRAME) {
+            const uint8_t* frame;
+            size_t length;
+            uint8_t channel;
+            int8_t rssi;
+            if (!replay.decode(frame, length, channel, rssi)) continue;
+            replay.noteFrame(frame, length, nowMs);
+            ProbeRecord probe;
+            if (sniffer.accept(true, frame, length, channel, rssi, probe)) queue.push(probe);
+            replay.noteQueueDepth(queue.size());
+        }
+        ProbeRecord probe;
+        while (queue.pop(probe)) {
+            if (probe.forward) replay.noteForward(probe.ssid, nowMs);
+        }
+        nowMs += 10;
+    } while (step != REPLAY_END);
+
+    std::string report;
+    JsonWriter json(appendChunk, &report);
+    replay.writeReport(json, nowMs, sniffer.snapshot(), queue.dropped.load());
+    json.end();
+    return report;
+}
+
+void test_report_counts_each_ssid_once(void) {
+    TraceBuilder trace;
+    char name[33];
+    uint32_t atMs = 0;
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 40; i++) {
+            snprintf(name, sizeof(name), "Network-%d", i);
+            trace.add(probeFor(name), atMs += 7);
+        }
+    }
+    static ProbeReplay replay;
+    std::string report = replayReport(trace.finish(), replay);
+
+    TEST_ASSERT_EQUAL(maxReplaySSIDs, replay.ssidCount);
+    TEST_ASSERT_EQUAL(40, replay.uniqueSSIDs());
+    TEST_ASSERT_TRUE(report.find("\"frames\":120,\"probes\":120,") != std::string::npos);
+    TEST_ASSERT_TRUE(report.find("\"uniqueSSIDs\":40,\"dedupHits\":0,") != std::string::npos);
+    TEST_ASSERT_TRUE(report.find("\"ssid\":\"Network-0\",\"firstSeenMs\":0,\"timeToForwardMs\":0}") != std::string::npos);
+    TEST_ASSERT_TRUE(report.find("uniqueSSIDsCapped") == std::string::npos);
+}
+
+void test_report_flags_capped_unique_count(void) {
+    TraceBuilder trace;
+    char name[33];
+    for (int i = 0; i < 400; i++) {
+        snprintf(name, sizeof(name), "Network-%d", i);
+        trace.add(probeFor(name), i);
+    }
+    static ProbeReplay replay;
+    std::string report = replayReport(trace.finish(), replay);
+    TEST_ASSERT_EQUAL(maxReplaySSIDs + replayUntrackedSlots * 3 / 4, replay.uniqueSSIDs());
+    TEST_ASSERT_TRUE(report.find("\"uniqueSSIDsCapped\":true") != std::string::npos);
+}
+
+// Frames per second through replay, intake and queue on the host: the
+// ceiling a speed-0 replay is held to before device timing applies
+void test_benchmark_replay_throughput(void) {
+    TraceBuilder trace;
+    XorShift rng(11);
+    char name[33];
+    const int frames = 20000;
+    for (int i = 0; i < frames; i++) {
+        snprintf(name, sizeof(name), "Network-%u", rng.below(60));
+        trace.add(probeFor(name, (uint8_t)rng.next()), i);
+    }
+    MemoryFile& file = trace.finish();
+
+    static ProbeReplay replay;
+    const int rounds = 20;
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        file.pos = 0;
+        replayReport(file, replay);
+    }
+    uint64_t elapsed = hostNowNs() - start;
+    benchReport("replay + intake + queue", "frames/s", (double)rounds * frames * 1e9 / elapsed);
+    TEST_ASSERT_EQUAL(frames, replay.frames);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sniffer_counters_and_dedup);
+    RUN_TEST(test_recorded_trace_replays_channel_and_rssi);
+    RUN_TEST(test_pacing_and_oversized_records);
+    RUN_TEST(test_report_counts_each_ssid_once);
+    RUN_TEST(test_report_flags_capped_unique_count);
+    RUN_TEST(test_benchmark_replay_throughput);
+    return UNITY_END();
+}
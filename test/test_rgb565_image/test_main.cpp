@@ -0,0 +1,183 @@
+// .565 splash decoding: the shipped data/logo.565 drawn band by band, as
+// drawRgb565File does, must match data/logo.bmp drawn through the BMP path
+// byte for byte; plus truncated input and decode time for both paths.
+// Decode times exclude flash reads; the file sizes show how much each path
+// reads from SPIFFS. In memory the RLE decode costs about the same as the
+// BMP path, since both touch every pixel once. The device's win is reading
+// about 20 KB instead of 97 KB from flash, and the raw .565 shows the decode
+// floor with no conversion at all.
+#include <unity.h>
+
+#include "rgb565_image.h"
+#include "../helpers/host_support.h"
+
+#ifndef PROJECT_DATA_DIR
+#define PROJECT_DATA_DIR "data"
+#endif
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static std::vector<uint8_t> readFile(const char* name) {
+    std::string path = std::string(PROJECT_DATA_DIR) + "/" + name;
+    std::vector<uint8_t> bytes;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return bytes;
+    uint8_t chunk[4096];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), file)) > 0) bytes.insert(bytes.end(), chunk, chunk + count);
+    fclose(file);
+    return bytes;
+}
+
+// In-memory stand-in for a SPIFFS File
+struct MemorySource {
+    const std::vector<uint8_t>& bytes;
+    size_t pos;
+    MemorySource(const std::vector<uint8_t>& data, size_t start) : bytes(data), pos(start) {}
+    size_t read(uint8_t* out, size_t length) {
+        size_t count = std::min(length, bytes.size() - pos);
+        memcpy(out, bytes.data() + pos, count);
+        pos += count;
+        return count;
+    }
+};
+
+struct Framebuffer {
+    int width = 0;
+    int height = 0;
+    std::vector<uint16_t> pixels;   // in panel byte order, as pushImageDMA gets them
+};
+
+static uint32_t readLE32(const std::vector<uint8_t>& data, size_t offset) {
+    return data[offset] | data[offset + 1] << 8 | data[offset + 2] << 16 | (uint32_t)data[offset + 3] << 24;
+}
+
+// The BMP path: M5GFX's drawBmpFile reads bottom-up BGR rows and converts
+// each pixel to swapped RGB565
+static bool drawBmp(const std::vector<uint8_t>& bmp, Framebuffer& frame) {
+    if (bmp.size() < 54 || bmp[0] != 'B' || bmp[1] != 'M') return false;
+    uint32_t pixelOffset = readLE32(bmp, 10);
+    int32_t width = (int32_t)readLE32(bmp, 18);
+    int32_t height = (int32_t)readLE32(bmp, 22);
+    int bytesPerPixel = (bmp[28] | bmp[29] << 8) / 8;
+    bool topDown = height < 0;
+    if (topDown) height = -height;
+    size_t stride = (width * bytesPerPixel + 3) & ~3;
+
+    frame.width = width;
+    frame.height = height;
+    frame.pixels.assign((size_t)width * height, 0);
+    for (int row = 0; row < height; row++) {
+        const uint8_t* source = &bmp[pixelOffset + (topDown ? row : height - 1 - row) * stride];
+        for (int col = 0; col < width; col++) {
+            uint8_t b = source[col * bytesPerPixel], g = source[col * bytesPerPixel + 1], r = source[col * bytesPerPixel + 2];
+            uint16_t color = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+            uint8_t panel[2] = { (uint8_t)(color >> 8), (uint8_t)color };
+            memcpy(&frame.pixels[(size_t)row * width + col], panel, 2);
+        }
+    }
+    return true;
+}
+
+// The .565 path, in the same bands and order as drawRgb565File
+static bool draw565(const std::vector<uint8_t>& image, Framebuffer& frame) {
+    const int bandLines = 8;
+    Rgb565Header header;
+    if (image.size() < sizeof(header)) return false;
+    memcpy(&header, image.data(), sizeof(header));
+    if (!rgb565HeaderValid(header)) return false;
+
+    frame.width = header.width;
+    frame.height = header.height;
+    frame.pixels.assign((size_t)header.width * header.height, 0);
+    MemorySource source(image, sizeof(header));
+    Rgb565Decoder<MemorySource> decoder(source);
+    std::vector<uint16_t> band((size_t)header.width * bandLines);
+    for (int row = 0; row < header.height; row += bandLines) {
+        int lines = std::min(bandLines, header.height - row);
+        size_t count = (size_t)header.width * lines;
+        bool ok = (header.flags & rgb565FlagRLE)
+                      ? decoder.decodeRLE(band.data(), count)
+                      : source.read((uint8_t*)band.data(), count * 2) == count * 2;
+        if (!ok) return false;
+        memcpy(&frame.pixels[(size_t)row * header.width], band.data(), count * 2);
+    }
+    return true;
+}
+
+// Raw .565 of a framebuffer, as bmp_to_rgb565.py --raw writes it
+static std::vector<uint8_t> encodeRaw(const Framebuffer& frame) {
+    Rgb565Header header = { {'R', '5', '6', '5'}, (uint16_t)frame.width, (uint16_t)frame.height, 0, {0, 0, 0} };
+    std::vector<uint8_t> image(sizeof(header) + frame.pixels.size() * 2);
+    memcpy(image.data(), &header, sizeof(header));
+    memcpy(image.data() + sizeof(header), frame.pixels.data(), frame.pixels.size() * 2);
+    return image;
+}
+
+void test_logo_matches_bmp_path(void) {
+    std::vector<uint8_t> bmp = readFile("logo.bmp");
+    std::vector<uint8_t> image = readFile("logo.565");
+    TEST_ASSERT_TRUE_MESSAGE(!bmp.empty() && !image.empty(), "run from the project directory");
+
+    Framebuffer expected, actual;
+    TEST_ASSERT_TRUE(drawBmp(bmp, expected));
+    TEST_ASSERT_TRUE(draw565(image, actual));
+    TEST_ASSERT_EQUAL(expected.width, actual.width);
+    TEST_ASSERT_EQUAL(expected.height, actual.height);
+    TEST_ASSERT_EQUAL_MEMORY(expected.pixels.data(), actual.pixels.data(), expected.pixels.size() * 2);
+}
+
+void test_raw_image_matches_bmp_path(void) {
+    Framebuffer expected, actual;
+    TEST_ASSERT_TRUE(drawBmp(readFile("logo.bmp"), expected));
+    TEST_ASSERT_TRUE(draw565(encodeRaw(expected), actual));
+    TEST_ASSERT_EQUAL_MEMORY(expected.pixels.data(), actual.pixels.data(), expected.pixels.size() * 2);
+}
+
+void test_truncated_and_bad_images_fail(void) {
+    std::vector<uint8_t> image = readFile("logo.565");
+    Framebuffer frame;
+    std::vector<uint8_t> truncated(image.begin(), image.begin() + image.size() / 2);
+    TEST_ASSERT_FALSE(draw565(truncated, frame));
+    std::vector<uint8_t> badMagic(image);
+    badMagic[0] = 'X';
+    TEST_ASSERT_FALSE(draw565(badMagic, frame));
+    std::vector<uint8_t> headerOnly(image.begin(), image.begin() + sizeof(Rgb565Header));
+    TEST_ASSERT_FALSE(draw565(headerOnly, frame));
+}
+
+void test_benchmark_decode(void) {
+    std::vector<uint8_t> bmp = readFile("logo.bmp");
+    std::vector<uint8_t> image = readFile("logo.565");
+    Framebuffer frame;
+    TEST_ASSERT_TRUE(drawBmp(bmp, frame));
+    std::vector<uint8_t> raw = encodeRaw(frame);
+
+    const int rounds = 500;
+    uint64_t start = hostNowNs();
+    for (int i = 0; i < rounds; i++) drawBmp(bmp, frame);
+    double bmpUs = (hostNowNs() - start) / 1e3 / rounds;
+    start = hostNowNs();
+    for (int i = 0; i < rounds; i++) draw565(image, frame);
+    double rleUs = (hostNowNs() - start) / 1e3 / rounds;
+    start = hostNowNs();
+    for (int i = 0; i < rounds; i++) draw565(raw, frame);
+    double rawUs = (hostNowNs() - start) / 1e3 / rounds;
+
+    benchReport("splash decode, BMP path", "us", bmpUs);
+    benchReport("splash decode, RLE .565", "us", rleUs);
+    benchReport("splash decode, raw .565", "us", rawUs);
+    benchReport("splash file, BMP", "bytes", (double)bmp.size());
+    benchReport("splash file, RLE .565", "bytes", (double)image.size());
+    benchReport("splash file, raw .565", "bytes", (double)raw.size());
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_logo_matches_bmp_path);
+    RUN_TEST(test_raw_image_matches_bmp_path);
+    RUN_TEST(test_truncated_and_bad_images_fail);
+    RUN_TEST(test_benchmark_decode);
+    return UNITY_END();
+}
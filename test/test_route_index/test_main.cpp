@@ -0,0 +1,119 @@
+// Route index: lookups for every route and captive probe, misses, and a
+// dispatch-time benchmark over a captive-portal request mix compared with a
+// linear scan of the registered handlers.
+#include <unity.h>
+
+#include "route_index.h"
+#include "../helpers/host_support.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Same values as WebServer's HTTPMethod
+enum { GET = 1, POST = 3, DELETE = 4 };
+
+struct TestRoute { uint32_t method; const char* path; };
+
+// Mirrors routes[] and captiveProbes[] in main.cpp
+static const TestRoute routes[] = {
+    { GET, "/upload" },   { POST, "/upload" },  { POST, "/submit" },    { GET, "/logs" },
+    { GET, "/files" },    { GET, "/stations" }, { GET, "/captures" },   { GET, "/pcap" },
+    { GET, "/devices" },  { GET, "/ssid-stats" }, { GET, "/metrics" },  { GET, "/boot" },
+    { GET, "/trace" },    { DELETE, "/deleteFile" },
+};
+static const int routeCount = sizeof(routes) / sizeof(routes[0]);
+static const char* const captiveProbes[] = {
+    "/generate_204", "/gen_204", "/hotspot-detect.html", "/library/test/success.html",
+    "/connecttest.txt", "/ncsi.txt", "/redirect", "/success.txt", "/canonical.html",
+    "/check_network_status.txt",
+};
+static const int captiveProbeCount = sizeof(captiveProbes) / sizeof(captiveProbes[0]);
+
+static RouteIndex<64> routeIndex;
+
+static void buildIndex() {
+    routeIndex.clear();
+    for (int i = 0; i < routeCount; i++) routeIndex.add(routes[i].method, routes[i].path, i);
+    for (int i = 0; i < captiveProbeCount; i++) routeIndex.add(GET, captiveProbes[i], routeCount + i);
+}
+
+static int find(uint32_t method, const char* path) {
+    return routeIndex.find(method, path, [&](int entry) {
+        if (entry < routeCount) return routes[entry].method == method && strcmp(routes[entry].path, path) == 0;
+        return method == GET && strcmp(captiveProbes[entry - routeCount], path) == 0;
+    });
+}
+
+// What WebServer did: walk the handler list in registration order
+static int linearFind(uint32_t method, const char* path) {
+    for (int i = 0; i < routeCount; i++) {
+        if (routes[i].method == method && strcmp(routes[i].path, path) == 0) return i;
+    }
+    for (int i = 0; i < captiveProbeCount; i++) {
+        if (method == GET && strcmp(captiveProbes[i], path) == 0) return routeCount + i;
+    }
+    return -1;
+}
+
+void test_every_entry_is_found(void) {
+    buildIndex();
+    for (int i = 0; i < routeCount; i++) TEST_ASSERT_EQUAL(i, find(routes[i].method, routes[i].path));
+    for (int i = 0; i < captiveProbeCount; i++) TEST_ASSERT_EQUAL(routeCount + i, find(GET, captiveProbes[i]));
+}
+
+void test_misses(void) {
+    buildIndex();
+    TEST_ASSERT_EQUAL(-1, find(POST, "/logs"));
+    TEST_ASSERT_EQUAL(-1, find(GET, "/deleteFile"));
+    TEST_ASSERT_EQUAL(-1, find(POST, "/generate_204"));
+    TEST_ASSERT_EQUAL(-1, find(GET, "/"));
+    TEST_ASSERT_EQUAL(-1, find(GET, "/style.css"));
+    TEST_ASSERT_EQUAL(-1, find(GET, "/logs/"));
+    TEST_ASSERT_EQUAL(-1, find(GET, ""));
+}
+
+void test_content_types(void) {
+    TEST_ASSERT_EQUAL_STRING("text/html", contentTypeFor("/index.html"));
+    TEST_ASSERT_EQUAL_STRING("image/jpeg", contentTypeFor("/a.jpeg"));
+    TEST_ASSERT_EQUAL_STRING("text/plain", contentTypeFor("/html"));
+}
+
+// Phones hammer the probe URLs, the portal pulls its page and assets, and a
+// few admin requests and unknown paths (static fallback) are mixed in
+void test_benchmark_dispatch(void) {
+    buildIndex();
+    static const TestRoute mix[] = {
+        { GET, "/generate_204" }, { GET, "/hotspot-detect.html" }, { GET, "/generate_204" },
+        { GET, "/connecttest.txt" }, { GET, "/" }, { GET, "/index.html" }, { GET, "/style.css" },
+        { GET, "/favicon.ico" }, { POST, "/submit" }, { GET, "/gen_204" }, { GET, "/success.txt" },
+        { GET, "/metrics" }, { GET, "/logs" }, { GET, "/wpad.dat" }, { GET, "/hotspot-detect.html" },
+        { DELETE, "/deleteFile" },
+    };
+    const int mixLength = sizeof(mix) / sizeof(mix[0]);
+    for (int i = 0; i < mixLength; i++) TEST_ASSERT_EQUAL(linearFind(mix[i].method, mix[i].path), find(mix[i].method, mix[i].path));
+
+    const int rounds = 200000;
+    volatile int sink = 0;
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < mixLength; i++) sink = sink + find(mix[i].method, mix[i].path);
+    }
+    uint64_t indexed = hostNowNs() - start;
+    start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < mixLength; i++) sink = sink + linearFind(mix[i].method, mix[i].path);
+    }
+    uint64_t linear = hostNowNs() - start;
+
+    benchReport("route dispatch, index", "ns/request", (double)indexed / (rounds * mixLength));
+    benchReport("route dispatch, linear scan", "ns/request", (double)linear / (rounds * mixLength));
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_entry_is_found);
+    RUN_TEST(test_misses);
+    RUN_TEST(test_content_types);
+    RUN_TEST(test_benchmark_dispatch);
+    return UNITY_END();
+}
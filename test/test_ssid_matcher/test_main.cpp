@@ -0,0 +1,161 @@
+// SSID matcher: exact, prefix, suffix and match-all rules, rule length limits,
+// and lookup cost with 1k rules compared with a linear scan of the rule list.
+#include <unity.h>
+
+#include "ssid_matcher.h"
+#include "../helpers/host_support.h"
+
+static SSIDMatcher matcher;
+
+void setUp(void) {
+    matcher.clear();
+}
+void tearDown(void) {}
+
+void test_exact_prefix_and_suffix_rules(void) {
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule("Home"));
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule("Corp-*"));
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule("*-Guest"));
+    matcher.build();
+
+    TEST_ASSERT_TRUE(matcher.matches("Home"));
+    TEST_ASSERT_FALSE(matcher.matches("Home2"));
+    TEST_ASSERT_FALSE(matcher.matches("Hom"));
+    TEST_ASSERT_TRUE(matcher.matches("Corp-"));
+    TEST_ASSERT_TRUE(matcher.matches("Corp-Lab"));
+    TEST_ASSERT_FALSE(matcher.matches("Corp"));
+    TEST_ASSERT_TRUE(matcher.matches("Cafe-Guest"));
+    TEST_ASSERT_FALSE(matcher.matches("Cafe-Guests"));
+    TEST_ASSERT_FALSE(matcher.matches(""));
+    TEST_ASSERT_EQUAL(3, matcher.ruleCount);
+}
+
+void test_comments_and_whitespace(void) {
+    TEST_ASSERT_EQUAL(SSID_RULE_SKIPPED, matcher.addRule(""));
+    TEST_ASSERT_EQUAL(SSID_RULE_SKIPPED, matcher.addRule("   \r"));
+    TEST_ASSERT_EQUAL(SSID_RULE_SKIPPED, matcher.addRule("# Corp-*"));
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule("  Lab \r"));
+    matcher.build();
+
+    TEST_ASSERT_TRUE(matcher.matches("Lab"));
+    TEST_ASSERT_FALSE(matcher.matches("Corp-Lab"));
+    TEST_ASSERT_EQUAL(1, matcher.ruleCount);
+}
+
+void test_lone_star_matches_everything(void) {
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule("*"));
+    matcher.build();
+    TEST_ASSERT_TRUE(matcher.matches("Anything"));
+    TEST_ASSERT_TRUE(matcher.matches(""));
+
+    matcher.clear();
+    matcher.build();
+    TEST_ASSERT_FALSE(matcher.matches("Anything"));
+}
+
+void test_rules_longer_than_an_ssid_are_rejected(void) {
+    const char* longest = "0123456789abcdef0123456789abcdef";     // 32 bytes
+    std::string tooLong = std::string(longest) + "x";
+
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule(longest));
+    TEST_ASSERT_EQUAL(SSID_RULE_TOO_LONG, matcher.addRule(tooLong.c_str()));
+    matcher.build();
+    TEST_ASSERT_TRUE(matcher.matches(longest));
+    TEST_ASSERT_FALSE(matcher.matches(tooLong.c_str()));
+
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule((std::string(longest) + "*").c_str()));
+    TEST_ASSERT_EQUAL(SSID_RULE_TOO_LONG, matcher.addRule((tooLong + "*").c_str()));
+    TEST_ASSERT_EQUAL(SSID_RULE_ADDED, matcher.addRule(("*" + std::string(longest)).c_str()));
+    TEST_ASSERT_EQUAL(SSID_RULE_TOO_LONG, matcher.addRule(("*" + tooLong).c_str()));
+    TEST_ASSERT_EQUAL(3, matcher.ruleCount);
+}
+
+// A client engagement's worth of rules: mostly exact names, some prefix and
+// suffix patterns, as they would appear in /whitelist.txt
+struct RuleSet {
+    std::vector<std::string> rules;
+    RuleSet(int count, uint32_t seed) {
+        XorShift rng(seed);
+        char rule[40];
+        for (int i = 0; i < count; i++) {
+            uint32_t kind = rng.below(10);
+            if (kind < 7) snprintf(rule, sizeof(rule), "Client-%u-AP-%u", rng.below(500), i);
+            else if (kind < 9) snprintf(rule, sizeof(rule), "Site%u-*", i);
+            else snprintf(rule, sizeof(rule), "*-Branch%u", i);
+            rules.push_back(rule);
+        }
+    }
+};
+
+// What the whitelist did before it was compiled: every rule, in order
+static bool linearMatch(const std::vector<std::string>& rules, const char* ssid) {
+    size_t length = strlen(ssid);
+    for (size_t i = 0; i < rules.size(); i++) {
+        const std::string& rule = rules[i];
+        size_t stem = rule.size() - 1;
+        if (rule.back() == '*') {
+            if (length >= stem && memcmp(ssid, rule.data(), stem) == 0) return true;
+        } else if (rule[0] == '*') {
+            if (length >= stem && memcmp(ssid + length - stem, rule.data() + 1, stem) == 0) return true;
+        } else if (rule == ssid) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void test_benchmark_lookup_with_1k_rules(void) {
+    RuleSet set(1000, 17);
+    for (size_t i = 0; i < set.rules.size(); i++) matcher.addRule(set.rules[i].c_str());
+    matcher.build();
+    TEST_ASSERT_EQUAL(1000, matcher.ruleCount);
+
+    // Probed SSIDs heard in the field: mostly misses, some hits of each kind
+    XorShift rng(23);
+    std::vector<std::string> ssids;
+    char ssid[33];
+    for (int i = 0; i < 4096; i++) {
+        uint32_t kind = rng.below(20);
+        if (kind == 0) snprintf(ssid, sizeof(ssid), "%s", set.rules[rng.below(1000)].c_str());
+        else if (kind == 1) snprintf(ssid, sizeof(ssid), "Site%u-Floor2", rng.below(1000));
+        else if (kind == 2) snprintf(ssid, sizeof(ssid), "Shop-Branch%u", rng.below(1000));
+        else snprintf(ssid, sizeof(ssid), "HomeNet-%08x", rng.next());
+        if (ssid[strlen(ssid) - 1] == '*') ssid[strlen(ssid) - 1] = '\0';
+        ssids.push_back(ssid);
+    }
+
+    for (size_t i = 0; i < ssids.size(); i++) {
+        TEST_ASSERT_EQUAL(linearMatch(set.rules, ssids[i].c_str()), matcher.matches(ssids[i].c_str()));
+    }
+
+    const int rounds = 200;
+    volatile uint32_t hits = 0;
+    uint64_t start = hostNowNs();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < ssids.size(); i++) hits = hits + matcher.matches(ssids[i].c_str());
+    }
+    double compiled = (double)(hostNowNs() - start) / (rounds * ssids.size());
+
+    start = hostNowNs();
+    for (int round = 0; round < rounds / 20; round++) {
+        for (size_t i = 0; i < ssids.size(); i++) hits = hits + linearMatch(set.rules, ssids[i].c_str());
+    }
+    double linear = (double)(hostNowNs() - start) / (rounds / 20 * ssids.size());
+
+    benchReport("compiled matcher, 1k rules", "ns/lookup", compiled);
+    benchReport("linear rule scan, 1k rules", "ns/lookup", linear);
+    size_t bytes = matcher.names.size() + matcher.slots.size() * sizeof(SSIDNameSlot) +
+                   (matcher.prefixes.size() + matcher.suffixes.size()) * sizeof(SSIDTrieNode);
+    benchReport("compiled matcher memory, 1k rules", "bytes", bytes);
+    TEST_ASSERT_TRUE(compiled < linear);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_exact_prefix_and_suffix_rules);
+    RUN_TEST(test_comments_and_whitespace);
+    RUN_TEST(test_lone_star_matches_everything);
+    RUN_TEST(test_rules_longer_than_an_ssid_are_rejected);
+    RUN_TEST(test_benchmark_lookup_with_1k_rules);
+    return UNITY_END();
+}
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Convert 24/32-bit BMP images to the firmware's .565 splash format.
+
+Layout (little-endian header, 12 bytes):
+    char[4]  magic "R565"
+    uint16   width
+    uint16   height
+    uint8    flags (bit 0: RLE)
+    uint8[3] reserved
+followed by top-down RGB565 pixels in display byte order (high byte first).
+
+With RLE each packet starts with a control byte n:
+    n < 128   n + 1 literal pixels follow
+    n >= 128  the next pixel repeats n - 126 times (2..129)
+
+Usage:
+    tools/bmp_to_rgb565.py data/logo.bmp            # writes data/logo.565
+    tools/bmp_to_rgb565.py --raw in.bmp out.565
+    tools/bmp_to_rgb565.py --all data               # every BMP in data/
+
+Also usable as a PlatformIO pre-script: it then converts any BMP in data/
+whose .565 is missing or older, so the filesystem image stays in sync.
+"""
+
+import os
+import struct
+import sys
+
+MAGIC = b"R565"
+FLAG_RLE = 0x01
+
+
+def read_bmp(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:2] != b"BM":
+        raise ValueError("%s: not a BMP file" % path)
+    pixel_offset = struct.unpack_from("<I", data, 10)[0]
+    width, height, planes, bpp = struct.unpack_from("<iiHH", data, 18)
+    compression = struct.unpack_from("<I", data, 30)[0]
+    if bpp not in (24, 32) or compression not in (0, 3):
+        raise ValueError("%s: only uncompressed 24/32-bit BMPs are supported" % path)
+
+    top_down = height < 0
+    height = abs(height)
+    bytes_per_pixel = bpp // 8
+    stride = (width * bytes_per_pixel + 3) & ~3
+
+    pixels = []
+    for row in range(height):
+        source_row = row if top_down else height - 1 - row
+        start = pixel_offset + source_row * stride
+        for col in range(width):
+            b, g, r = data[start + col * bytes_per_pixel:start + col * bytes_per_pixel + 3]
+            pixels.append(((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3))
+    return width, height, pixels
+
+
+def encode_rle(pixels):
+    out = bytearray()
+    literals = []
+
+    def flush_literals():
+        while literals:
+            chunk = literals[:128]
+            del literals[:128]
+            out.append(len(chunk) - 1)
+            for p in chunk:
+                out.extend(struct.pack(">H", p))
+
+    i = 0
+    while i < len(pixels):
+        run = 1
+        while i + run < len(pixels) and run < 129 and pixels[i + run] == pixels[i]:
+            run += 1
+        if run >= 2:
+            flush_literals()
+            out.append(run + 126)
+            out.extend(struct.pack(">H", pixels[i]))
+        else:
+            literals.append(pixels[i])
+        i += run
+    flush_literals()
+    return bytes(out)
+
+
+def convert(source, target, rle=True):
+    width, height, pixels = read_bmp(source)
+    if rle:
+        body = encode_rle(pixels)
+        flags = FLAG_RLE
+    else:
+        body = b"".join(struct.pack(">H", p) for p in pixels)
+        flags = 0
+    with open(target, "wb") as f:
+        f.write(MAGIC + struct.pack("<HHB3x", width, height, flags) + body)
+    return width, height, len(body) + 12
+
+
+def convert_directory(directory):
+    for name in sorted(os.listdir(directory)):
+        if not name.lower().endswith(".bmp"):
+            continue
+        source = os.path.join(directory, name)
+        target = os.path.splitext(source)[0] + ".565"
+        if os.path.exists(target) and os.path.getmtime(target) >= os.path.getmtime(source):
+            continue
+        width, height, size = convert(source, target)
+        print("bmp_to_rgb565: %s -> %s (%dx%d, %d bytes)" % (source, target, width, height, size))
+
+
+def main(argv):
+    rle = "--raw" not in argv
+    args = [a for a in argv if a != "--raw"]
+    if len(args) == 2 and args[0] == "--all":
+        convert_directory(args[1])
+        return 0
+    if len(args) not in (1, 2):
+        print(__doc__)
+        return 1
+    target = args[1] if len(args) == 2 else os.path.splitext(args[0])[0] + ".565"
+    width, height, size = convert(args[0], target, rle)
+    print("%s: %dx%d, %d bytes" % (target, width, height, size))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
+else:
+    # Loaded by PlatformIO through extra_scripts
+    Import("env")  # noqa: F821
+    convert_directory(os.path.join(env.subst("$PROJECT_DIR"), "data"))  # noqa: F821